@@ -0,0 +1,187 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <wayland-client.h>
+#include "repaint-timing-client-protocol.h"
+
+/* Prints the repaint stage timings the compositor collected for each
+ * output, once or every few seconds. */
+
+static const char * const stage_names[] = {
+	[REPAINT_TIMING_STAGE_VIEW_LIST] = "view list",
+	[REPAINT_TIMING_STAGE_ASSIGN_PLANES] = "assign planes",
+	[REPAINT_TIMING_STAGE_FRAME_CALLBACKS] = "frame callbacks",
+	[REPAINT_TIMING_STAGE_ACCUMULATE_DAMAGE] = "accumulate damage",
+	[REPAINT_TIMING_STAGE_REPAINT_OUTPUT] = "repaint output",
+	[REPAINT_TIMING_STAGE_REPICK] = "repick",
+	[REPAINT_TIMING_STAGE_ANIMATIONS] = "animations",
+};
+
+struct timing_output {
+	struct wl_output *output;
+	uint32_t index;
+	struct wl_list link;
+};
+
+static struct repaint_timing *repaint_timing;
+static struct wl_list output_list;
+static uint32_t output_count;
+static int query_done;
+
+static void
+timing_handle_stage(void *data, struct repaint_timing *repaint_timing,
+		    uint32_t stage, uint32_t samples, uint32_t min,
+		    uint32_t avg, uint32_t p99, uint32_t max)
+{
+	const char *name = "unknown";
+
+	if (stage < sizeof stage_names / sizeof stage_names[0])
+		name = stage_names[stage];
+
+	printf("  %-18s %7u %9.1f %9.1f %9.1f %9.1f\n", name, samples,
+	       min / 1000.0, avg / 1000.0, p99 / 1000.0, max / 1000.0);
+}
+
+static void
+timing_handle_done(void *data, struct repaint_timing *repaint_timing)
+{
+	query_done = 1;
+}
+
+static const struct repaint_timing_listener repaint_timing_listener = {
+	timing_handle_stage,
+	timing_handle_done
+};
+
+static void
+handle_global(void *data, struct wl_registry *registry,
+	      uint32_t name, const char *interface, uint32_t version)
+{
+	struct timing_output *output;
+
+	if (strcmp(interface, "wl_output") == 0) {
+		output = malloc(sizeof *output);
+		if (output == NULL)
+			return;
+		output->output = wl_registry_bind(registry, name,
+						  &wl_output_interface, 1);
+		output->index = output_count++;
+		wl_list_insert(output_list.prev, &output->link);
+	} else if (strcmp(interface, "repaint_timing") == 0) {
+		repaint_timing = wl_registry_bind(registry, name,
+						  &repaint_timing_interface,
+						  1);
+	}
+}
+
+static void
+handle_global_remove(void *data, struct wl_registry *registry, uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	handle_global,
+	handle_global_remove
+};
+
+static int
+print_timings(struct wl_display *display)
+{
+	struct timing_output *output;
+
+	wl_list_for_each(output, &output_list, link) {
+		printf("output %u, in us:\n", output->index);
+		printf("  %-18s %7s %9s %9s %9s %9s\n", "stage", "samples",
+		       "min", "avg", "p99", "max");
+
+		query_done = 0;
+		repaint_timing_query(repaint_timing, output->output);
+		while (!query_done)
+			if (wl_display_roundtrip(display) < 0)
+				return -1;
+	}
+
+	fflush(stdout);
+
+	return 0;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-i seconds]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct wl_display *display;
+	struct wl_registry *registry;
+	int interval = 0, opt;
+
+	while ((opt = getopt(argc, argv, "i:h")) != -1) {
+		switch (opt) {
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	display = wl_display_connect(NULL);
+	if (display == NULL) {
+		fprintf(stderr, "failed to create display: %m\n");
+		return 1;
+	}
+
+	wl_list_init(&output_list);
+	registry = wl_display_get_registry(display);
+	wl_registry_add_listener(registry, &registry_listener, NULL);
+	wl_display_roundtrip(display);
+	if (repaint_timing == NULL) {
+		fprintf(stderr, "display doesn't support repaint_timing\n");
+		return 1;
+	}
+
+	repaint_timing_add_listener(repaint_timing,
+				    &repaint_timing_listener, NULL);
+
+	do {
+		if (print_timings(display) < 0)
+			return 1;
+		if (interval > 0)
+			sleep(interval);
+	} while (interval > 0);
+
+	wl_display_disconnect(display);
+
+	return 0;
+}
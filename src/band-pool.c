@@ -0,0 +1,187 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdlib.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "band-pool.h"
+
+struct band_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+
+	int threads;			/* including the calling thread */
+	pthread_t *workers;
+
+	/* The current job, protected by 'mutex'. */
+	unsigned int generation;
+	band_func_t func;
+	void *data;
+	int bands;
+	int next_band;
+	int bands_done;
+	int quit;
+};
+
+/* Run bands of the current job until there are none left to claim.
+ * Called and returns with the mutex held. */
+static void
+band_pool_work(struct band_pool *pool)
+{
+	band_func_t func = pool->func;
+	void *data = pool->data;
+	int band;
+
+	while (pool->next_band < pool->bands) {
+		band = pool->next_band++;
+
+		pthread_mutex_unlock(&pool->mutex);
+		func(band, data);
+		pthread_mutex_lock(&pool->mutex);
+
+		if (++pool->bands_done == pool->bands)
+			pthread_cond_signal(&pool->done_cond);
+	}
+}
+
+static void *
+band_pool_worker(void *data)
+{
+	struct band_pool *pool = data;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (1) {
+		while (!pool->quit && pool->generation == generation)
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+
+		if (pool->quit)
+			break;
+
+		generation = pool->generation;
+		band_pool_work(pool);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+struct band_pool *
+band_pool_create(int threads)
+{
+	struct band_pool *pool;
+	sigset_t all, old;
+	int i;
+
+	if (threads < 1)
+		threads = 1;
+
+	pool = calloc(1, sizeof *pool);
+	if (!pool)
+		return NULL;
+
+	pool->workers = calloc(threads, sizeof *pool->workers);
+	if (!pool->workers) {
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	/* The thread calling band_pool_run() does its share of the bands,
+	 * so only threads - 1 workers are needed. */
+	pool->threads = 1;
+
+	/* Signals are handled by the main thread through the event loop,
+	 * including those blocked only after the pool is created. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	for (i = 1; i < threads; i++) {
+		if (pthread_create(&pool->workers[i], NULL,
+				   band_pool_worker, pool) != 0)
+			break;
+		pool->threads++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return pool;
+}
+
+void
+band_pool_destroy(struct band_pool *pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 1; i < pool->threads; i++)
+		pthread_join(pool->workers[i], NULL);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->workers);
+	free(pool);
+}
+
+int
+band_pool_get_threads(struct band_pool *pool)
+{
+	return pool ? pool->threads : 1;
+}
+
+void
+band_pool_run(struct band_pool *pool, int bands,
+	      band_func_t func, void *data)
+{
+	int i;
+
+	if (!pool || pool->threads == 1 || bands == 1) {
+		for (i = 0; i < bands; i++)
+			func(i, data);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->func = func;
+	pool->data = data;
+	pool->bands = bands;
+	pool->next_band = 0;
+	pool->bands_done = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work_cond);
+
+	band_pool_work(pool);
+
+	while (pool->bands_done < pool->bands)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef _WESTON_BAND_POOL_H
+#define _WESTON_BAND_POOL_H
+
+/*
+ * A small pool of worker threads for splitting one piece of work into
+ * horizontal bands.  band_pool_run() hands out the bands to the workers
+ * and to the calling thread, and returns once every band is done.  The
+ * band function must only touch state private to its band.
+ */
+
+struct band_pool;
+
+typedef void (*band_func_t)(int band, void *data);
+
+struct band_pool *
+band_pool_create(int threads);
+
+void
+band_pool_destroy(struct band_pool *pool);
+
+int
+band_pool_get_threads(struct band_pool *pool);
+
+void
+band_pool_run(struct band_pool *pool, int bands,
+	      band_func_t func, void *data);
+
+/* Rows [*band_y1, *band_y2) of band 'band' when [y1, y2) is cut into
+ * 'bands' bands of (nearly) equal height. */
+static inline void
+band_get_rows(int y1, int y2, int bands, int band,
+	      int *band_y1, int *band_y2)
+{
+	int h = y2 - y1;
+
+	*band_y1 = y1 + (int) ((long long) h * band / bands);
+	*band_y2 = y1 + (int) ((long long) h * (band + 1) / bands);
+}
+
+#endif
@@ -50,6 +50,7 @@
 #include "udev-seat.h"
 #include "launcher-util.h"
 #include "vaapi-recorder.h"
+#include "presentation_timing-server-protocol.h"
 
 #ifndef DRM_CAP_TIMESTAMP_MONOTONIC
 #define DRM_CAP_TIMESTAMP_MONOTONIC 0x6
@@ -164,7 +165,6 @@ struct drm_output {
 	struct drm_fb *dumb[2];
 	pixman_image_t *image[2];
 	int current_image;
-	pixman_region32_t previous_damage;
 
 	struct vaapi_recorder *recorder;
 	struct wl_listener recorder_frame_listener;
@@ -519,15 +519,6 @@ static void
 drm_output_render_pixman(struct drm_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *ec = output->base.compositor;
-	pixman_region32_t total_damage, previous_damage;
-
-	pixman_region32_init(&total_damage);
-	pixman_region32_init(&previous_damage);
-
-	pixman_region32_copy(&previous_damage, damage);
-
-	pixman_region32_union(&total_damage, damage, &output->previous_damage);
-	pixman_region32_copy(&output->previous_damage, &previous_damage);
 
 	output->current_image ^= 1;
 
@@ -535,10 +526,9 @@ drm_output_render_pixman(struct drm_output *output, pixman_region32_t *damage)
 	pixman_renderer_output_set_buffer(&output->base,
 					  output->image[output->current_image]);
 
-	ec->renderer->repaint_output(&output->base, &total_damage);
-
-	pixman_region32_fini(&total_damage);
-	pixman_region32_fini(&previous_damage);
+	/* The renderer brings the back buffer up to date with the damage
+	 * of the frame painted into the other one. */
+	ec->renderer->repaint_output(&output->base, damage);
 }
 
 static void
@@ -685,7 +675,6 @@ drm_output_start_repaint_loop(struct weston_output *output_base)
 	struct drm_compositor *compositor = (struct drm_compositor *)
 		output_base->compositor;
 	uint32_t fb_id;
-	uint32_t msec;
 	struct timespec ts;
 
 	if (output->destroy_pending)
@@ -708,9 +697,21 @@ drm_output_start_repaint_loop(struct weston_output *output_base)
 
 finish_frame:
 	/* if we cannot page-flip, immediately finish frame */
-	clock_gettime(compositor->clock, &ts);
-	msec = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
-	weston_output_finish_frame(output_base, msec);
+	weston_compositor_read_presentation_clock(&compositor->base, &ts);
+	weston_output_finish_frame(output_base, &ts, 0);
+}
+
+/* Extend the 32-bit vblank sequence number of a DRM event to the 64-bit
+ * output->msc, allowing for wrap-around. */
+static void
+drm_output_update_msc(struct drm_output *output, unsigned int seq)
+{
+	uint64_t msc_hi = output->base.msc >> 32;
+
+	if (seq < (output->base.msc & 0xffffffff))
+		msc_hi++;
+
+	output->base.msc = (msc_hi << 32) + seq;
 }
 
 static void
@@ -719,8 +720,12 @@ vblank_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec,
 {
 	struct drm_sprite *s = (struct drm_sprite *)data;
 	struct drm_output *output = s->output;
-	uint32_t msecs;
+	struct timespec ts;
+	uint32_t flags = PRESENTATION_FEEDBACK_KIND_VSYNC |
+			 PRESENTATION_FEEDBACK_KIND_HW_COMPLETION |
+			 PRESENTATION_FEEDBACK_KIND_HW_CLOCK;
 
+	drm_output_update_msc(output, frame);
 	output->vblank_pending = 0;
 
 	drm_output_release_fb(output, s->current);
@@ -728,8 +733,9 @@ vblank_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec,
 	s->next = NULL;
 
 	if (!output->page_flip_pending) {
-		msecs = sec * 1000 + usec / 1000;
-		weston_output_finish_frame(&output->base, msecs);
+		ts.tv_sec = sec;
+		ts.tv_nsec = usec * 1000;
+		weston_output_finish_frame(&output->base, &ts, flags);
 	}
 }
 
@@ -741,7 +747,12 @@ page_flip_handler(int fd, unsigned int frame,
 		  unsigned int sec, unsigned int usec, void *data)
 {
 	struct drm_output *output = (struct drm_output *) data;
-	uint32_t msecs;
+	struct timespec ts;
+	uint32_t flags = PRESENTATION_FEEDBACK_KIND_VSYNC |
+			 PRESENTATION_FEEDBACK_KIND_HW_COMPLETION |
+			 PRESENTATION_FEEDBACK_KIND_HW_CLOCK;
+
+	drm_output_update_msc(output, frame);
 
 	/* We don't set page_flip_pending on start_repaint_loop, in that case
 	 * we just want to page flip to the current buffer to get an accurate
@@ -757,8 +768,9 @@ page_flip_handler(int fd, unsigned int frame,
 	if (output->destroy_pending)
 		drm_output_destroy(&output->base);
 	else if (!output->vblank_pending) {
-		msecs = sec * 1000 + usec / 1000;
-		weston_output_finish_frame(&output->base, msecs);
+		ts.tv_sec = sec;
+		ts.tv_nsec = usec * 1000;
+		weston_output_finish_frame(&output->base, &ts, flags);
 
 		/* We can't call this from frame_notify, because the output's
 		 * repaint needed flag is cleared just after that */
@@ -1292,6 +1304,8 @@ init_drm(struct drm_compositor *ec, struct udev_device *device)
 	else
 		ec->clock = CLOCK_REALTIME;
 
+	weston_compositor_set_presentation_clock(&ec->base, ec->clock);
+
 	return 0;
 }
 
@@ -1591,9 +1605,6 @@ drm_output_init_pixman(struct drm_output *output, struct drm_compositor *c)
 	if (pixman_renderer_output_create(&output->base) < 0)
 		goto err;
 
-	pixman_region32_init_rect(&output->previous_damage,
-				  output->base.x, output->base.y, output->base.width, output->base.height);
-
 	return 0;
 
 err:
@@ -1616,7 +1627,6 @@ drm_output_fini_pixman(struct drm_output *output)
 	unsigned int i;
 
 	pixman_renderer_output_destroy(&output->base);
-	pixman_region32_fini(&output->previous_damage);
 
 	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
 		drm_fb_destroy_dumb(output->dumb[i]);
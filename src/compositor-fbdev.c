@@ -114,12 +114,10 @@ to_fbdev_compositor(struct weston_compositor *base)
 static void
 fbdev_output_start_repaint_loop(struct weston_output *output)
 {
-	uint32_t msec;
-	struct timeval tv;
+	struct timespec ts;
 
-	gettimeofday(&tv, NULL);
-	msec = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-	weston_output_finish_frame(output, msec);
+	weston_compositor_read_presentation_clock(output->compositor, &ts);
+	weston_output_finish_frame(output, &ts, 0);
 }
 
 static void
@@ -130,6 +128,14 @@ fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damag
 	pixman_box32_t *rects;
 	int nrects, i, src_x, src_y, x1, y1, x2, y2, width, height;
 
+	/* Without rotation, the renderer paints straight into the frame
+	 * buffer. */
+	if (!output->shadow_surface) {
+		pixman_renderer_output_set_buffer(base, output->hw_surface);
+		ec->renderer->repaint_output(base, damage);
+		goto out;
+	}
+
 	/* Repaint the damaged region onto the back buffer. */
 	pixman_renderer_output_set_buffer(base, output->shadow_surface);
 	ec->renderer->repaint_output(base, damage);
@@ -181,6 +187,7 @@ fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damag
 			y2 - y1 /* height */);
 	}
 
+out:
 	/* Update the damage region. */
 	pixman_region32_subtract(&ec->primary_plane.damage,
 	                         &ec->primary_plane.damage, damage);
@@ -190,10 +197,10 @@ fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damag
 	 * compositor. FBIO_WAITFORVSYNC blocks and FB_ACTIVATE_VBL requires
 	 * panning, which is broken in most kernel drivers.
 	 *
-	 * Finish the frame synchronised to the specified refresh rate. The
-	 * refresh rate is given in mHz and the interval in ms. */
+	 * Finish the frame at the next vblank of the specified refresh
+	 * rate, counted from the end of the previous frame. */
 	wl_event_source_timer_update(output->finish_frame_timer,
-	                             1000000 / output->mode.refresh);
+	                             weston_output_get_vblank_delay(base));
 }
 
 static int
@@ -212,7 +219,7 @@ fbdev_output_repaint(struct weston_output *base, pixman_region32_t *damage)
 	                         &ec->primary_plane.damage, damage);
 
 		wl_event_source_timer_update(output->finish_frame_timer,
-	                             1000000 / output->mode.refresh);
+	                             weston_output_get_vblank_delay(base));
 	}
 
 	return 0;
@@ -222,8 +229,12 @@ static int
 finish_frame_handler(void *data)
 {
 	struct fbdev_output *output = data;
+	struct timespec ts;
 
-	fbdev_output_start_repaint_loop(&output->base);
+	output->base.msc++;
+	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
+	weston_output_finish_frame(&output->base, &ts,
+				   WESTON_FINISH_FRAME_VBLANK);
 
 	return 1;
 }
@@ -607,20 +618,23 @@ fbdev_output_create(struct fbdev_compositor *compositor,
 
 	bytes_per_pixel = output->fb_info.bits_per_pixel / 8;
 
-	output->shadow_buf = malloc(width * height * bytes_per_pixel);
-	output->shadow_surface =
-		pixman_image_create_bits(output->fb_info.pixel_format,
-		                         shadow_width, shadow_height,
-		                         output->shadow_buf,
-		                         shadow_width * bytes_per_pixel);
-	if (output->shadow_buf == NULL || output->shadow_surface == NULL) {
-		weston_log("Failed to create surface for frame buffer.\n");
-		goto out_hw_surface;
-	}
+	/* Rotated outputs are painted into a shadow buffer first, which is
+	 * rotated into the frame buffer.  No need for it on normal ones. */
+	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		output->shadow_buf = malloc(width * height * bytes_per_pixel);
+		output->shadow_surface =
+			pixman_image_create_bits(output->fb_info.pixel_format,
+						 shadow_width, shadow_height,
+						 output->shadow_buf,
+						 shadow_width * bytes_per_pixel);
+		if (output->shadow_buf == NULL ||
+		    output->shadow_surface == NULL) {
+			weston_log("Failed to create surface for frame buffer.\n");
+			goto out_hw_surface;
+		}
 
-	/* No need in transform for normal output */
-	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL)
 		pixman_image_set_transform(output->shadow_surface, &transform);
+	}
 
 	if (compositor->use_pixman) {
 		if (pixman_renderer_output_create(&output->base) < 0)
@@ -649,7 +663,8 @@ fbdev_output_create(struct fbdev_compositor *compositor,
 	return 0;
 
 out_shadow_surface:
-	pixman_image_unref(output->shadow_surface);
+	if (output->shadow_surface)
+		pixman_image_unref(output->shadow_surface);
 	output->shadow_surface = NULL;
 out_hw_surface:
 	free(output->shadow_buf);
@@ -267,9 +267,14 @@ static void
 frame_done(void *data, struct wl_callback *callback, uint32_t time)
 {
 	struct weston_output *output = data;
+	struct timespec ts;
 
 	wl_callback_destroy(callback);
-	weston_output_finish_frame(output, time);
+
+	/* XXX: use the presentation extension for proper timings */
+	weston_compositor_read_presentation_clock(output->compositor, &ts);
+	output->msc++;
+	weston_output_finish_frame(output, &ts, WESTON_FINISH_FRAME_VBLANK);
 }
 
 static const struct wl_callback_listener frame_listener = {
@@ -338,12 +338,10 @@ x11_input_destroy(struct x11_compositor *compositor)
 static void
 x11_output_start_repaint_loop(struct weston_output *output)
 {
-	uint32_t msec;
-	struct timeval tv;
+	struct timespec ts;
 
-	gettimeofday(&tv, NULL);
-	msec = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-	weston_output_finish_frame(output, msec);
+	weston_compositor_read_presentation_clock(output->compositor, &ts);
+	weston_output_finish_frame(output, &ts, 0);
 }
 
 static int
@@ -358,7 +356,8 @@ x11_output_repaint_gl(struct weston_output *output_base,
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 
-	wl_event_source_timer_update(output->finish_frame_timer, 10);
+	wl_event_source_timer_update(output->finish_frame_timer,
+				     weston_output_get_vblank_delay(output_base));
 	return 0;
 }
 
@@ -444,7 +443,8 @@ x11_output_repaint_shm(struct weston_output *output_base,
 		free(err);
 	}
 
-	wl_event_source_timer_update(output->finish_frame_timer, 10);
+	wl_event_source_timer_update(output->finish_frame_timer,
+				     weston_output_get_vblank_delay(output_base));
 	return 0;
 }
 
@@ -452,8 +452,12 @@ static int
 finish_frame_handler(void *data)
 {
 	struct x11_output *output = data;
+	struct timespec ts;
 
-	x11_output_start_repaint_loop(&output->base);
+	output->base.msc++;
+	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
+	weston_output_finish_frame(&output->base, &ts,
+				   WESTON_FINISH_FRAME_VBLANK);
 
 	return 1;
 }
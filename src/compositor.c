@@ -53,7 +53,11 @@
 #endif
 
 #include "compositor.h"
+#include "pick-grid.h"
+#include "tile-damage.h"
+#include "weston-trace.h"
 #include "scaler-server-protocol.h"
+#include "presentation_timing-server-protocol.h"
 #include "../shared/os-compatibility.h"
 #include "git-version.h"
 #include "version.h"
@@ -95,6 +99,13 @@ weston_output_transform_scale_init(struct weston_output *output,
 static void
 weston_compositor_build_view_list(struct weston_compositor *compositor);
 
+static void
+weston_compositor_invalidate_pick_grid(struct weston_compositor *compositor);
+
+static void
+weston_compositor_add_pick_dirty_view(struct weston_compositor *compositor,
+				      struct weston_view *view);
+
 WL_EXPORT int
 weston_output_switch_mode(struct weston_output *output, struct weston_mode *mode,
 		int32_t scale, enum weston_mode_switch_op op)
@@ -336,6 +347,25 @@ empty_region(pixman_region32_t *region)
 	pixman_region32_init(region);
 }
 
+/* Damage regions with more rectangles than this are coarsened to tiles */
+#define DEFAULT_DAMAGE_TILE_THRESHOLD 64
+
+/* Coarsen a surface damage region once it grows past the threshold.  It
+ * is brought down to half the threshold so that the following damage
+ * requests do not coarsen it again right away. */
+static void
+weston_compositor_simplify_damage(struct weston_compositor *ec,
+				  pixman_region32_t *damage)
+{
+	int32_t threshold = ec->damage_tile_threshold;
+
+	if (threshold <= 0 || pixman_region32_n_rects(damage) <= threshold)
+		return;
+
+	tile_damage_simplify(ec->damage_tiles, damage,
+			     threshold > 1 ? threshold / 2 : 1);
+}
+
 static void
 region_init_infinite(pixman_region32_t *region)
 {
@@ -453,6 +483,7 @@ weston_view_create(struct weston_surface *surface)
 	wl_list_init(&view->geometry.child_list);
 	pixman_region32_init(&view->transform.boundingbox);
 	view->transform.dirty = 1;
+	view->transform.generation = ++surface->compositor->geometry_generation;
 
 	view->output = NULL;
 
@@ -497,6 +528,8 @@ weston_surface_create(struct weston_compositor *compositor)
 	wl_list_init(&surface->views);
 
 	wl_list_init(&surface->frame_callback_list);
+	wl_list_init(&surface->frame_throttle_link);
+	wl_list_init(&surface->feedback_list);
 
 	surface->pending.buffer_destroy_listener.notify =
 		surface_handle_pending_buffer_destroy;
@@ -504,6 +537,7 @@ weston_surface_create(struct weston_compositor *compositor)
 	pixman_region32_init(&surface->pending.opaque);
 	region_init_infinite(&surface->pending.input);
 	wl_list_init(&surface->pending.frame_callback_list);
+	wl_list_init(&surface->pending.feedback_list);
 
 	wl_list_init(&surface->subsurface_list);
 	wl_list_init(&surface->subsurface_list_pending);
@@ -1057,6 +1091,10 @@ weston_view_update_transform(struct weston_view *view)
 
 	view->transform.dirty = 0;
 
+	/* The grid was built with this view tested everywhere. */
+	if (view->surface->compositor->pick_grid_has_dirty)
+		weston_compositor_invalidate_pick_grid(view->surface->compositor);
+
 	weston_view_damage_below(view);
 
 	pixman_region32_fini(&view->transform.boundingbox);
@@ -1099,6 +1137,10 @@ weston_view_geometry_dirty(struct weston_view *view)
 		return;
 
 	view->transform.dirty = 1;
+	view->transform.generation =
+		++view->surface->compositor->geometry_generation;
+
+	weston_compositor_add_pick_dirty_view(view->surface->compositor, view);
 
 	wl_list_for_each(child, &view->geometry.child_list,
 			 geometry.parent_link)
@@ -1234,6 +1276,7 @@ weston_view_set_transform_parent(struct weston_view *view,
 	}
 
 	view->geometry.parent = parent;
+	view->surface->compositor->view_list_dirty = 1;
 
 	view->geometry.parent_destroy_listener.notify =
 		transform_parent_handle_parent_destroy;
@@ -1333,23 +1376,154 @@ weston_compositor_get_time(void)
        return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
+/* Beyond this many views moving since the pick grid was built, rebuild
+ * it rather than testing them all on every pick. */
+#define PICK_MAX_DIRTY_VIEWS 16
+
+static void
+weston_compositor_invalidate_pick_grid(struct weston_compositor *compositor)
+{
+	compositor->pick_grid_valid = 0;
+	compositor->pick_grid_has_dirty = 0;
+	compositor->pick_dirty_views.size = 0;
+}
+
+static void
+weston_compositor_add_pick_dirty_view(struct weston_compositor *compositor,
+				      struct weston_view *view)
+{
+	struct weston_view **entry;
+
+	if (!compositor->pick_grid_valid)
+		return;
+
+	if (compositor->pick_dirty_views.size >=
+	    PICK_MAX_DIRTY_VIEWS * sizeof *entry) {
+		weston_compositor_invalidate_pick_grid(compositor);
+		return;
+	}
+
+	entry = wl_array_add(&compositor->pick_dirty_views, sizeof *entry);
+	if (entry)
+		*entry = view;
+	else
+		weston_compositor_invalidate_pick_grid(compositor);
+}
+
+static void
+weston_compositor_build_pick_grid(struct weston_compositor *compositor)
+{
+	static const struct pick_grid_box always = PICK_GRID_BOX_ALWAYS;
+	struct weston_view *view, **entry;
+	struct pick_grid_box *box;
+	pixman_box32_t *extents;
+	uint32_t count = 0;
+
+	weston_compositor_invalidate_pick_grid(compositor);
+	compositor->pick_views.size = 0;
+	compositor->pick_boxes.size = 0;
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		entry = wl_array_add(&compositor->pick_views, sizeof *entry);
+		box = wl_array_add(&compositor->pick_boxes, sizeof *box);
+		if (!entry || !box)
+			return;
+
+		*entry = view;
+		view->pick_index = count++;
+
+		/* The bounding box is stale until the next repaint */
+		if (view->transform.dirty) {
+			*box = always;
+			compositor->pick_grid_has_dirty = 1;
+			continue;
+		}
+
+		extents = pixman_region32_extents(&view->transform.boundingbox);
+		box->x1 = extents->x1;
+		box->y1 = extents->y1;
+		box->x2 = extents->x2;
+		box->y2 = extents->y2;
+	}
+
+	if (pick_grid_build(compositor->pick_grid,
+			    compositor->pick_boxes.data, count) < 0)
+		return;
+
+	compositor->pick_grid_valid = 1;
+}
+
+static int
+view_contains_point(struct weston_view *view,
+		    wl_fixed_t x, wl_fixed_t y,
+		    wl_fixed_t *vx, wl_fixed_t *vy)
+{
+	weston_view_from_global_fixed(view, x, y, vx, vy);
+
+	return pixman_region32_contains_point(&view->surface->input,
+					      wl_fixed_to_int(*vx),
+					      wl_fixed_to_int(*vy),
+					      NULL);
+}
+
 WL_EXPORT struct weston_view *
 weston_compositor_pick_view(struct weston_compositor *compositor,
 			    wl_fixed_t x, wl_fixed_t y,
 			    wl_fixed_t *vx, wl_fixed_t *vy)
 {
-	struct weston_view *view;
+	struct weston_view *view, *pick = NULL;
+	struct weston_view **views, **dirty, **end;
+	struct pick_grid_iter iter;
+	wl_fixed_t dx, dy;
+	uint32_t i, count;
 
-	wl_list_for_each(view, &compositor->view_list, link) {
-		weston_view_from_global_fixed(view, x, y, vx, vy);
-		if (pixman_region32_contains_point(&view->surface->input,
-						   wl_fixed_to_int(*vx),
-						   wl_fixed_to_int(*vy),
-						   NULL))
-			return view;
+	if (!compositor->pick_grid_valid)
+		weston_compositor_build_pick_grid(compositor);
+
+	if (!compositor->pick_grid_valid) {
+		wl_list_for_each(view, &compositor->view_list, link) {
+			if (view_contains_point(view, x, y, vx, vy))
+				return view;
+		}
+
+		return NULL;
 	}
 
-	return NULL;
+	/* The grid returns the candidates in stacking order, so the first
+	 * one that contains the point is what the linear walk would find. */
+	views = compositor->pick_views.data;
+	pick_grid_query(compositor->pick_grid,
+			wl_fixed_to_int(x), wl_fixed_to_int(y), &iter);
+	while (pick_grid_iter_next(&iter, &i)) {
+		if (view_contains_point(views[i], x, y, vx, vy)) {
+			pick = views[i];
+			break;
+		}
+	}
+
+	/* Views that moved since the grid was built may now be on top. */
+	count = compositor->pick_views.size / sizeof *views;
+	dirty = compositor->pick_dirty_views.data;
+	end = dirty + compositor->pick_dirty_views.size / sizeof *dirty;
+	for (; dirty < end; dirty++) {
+		view = *dirty;
+		if (view->pick_index >= count || views[view->pick_index] != view)
+			continue;
+		if (pick && view->pick_index >= pick->pick_index)
+			continue;
+		if (view_contains_point(view, x, y, &dx, &dy)) {
+			pick = view;
+			*vx = dx;
+			*vy = dy;
+		}
+	}
+
+	if (!pick) {
+		*vx = 0;
+		*vy = 0;
+	}
+
+	return pick;
 }
 
 static void
@@ -1373,6 +1547,8 @@ weston_view_unmap(struct weston_view *view)
 		return;
 
 	weston_view_damage_below(view);
+	view->surface->compositor->view_list_dirty = 1;
+	weston_compositor_invalidate_pick_grid(view->surface->compositor);
 	view->output = NULL;
 	view->plane = NULL;
 	wl_list_remove(&view->layer_link);
@@ -1417,6 +1593,75 @@ struct weston_frame_callback {
 	struct wl_list link;
 };
 
+struct weston_presentation_feedback {
+	struct wl_resource *resource;
+
+	/* in surface pending, surface, subsurface cached or output list */
+	struct wl_list link;
+};
+
+static void
+weston_presentation_feedback_discard(
+		struct weston_presentation_feedback *feedback)
+{
+	presentation_feedback_send_discarded(feedback->resource);
+	wl_resource_destroy(feedback->resource);
+}
+
+static void
+weston_presentation_feedback_discard_list(struct wl_list *list)
+{
+	struct weston_presentation_feedback *feedback, *tmp;
+
+	wl_list_for_each_safe(feedback, tmp, list, link)
+		weston_presentation_feedback_discard(feedback);
+}
+
+static void
+weston_presentation_feedback_present(
+		struct weston_presentation_feedback *feedback,
+		struct weston_output *output,
+		uint32_t refresh_nsec,
+		const struct timespec *ts,
+		uint64_t seq,
+		uint32_t flags)
+{
+	struct wl_client *client = wl_resource_get_client(feedback->resource);
+	struct wl_resource *o;
+	uint64_t secs = ts->tv_sec;
+
+	wl_resource_for_each(o, &output->resource_list) {
+		if (wl_resource_get_client(o) != client)
+			continue;
+
+		presentation_feedback_send_sync_output(feedback->resource, o);
+	}
+
+	presentation_feedback_send_presented(feedback->resource,
+					     secs >> 32, secs & 0xffffffff,
+					     ts->tv_nsec,
+					     refresh_nsec,
+					     seq >> 32, seq & 0xffffffff,
+					     flags);
+	wl_resource_destroy(feedback->resource);
+}
+
+static void
+weston_presentation_feedback_present_list(struct wl_list *list,
+					  struct weston_output *output,
+					  uint32_t refresh_nsec,
+					  const struct timespec *ts,
+					  uint64_t seq,
+					  uint32_t flags)
+{
+	struct weston_presentation_feedback *feedback, *tmp;
+
+	wl_list_for_each_safe(feedback, tmp, list, link)
+		weston_presentation_feedback_present(feedback, output,
+						     refresh_nsec, ts, seq,
+						     flags);
+}
+
 WL_EXPORT void
 weston_view_destroy(struct weston_view *view)
 {
@@ -1429,6 +1674,13 @@ weston_view_destroy(struct weston_view *view)
 		weston_compositor_build_view_list(view->surface->compositor);
 	}
 
+	/* A view that is still in a layer may be freed and its address
+	 * reused before the next repaint, so don't trust the snapshot. */
+	if (!wl_list_empty(&view->layer_link))
+		view->surface->compositor->view_list_dirty = 1;
+
+	weston_compositor_invalidate_pick_grid(view->surface->compositor);
+
 	wl_list_remove(&view->link);
 	wl_list_remove(&view->layer_link);
 
@@ -1462,6 +1714,8 @@ weston_surface_destroy(struct weston_surface *surface)
 	wl_list_for_each_safe(cb, next,
 			      &surface->pending.frame_callback_list, link)
 		wl_resource_destroy(cb->resource);
+	weston_presentation_feedback_discard_list(
+					&surface->pending.feedback_list);
 
 	pixman_region32_fini(&surface->pending.input);
 	pixman_region32_fini(&surface->pending.opaque);
@@ -1478,6 +1732,8 @@ weston_surface_destroy(struct weston_surface *surface)
 
 	wl_list_for_each_safe(cb, next, &surface->frame_callback_list, link)
 		wl_resource_destroy(cb->resource);
+	wl_list_remove(&surface->frame_throttle_link);
+	weston_presentation_feedback_discard_list(&surface->feedback_list);
 
 	free(surface);
 }
@@ -1504,7 +1760,7 @@ weston_buffer_destroy_handler(struct wl_listener *listener, void *data)
 	free(buffer);
 }
 
-struct weston_buffer *
+WL_EXPORT struct weston_buffer *
 weston_buffer_from_resource(struct wl_resource *resource)
 {
 	struct weston_buffer *buffer;
@@ -1546,6 +1802,9 @@ WL_EXPORT void
 weston_buffer_reference(struct weston_buffer_reference *ref,
 			struct weston_buffer *buffer)
 {
+	weston_trace(WESTON_TRACE_BUFFER_REFERENCE, 0,
+		     (uintptr_t) ref->buffer, (uintptr_t) buffer);
+
 	if (ref->buffer && buffer != ref->buffer) {
 		ref->buffer->busy_count--;
 		if (ref->buffer->busy_count == 0) {
@@ -1600,6 +1859,61 @@ weston_output_damage(struct weston_output *output)
 	weston_output_schedule_repaint(output);
 }
 
+/* Bring output damage down to at most 'max_rects' rectangles, giving up
+ * precision tile by tile.  Renderers call this with the rectangle count
+ * that suits the way they walk damage; it does nothing if damage tiling
+ * is disabled. */
+WL_EXPORT void
+weston_output_simplify_damage(struct weston_output *output,
+			      pixman_region32_t *damage, int max_rects)
+{
+	int32_t threshold = output->compositor->damage_tile_threshold;
+
+	if (threshold <= 0 || output->damage_tiles == NULL)
+		return;
+
+	if (max_rects > threshold)
+		max_rects = threshold;
+
+	tile_damage_simplify(output->damage_tiles, damage, max_rects);
+}
+
+/* Read back a rectangle of what was last drawn on the output, as
+ * read_pixels() does.  'done' gets the pixels, which are only valid
+ * during the call, or NULL if they could not be read; it is not called
+ * if this returns -1.  Renderers without asynchronous readback read
+ * the pixels and call 'done' right away. */
+WL_EXPORT int
+weston_output_read_pixels_async(struct weston_output *output,
+				pixman_format_code_t format,
+				uint32_t x, uint32_t y,
+				uint32_t width, uint32_t height,
+				weston_read_pixels_done_func_t done,
+				void *data)
+{
+	struct weston_renderer *renderer = output->compositor->renderer;
+	void *pixels;
+
+	if (renderer->read_pixels_async)
+		return renderer->read_pixels_async(output, format, x, y,
+						   width, height, done, data);
+
+	pixels = malloc(width * height * (PIXMAN_FORMAT_BPP(format) / 8));
+	if (!pixels)
+		return -1;
+
+	if (renderer->read_pixels(output, format, pixels,
+				  x, y, width, height) < 0) {
+		free(pixels);
+		return -1;
+	}
+
+	done(pixels, data);
+	free(pixels);
+
+	return 0;
+}
+
 static void
 surface_flush_damage(struct weston_surface *surface)
 {
@@ -1610,31 +1924,38 @@ surface_flush_damage(struct weston_surface *surface)
 	empty_region(&surface->damage);
 }
 
+/* Surface damage of the view in plane coordinates */
 static void
-view_accumulate_damage(struct weston_view *view,
-		       pixman_region32_t *opaque)
+view_compute_plane_damage(struct weston_view *view, pixman_region32_t *damage)
 {
-	pixman_region32_t damage;
-
-	pixman_region32_init(&damage);
 	if (view->transform.enabled) {
 		pixman_box32_t *extents;
 
 		extents = pixman_region32_extents(&view->surface->damage);
+		pixman_region32_fini(damage);
 		view_compute_bbox(view, extents->x1, extents->y1,
 				  extents->x2 - extents->x1,
 				  extents->y2 - extents->y1,
-				  &damage);
-		pixman_region32_translate(&damage,
+				  damage);
+		pixman_region32_translate(damage,
 					  -view->plane->x,
 					  -view->plane->y);
 	} else {
-		pixman_region32_copy(&damage, &view->surface->damage);
-		pixman_region32_translate(&damage,
+		pixman_region32_copy(damage, &view->surface->damage);
+		pixman_region32_translate(damage,
 					  view->geometry.x - view->plane->x,
 					  view->geometry.y - view->plane->y);
 	}
+}
 
+static void
+view_accumulate_damage(struct weston_view *view,
+		       pixman_region32_t *opaque)
+{
+	pixman_region32_t damage;
+
+	pixman_region32_init(&damage);
+	view_compute_plane_damage(view, &damage);
 	pixman_region32_subtract(&damage, &damage, opaque);
 	pixman_region32_union(&view->plane->damage,
 			      &view->plane->damage, &damage);
@@ -1643,8 +1964,48 @@ view_accumulate_damage(struct weston_view *view,
 	pixman_region32_union(opaque, opaque, &view->transform.opaque);
 }
 
+static int
+view_is_on_output(struct weston_view *view, struct weston_output *output)
+{
+	return view->output_mask & (1 << output->id);
+}
+
+/* Views that are on no output at all are handled along with every
+ * output, so that their buffers still get released. */
+static int
+view_in_repaint_scope(struct weston_view *view, struct weston_output *output)
+{
+	return view->output_mask == 0 || view_is_on_output(view, output);
+}
+
+/* The surface damage is consumed when the surface is flushed, so views of
+ * it that are only on other outputs must take their share now.  Their
+ * occlusion is not known here, so the damage is not clipped. */
+static void
+surface_accumulate_damage_elsewhere(struct weston_surface *surface,
+				    struct weston_output *output)
+{
+	struct weston_view *view;
+	pixman_region32_t damage;
+
+	wl_list_for_each(view, &surface->views, surface_link) {
+		if (view_in_repaint_scope(view, output) || !view->plane)
+			continue;
+
+		pixman_region32_init(&damage);
+		view_compute_plane_damage(view, &damage);
+		pixman_region32_union(&view->plane->damage,
+				      &view->plane->damage, &damage);
+		pixman_region32_fini(&damage);
+	}
+}
+
+/* Only the views on the output being repainted are looked at.  Plane damage
+ * is still global, so damage of views spanning several outputs reaches the
+ * others through it. */
 static void
-compositor_accumulate_damage(struct weston_compositor *ec)
+compositor_accumulate_damage(struct weston_compositor *ec,
+			     struct weston_output *output)
 {
 	struct weston_plane *plane;
 	struct weston_view *ev;
@@ -1658,7 +2019,8 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 		pixman_region32_init(&opaque);
 
 		wl_list_for_each(ev, &ec->view_list, link) {
-			if (ev->plane != plane)
+			if (ev->plane != plane ||
+			    !view_in_repaint_scope(ev, output))
 				continue;
 
 			view_accumulate_damage(ev, &opaque);
@@ -1674,10 +2036,14 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 		ev->surface->touched = 0;
 
 	wl_list_for_each(ev, &ec->view_list, link) {
-		if (ev->surface->touched)
+		if (ev->surface->touched ||
+		    !view_in_repaint_scope(ev, output))
 			continue;
 		ev->surface->touched = 1;
 
+		if (pixman_region32_not_empty(&ev->surface->damage))
+			surface_accumulate_damage_elsewhere(ev->surface, output);
+
 		surface_flush_damage(ev->surface);
 
 		/* Both the renderer and the backend have seen the buffer
@@ -1792,23 +2158,238 @@ view_list_add(struct weston_compositor *compositor,
 static void
 weston_compositor_build_view_list(struct weston_compositor *compositor)
 {
-	struct weston_view *view;
+	struct weston_view *view, **entry;
 	struct weston_layer *layer;
+	int snapshot_complete = 1;
 
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list, layer_link)
 			surface_stash_subsurface_views(view->surface);
 
+	compositor->view_list_layer_views.size = 0;
 	wl_list_init(&compositor->view_list);
 	wl_list_for_each(layer, &compositor->layer_list, link) {
 		wl_list_for_each(view, &layer->view_list, layer_link) {
 			view_list_add(compositor, view);
+
+			entry = wl_array_add(&compositor->view_list_layer_views,
+					     sizeof *entry);
+			if (entry)
+				*entry = view;
+			else
+				snapshot_complete = 0;
 		}
 	}
 
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list, layer_link)
 			surface_free_unused_subsurface_views(view->surface);
+
+	compositor->view_list_rebuilds++;
+	compositor->view_list_dirty = !snapshot_complete;
+	weston_compositor_invalidate_pick_grid(compositor);
+}
+
+/* The shells add, remove and restack views by editing the layer lists
+ * directly, so compare the layers against the snapshot taken by the last
+ * rebuild.  Everything that changes the subsurface part of the list sets
+ * view_list_dirty instead. */
+static int
+weston_compositor_view_list_is_stale(struct weston_compositor *compositor)
+{
+	struct weston_view *view, **snapshot, **end;
+	struct weston_layer *layer;
+
+	if (compositor->view_list_dirty)
+		return 1;
+
+	snapshot = compositor->view_list_layer_views.data;
+	end = (void *) ((char *) snapshot +
+			compositor->view_list_layer_views.size);
+
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		wl_list_for_each(view, &layer->view_list, layer_link) {
+			if (snapshot == end || *snapshot != view)
+				return 1;
+			snapshot++;
+		}
+	}
+
+	return snapshot != end;
+}
+
+static void
+weston_compositor_update_view_list(struct weston_compositor *compositor)
+{
+	struct weston_view *view;
+
+	if (weston_compositor_view_list_is_stale(compositor)) {
+		weston_compositor_build_view_list(compositor);
+		return;
+	}
+
+	compositor->view_list_rebuilds_skipped++;
+	wl_list_for_each(view, &compositor->view_list, link)
+		weston_view_update_transform(view);
+}
+
+static int64_t
+timespec_sub_to_usec(const struct timespec *a, const struct timespec *b)
+{
+	return (int64_t) (a->tv_sec - b->tv_sec) * 1000000 +
+		(a->tv_nsec - b->tv_nsec) / 1000;
+}
+
+/* Records the time since *begin for the stage and restarts the clock. */
+static void
+weston_output_end_repaint_stage(struct weston_output *output,
+				enum weston_repaint_stage stage,
+				struct timespec *begin)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	weston_output_record_repaint_stage(output, stage, begin, &end);
+	*begin = end;
+}
+
+#define DEFAULT_HIDDEN_FRAME_INTERVAL 1000 /* ms */
+
+static int
+view_is_occluded(struct weston_view *view, struct weston_output *output)
+{
+	pixman_region32_t visible;
+	int occluded;
+
+	pixman_region32_init(&visible);
+	pixman_region32_intersect(&visible, &view->transform.boundingbox,
+				  &output->region);
+	pixman_region32_subtract(&visible, &visible, &view->clip);
+	if (view->plane)
+		pixman_region32_subtract(&visible, &visible,
+					 &view->plane->clip);
+	occluded = !pixman_region32_not_empty(&visible);
+	pixman_region32_fini(&visible);
+
+	return occluded;
+}
+
+/* A surface is hidden when each of its views is off-screen or covered by
+ * opaque views on the output being repainted.  A view spanning several
+ * outputs counts as visible, since its clip is only known for one of
+ * them at a time.  Must be called after the damage was accumulated. */
+static int
+surface_is_hidden(struct weston_surface *surface,
+		  struct weston_output *output)
+{
+	struct weston_view *view;
+
+	wl_list_for_each(view, &surface->views, surface_link) {
+		if (view->output_mask == 0)
+			continue;
+		if (view->output_mask != (1u << output->id) ||
+		    !view_is_occluded(view, output))
+			return 0;
+	}
+
+	return 1;
+}
+
+static void
+surface_send_frame_callbacks(struct weston_surface *surface, uint32_t msecs)
+{
+	struct weston_frame_callback *cb, *next;
+
+	wl_list_for_each_safe(cb, next, &surface->frame_callback_list, link) {
+		wl_callback_send_done(cb->resource, msecs);
+		wl_resource_destroy(cb->resource);
+	}
+}
+
+static void
+weston_compositor_update_frame_throttle(struct weston_compositor *ec,
+					const struct timespec *now)
+{
+	struct weston_surface *surface;
+	int64_t wait, next = 0;
+	int found = 0;
+
+	wl_list_for_each(surface, &ec->frame_throttle_list,
+			 frame_throttle_link) {
+		wait = (int64_t) ec->hidden_frame_interval * 1000 -
+			timespec_sub_to_usec(now, &surface->frame_callback_time);
+		if (wait < 0)
+			wait = 0;
+		if (!found || wait < next)
+			next = wait;
+		found = 1;
+	}
+
+	/* A timeout of 0 disarms the timer, so overdue surfaces still
+	 * wait a millisecond. */
+	if (!found)
+		wl_event_source_timer_update(ec->frame_throttle_timer, 0);
+	else
+		wl_event_source_timer_update(ec->frame_throttle_timer,
+					     next / 1000 + 1);
+}
+
+static int
+frame_throttle_timer_handler(void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_surface *surface, *next;
+	struct timespec now;
+	uint32_t msecs;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	msecs = now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+	wl_list_for_each_safe(surface, next, &ec->frame_throttle_list,
+			      frame_throttle_link) {
+		if (timespec_sub_to_usec(&now, &surface->frame_callback_time) <
+		    (int64_t) ec->hidden_frame_interval * 1000)
+			continue;
+
+		wl_list_remove(&surface->frame_throttle_link);
+		wl_list_init(&surface->frame_throttle_link);
+		surface->frame_callback_time = now;
+		surface_send_frame_callbacks(surface, msecs);
+	}
+
+	weston_compositor_update_frame_throttle(ec, &now);
+
+	return 1;
+}
+
+/* Decide whether the frame callbacks of a surface go out with this
+ * repaint.  Those of hidden surfaces are held back and sent by the
+ * throttle timer at most every hidden_frame_interval ms, until a repaint
+ * finds the surface visible again. */
+static int
+surface_throttle_frame(struct weston_surface *surface,
+		       struct weston_output *output,
+		       const struct timespec *now)
+{
+	struct weston_compositor *ec = surface->compositor;
+
+	if (ec->hidden_frame_interval > 0 &&
+	    surface_is_hidden(surface, output) &&
+	    timespec_sub_to_usec(now, &surface->frame_callback_time) <
+	    (int64_t) ec->hidden_frame_interval * 1000) {
+		if (wl_list_empty(&surface->frame_throttle_link)) {
+			wl_list_insert(&ec->frame_throttle_list,
+				       &surface->frame_throttle_link);
+			weston_compositor_update_frame_throttle(ec, now);
+		}
+		return 1;
+	}
+
+	wl_list_remove(&surface->frame_throttle_link);
+	wl_list_init(&surface->frame_throttle_link);
+	surface->frame_callback_time = *now;
+
+	return 0;
 }
 
 static int
@@ -1820,37 +2401,71 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 	struct weston_frame_callback *cb, *cnext;
 	struct wl_list frame_callback_list;
 	pixman_region32_t output_damage;
+	struct timespec stage_begin;
 	int r;
 
 	if (output->destroying)
 		return 0;
 
-	/* Rebuild the surface list and update surface transforms up front. */
-	weston_compositor_build_view_list(ec);
+	weston_trace(WESTON_TRACE_REPAINT_BEGIN, output->id, msecs, 0);
+	clock_gettime(CLOCK_MONOTONIC, &stage_begin);
+
+	/* Rebuild the surface list if it changed and update surface
+	 * transforms up front. */
+	weston_compositor_update_view_list(ec);
+	weston_output_end_repaint_stage(output, WESTON_REPAINT_STAGE_VIEW_LIST,
+					&stage_begin);
 
 	if (output->assign_planes && !output->disable_planes)
 		output->assign_planes(output);
 	else
 		wl_list_for_each(ev, &ec->view_list, link)
-			weston_view_move_to_plane(ev, &ec->primary_plane);
-
+			if (view_in_repaint_scope(ev, output))
+				weston_view_move_to_plane(ev,
+							  &ec->primary_plane);
+	weston_output_end_repaint_stage(output,
+					WESTON_REPAINT_STAGE_ASSIGN_PLANES,
+					&stage_begin);
+
+	compositor_accumulate_damage(ec, output);
+	weston_output_end_repaint_stage(output,
+					WESTON_REPAINT_STAGE_ACCUMULATE_DAMAGE,
+					&stage_begin);
+
+	/* Collected after the damage was accumulated, since that is what
+	 * computes the clip telling whether a view is occluded. */
 	wl_list_init(&frame_callback_list);
 	wl_list_for_each(ev, &ec->view_list, link) {
+		if (!view_in_repaint_scope(ev, output))
+			continue;
+
 		/* Note: This operation is safe to do multiple times on the
 		 * same surface.
 		 */
-		if (ev->surface->output == output) {
+		if (ev->surface->output == output &&
+		    !wl_list_empty(&ev->surface->frame_callback_list) &&
+		    !surface_throttle_frame(ev->surface, output,
+					    &stage_begin)) {
 			wl_list_insert_list(&frame_callback_list,
 					    &ev->surface->frame_callback_list);
 			wl_list_init(&ev->surface->frame_callback_list);
 		}
-	}
 
-	compositor_accumulate_damage(ec);
+		if (view_is_on_output(ev, output)) {
+			wl_list_insert_list(&output->feedback_list,
+					    &ev->surface->feedback_list);
+			wl_list_init(&ev->surface->feedback_list);
+		}
+	}
+	weston_output_end_repaint_stage(output,
+					WESTON_REPAINT_STAGE_FRAME_CALLBACKS,
+					&stage_begin);
 
 	pixman_region32_init(&output_damage);
 	pixman_region32_intersect(&output_damage,
 				  &ec->primary_plane.damage, &output->region);
+	weston_output_simplify_damage(output, &output_damage,
+				      ec->damage_tile_threshold);
 	pixman_region32_subtract(&output_damage,
 				 &output_damage, &ec->primary_plane.clip);
 
@@ -1858,12 +2473,20 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 		weston_output_update_matrix(output);
 
 	r = output->repaint(output, &output_damage);
+	if (r != 0)
+		weston_presentation_feedback_discard_list(&output->feedback_list);
 
 	pixman_region32_fini(&output_damage);
+	weston_output_end_repaint_stage(output,
+					WESTON_REPAINT_STAGE_REPAINT_OUTPUT,
+					&stage_begin);
 
 	output->repaint_needed = 0;
 
 	weston_compositor_repick(ec);
+	weston_output_end_repaint_stage(output, WESTON_REPAINT_STAGE_REPICK,
+					&stage_begin);
+
 	wl_event_loop_dispatch(ec->input_loop, 0);
 
 	wl_list_for_each_safe(cb, cnext, &frame_callback_list, link) {
@@ -1871,10 +2494,15 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 		wl_resource_destroy(cb->resource);
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &stage_begin);
 	wl_list_for_each_safe(animation, next, &output->animation_list, link) {
 		animation->frame_counter++;
 		animation->frame(animation, output, msecs);
 	}
+	weston_output_end_repaint_stage(output, WESTON_REPAINT_STAGE_ANIMATIONS,
+					&stage_begin);
+
+	weston_trace(WESTON_TRACE_REPAINT_END, output->id, r, 0);
 
 	return r;
 }
@@ -1889,20 +2517,94 @@ weston_compositor_read_input(int fd, uint32_t mask, void *data)
 	return 1;
 }
 
-WL_EXPORT void
-weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
+#define DEFAULT_REPAINT_WINDOW 7 /* ms */
+
+/* Extra time given to the repaint on top of the slowest recent one. */
+#define REPAINT_WINDOW_MARGIN 1000 /* us */
+
+/* Refresh period in microseconds, or 0 if the output has no usable
+ * refresh rate (mode refresh is in mHz). */
+static int64_t
+weston_output_refresh_period(struct weston_output *output)
+{
+	if (!output->current_mode || output->current_mode->refresh < 1000)
+		return 0;
+
+	return 1000000000LL / output->current_mode->refresh;
+}
+
+/* Milliseconds from now until the vblank that follows the last finished
+ * frame.  For backends that emulate vblank with a timer; never returns 0,
+ * since that would disarm the timer. */
+WL_EXPORT int
+weston_output_get_vblank_delay(struct weston_output *output)
+{
+	struct timespec now;
+	int64_t period, elapsed, delay;
+
+	period = weston_output_refresh_period(output);
+	if (period == 0)
+		period = 1000000 / 60;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = timespec_sub_to_usec(&now, &output->frame_timestamp);
+
+	/* Skip vblanks we have already missed. */
+	delay = period - elapsed % period;
+	delay = (delay + 500) / 1000;
+
+	return delay > 0 ? delay : 1;
+}
+
+static int32_t
+weston_output_repaint_delay(struct weston_output *output)
+{
+	int64_t period, window;
+
+	period = weston_output_refresh_period(output);
+	if (period == 0 || output->repaint_window < 0)
+		return 0;
+
+	window = output->repaint_window * 1000;
+	if (window < output->repaint_time_peak + REPAINT_WINDOW_MARGIN)
+		window = output->repaint_time_peak + REPAINT_WINDOW_MARGIN;
+	if (window >= period)
+		return 0;
+
+	return (period - window) / 1000;
+}
+
+static void
+weston_output_update_repaint_time(struct weston_output *output,
+				  const struct timespec *start)
+{
+	struct timespec end;
+	uint32_t usec;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	usec = timespec_sub_to_usec(&end, start);
+
+	/* Let the peak decay so one slow frame doesn't pin the window. */
+	output->repaint_time_peak -= output->repaint_time_peak / 16;
+	if (usec > output->repaint_time_peak)
+		output->repaint_time_peak = usec;
+}
+
+static void
+weston_output_maybe_repaint(struct weston_output *output)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct wl_event_loop *loop =
 		wl_display_get_event_loop(compositor->wl_display);
+	struct timespec start;
 	int fd, r;
 
-	output->frame_time = msecs;
-
 	if (output->repaint_needed &&
 	    compositor->state != WESTON_COMPOSITOR_SLEEPING &&
 	    compositor->state != WESTON_COMPOSITOR_OFFSCREEN) {
-		r = weston_output_repaint(output, msecs);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		r = weston_output_repaint(output, output->frame_time);
+		weston_output_update_repaint_time(output, &start);
 		if (!r)
 			return;
 	}
@@ -1917,6 +2619,84 @@ weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
 				     weston_compositor_read_input, compositor);
 }
 
+static int
+output_repaint_timer_handler(void *data)
+{
+	struct weston_output *output = data;
+
+	weston_output_maybe_repaint(output);
+
+	return 1;
+}
+
+/* Convert a presentation clock timestamp to CLOCK_MONOTONIC, going by
+ * the current offset between the two clocks. */
+static void
+presentation_to_monotonic(struct weston_compositor *compositor,
+			  const struct timespec *stamp, struct timespec *ts)
+{
+	struct timespec now, mono;
+	int64_t nsec;
+
+	if (compositor->presentation_clock == CLOCK_MONOTONIC) {
+		*ts = *stamp;
+		return;
+	}
+
+	weston_compositor_read_presentation_clock(compositor, &now);
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+
+	nsec = (int64_t) (mono.tv_sec - now.tv_sec + stamp->tv_sec) *
+		1000000000LL + mono.tv_nsec - now.tv_nsec + stamp->tv_nsec;
+	ts->tv_sec = nsec / 1000000000LL;
+	ts->tv_nsec = nsec % 1000000000LL;
+}
+
+/* Called by the backends when the frame submitted by the previous repaint
+ * is on screen, or when a repaint loop starts.  'stamp' is the time the
+ * frame was shown, in the compositor's presentation clock, and
+ * 'presented_flags' are the presentation_feedback kind flags telling how
+ * it was obtained, or WESTON_FINISH_FRAME_VBLANK.  A loop starting from
+ * idle passes no flags. */
+WL_EXPORT void
+weston_output_finish_frame(struct weston_output *output,
+			   const struct timespec *stamp,
+			   uint32_t presented_flags)
+{
+	int64_t refresh;
+	uint32_t msecs;
+	int32_t delay;
+
+	msecs = stamp->tv_sec * 1000 + stamp->tv_nsec / 1000000;
+	weston_trace(WESTON_TRACE_FINISH_FRAME, output->id, msecs, 0);
+
+	refresh = weston_output_refresh_period(output) * 1000;
+	weston_presentation_feedback_present_list(&output->feedback_list,
+						  output, refresh, stamp,
+						  output->msc,
+						  presented_flags &
+						  ~WESTON_FINISH_FRAME_VBLANK);
+
+	output->frame_time = msecs;
+	presentation_to_monotonic(output->compositor, stamp,
+				  &output->frame_timestamp);
+
+	/* Hold the repaint back so that commits arriving later in the
+	 * refresh cycle still make the next vblank.  The output stays
+	 * scheduled meanwhile, so those commits only set repaint_needed.
+	 * When the repaint loop starts from idle there was no frame to
+	 * wait behind, and waiting would only add latency. */
+	delay = 0;
+	if (presented_flags != 0)
+		delay = weston_output_repaint_delay(output);
+	if (delay > 0) {
+		wl_event_source_timer_update(output->repaint_timer, delay);
+		return;
+	}
+
+	weston_output_maybe_repaint(output);
+}
+
 static void
 idle_repaint(void *data)
 {
@@ -1943,6 +2723,8 @@ weston_output_schedule_repaint(struct weston_output *output)
 	    compositor->state == WESTON_COMPOSITOR_OFFSCREEN)
 		return;
 
+	weston_trace(WESTON_TRACE_SCHEDULE_REPAINT, output->id, 0, 0);
+
 	loop = wl_display_get_event_loop(compositor->wl_display);
 	output->repaint_needed = 1;
 	if (output->repaint_scheduled)
@@ -2013,6 +2795,8 @@ surface_damage(struct wl_client *client,
 	pixman_region32_union_rect(&surface->pending.damage,
 				   &surface->pending.damage,
 				   x, y, width, height);
+	weston_compositor_simplify_damage(surface->compositor,
+					  &surface->pending.damage);
 }
 
 static void
@@ -2086,11 +2870,38 @@ surface_set_input_region(struct wl_client *client,
 	}
 }
 
+static int
+subsurface_order_changed(struct weston_surface *surface)
+{
+	struct wl_list *current, *pending;
+
+	current = surface->subsurface_list.next;
+	pending = surface->subsurface_list_pending.next;
+	while (current != &surface->subsurface_list &&
+	       pending != &surface->subsurface_list_pending) {
+		if (container_of(current, struct weston_subsurface,
+				 parent_link) !=
+		    container_of(pending, struct weston_subsurface,
+				 parent_link_pending))
+			return 1;
+		current = current->next;
+		pending = pending->next;
+	}
+
+	return current != &surface->subsurface_list ||
+	       pending != &surface->subsurface_list_pending;
+}
+
 static void
 weston_surface_commit_subsurface_order(struct weston_surface *surface)
 {
 	struct weston_subsurface *sub;
 
+	if (!subsurface_order_changed(surface))
+		return;
+
+	surface->compositor->view_list_dirty = 1;
+
 	wl_list_for_each_reverse(sub, &surface->subsurface_list_pending,
 				 parent_link_pending) {
 		wl_list_remove(&sub->parent_link);
@@ -2098,6 +2909,17 @@ weston_surface_commit_subsurface_order(struct weston_surface *surface)
 	}
 }
 
+static void
+weston_surface_set_buffer_viewport(struct weston_surface *surface,
+				   const struct weston_buffer_viewport *viewport)
+{
+	if (memcmp(&surface->buffer_viewport, viewport, sizeof *viewport))
+		surface->buffer_viewport_generation =
+			++surface->compositor->geometry_generation;
+
+	surface->buffer_viewport = *viewport;
+}
+
 static void
 weston_surface_commit(struct weston_surface *surface)
 {
@@ -2107,7 +2929,8 @@ weston_surface_commit(struct weston_surface *surface)
 	/* wl_surface.set_buffer_transform */
 	/* wl_surface.set_buffer_scale */
 	/* wl_viewport.set */
-	surface->buffer_viewport = surface->pending.buffer_viewport;
+	weston_surface_set_buffer_viewport(surface,
+					   &surface->pending.buffer_viewport);
 
 	/* wl_surface.attach */
 	if (surface->pending.buffer || surface->pending.newly_attached) {
@@ -2133,6 +2956,8 @@ weston_surface_commit(struct weston_surface *surface)
 				       0, 0,
 				       surface->width,
 				       surface->height);
+	weston_compositor_simplify_damage(surface->compositor,
+					  &surface->damage);
 	empty_region(&surface->pending.damage);
 
 	/* wl_surface.set_opaque_region */
@@ -2163,6 +2988,12 @@ weston_surface_commit(struct weston_surface *surface)
 			    &surface->pending.frame_callback_list);
 	wl_list_init(&surface->pending.frame_callback_list);
 
+	/* presentation.feedback */
+	weston_presentation_feedback_discard_list(&surface->feedback_list);
+	wl_list_insert_list(&surface->feedback_list,
+			    &surface->pending.feedback_list);
+	wl_list_init(&surface->pending.feedback_list);
+
 	weston_surface_commit_subsurface_order(surface);
 
 	weston_surface_schedule_repaint(surface);
@@ -2181,6 +3012,9 @@ surface_commit(struct wl_client *client, struct wl_resource *resource)
 	struct weston_surface *surface = wl_resource_get_user_data(resource);
 	struct weston_subsurface *sub = weston_surface_to_subsurface(surface);
 
+	weston_trace(WESTON_TRACE_SURFACE_COMMIT, wl_resource_get_id(resource),
+		     (uintptr_t) surface, (uintptr_t) surface->pending.buffer);
+
 	if (sub) {
 		weston_subsurface_commit(sub);
 		return;
@@ -2333,7 +3167,8 @@ weston_subsurface_commit_from_cache(struct weston_subsurface *sub)
 	/* wl_surface.set_buffer_transform */
 	/* wl_surface.set_buffer_scale */
 	/* wl_viewport.set */
-	surface->buffer_viewport = sub->cached.buffer_viewport;
+	weston_surface_set_buffer_viewport(surface,
+					   &sub->cached.buffer_viewport);
 
 	/* wl_surface.attach */
 	if (sub->cached.buffer_ref.buffer || sub->cached.newly_attached) {
@@ -2355,6 +3190,8 @@ weston_subsurface_commit_from_cache(struct weston_subsurface *sub)
 				       0, 0,
 				       surface->width,
 				       surface->height);
+	weston_compositor_simplify_damage(surface->compositor,
+					  &surface->damage);
 	empty_region(&sub->cached.damage);
 
 	/* wl_surface.set_opaque_region */
@@ -2385,6 +3222,12 @@ weston_subsurface_commit_from_cache(struct weston_subsurface *sub)
 			    &sub->cached.frame_callback_list);
 	wl_list_init(&sub->cached.frame_callback_list);
 
+	/* presentation.feedback */
+	weston_presentation_feedback_discard_list(&surface->feedback_list);
+	wl_list_insert_list(&surface->feedback_list,
+			    &sub->cached.feedback_list);
+	wl_list_init(&sub->cached.feedback_list);
+
 	weston_surface_commit_subsurface_order(surface);
 
 	weston_surface_schedule_repaint(surface);
@@ -2407,6 +3250,8 @@ weston_subsurface_commit_to_cache(struct weston_subsurface *sub)
 				  -surface->pending.sx, -surface->pending.sy);
 	pixman_region32_union(&sub->cached.damage, &sub->cached.damage,
 			      &surface->pending.damage);
+	weston_compositor_simplify_damage(surface->compositor,
+					  &sub->cached.damage);
 	empty_region(&surface->pending.damage);
 
 	if (surface->pending.newly_attached) {
@@ -2430,6 +3275,11 @@ weston_subsurface_commit_to_cache(struct weston_subsurface *sub)
 			    &surface->pending.frame_callback_list);
 	wl_list_init(&surface->pending.frame_callback_list);
 
+	weston_presentation_feedback_discard_list(&sub->cached.feedback_list);
+	wl_list_insert_list(&sub->cached.feedback_list,
+			    &surface->pending.feedback_list);
+	wl_list_init(&surface->pending.feedback_list);
+
 	sub->cached.has_data = 1;
 }
 
@@ -2698,6 +3548,7 @@ weston_subsurface_cache_init(struct weston_subsurface *sub)
 	pixman_region32_init(&sub->cached.opaque);
 	pixman_region32_init(&sub->cached.input);
 	wl_list_init(&sub->cached.frame_callback_list);
+	wl_list_init(&sub->cached.feedback_list);
 	sub->cached.buffer_ref.buffer = NULL;
 }
 
@@ -2708,6 +3559,7 @@ weston_subsurface_cache_fini(struct weston_subsurface *sub)
 
 	wl_list_for_each_safe(cb, tmp, &sub->cached.frame_callback_list, link)
 		wl_resource_destroy(cb->resource);
+	weston_presentation_feedback_discard_list(&sub->cached.feedback_list);
 
 	weston_buffer_reference(&sub->cached.buffer_ref, NULL);
 	pixman_region32_fini(&sub->cached.damage);
@@ -2718,6 +3570,7 @@ weston_subsurface_cache_fini(struct weston_subsurface *sub)
 static void
 weston_subsurface_unlink_parent(struct weston_subsurface *sub)
 {
+	sub->surface->compositor->view_list_dirty = 1;
 	wl_list_remove(&sub->parent_link);
 	wl_list_remove(&sub->parent_link_pending);
 	wl_list_remove(&sub->parent_destroy_listener.link);
@@ -2777,6 +3630,7 @@ weston_subsurface_link_parent(struct weston_subsurface *sub,
 			      struct weston_surface *parent)
 {
 	sub->parent = parent;
+	parent->compositor->view_list_dirty = 1;
 	sub->parent_destroy_listener.notify = subsurface_handle_parent_destroy;
 	wl_signal_add(&parent->destroy_signal,
 		      &sub->parent_destroy_listener);
@@ -3195,6 +4049,13 @@ weston_output_destroy(struct weston_output *output)
 
 	wl_signal_emit(&output->destroy_signal, output);
 
+	weston_presentation_feedback_discard_list(&output->feedback_list);
+	wl_event_source_remove(output->repaint_timer);
+	weston_repaint_timings_destroy(output->repaint_timings);
+	if (output->damage_tiles)
+		tile_damage_release(output->damage_tiles);
+	free(output->damage_tiles);
+
 	free(output->name);
 	pixman_region32_fini(&output->region);
 	pixman_region32_fini(&output->previous_damage);
@@ -3291,6 +4152,8 @@ weston_output_update_matrix(struct weston_output *output)
 		weston_matrix_multiply(&output->matrix, &modelview);
 	}
 
+	output->geometry_generation =
+		++output->compositor->geometry_generation;
 	output->dirty = 0;
 }
 
@@ -3371,11 +4234,35 @@ weston_output_move(struct weston_output *output, int x, int y)
 					output->transform);
 }
 
+static void
+weston_output_init_repaint_window(struct weston_output *output)
+{
+	struct weston_config *config = output->compositor->config;
+	struct weston_config_section *s;
+	int32_t window;
+
+	s = weston_config_get_section(config, "core", NULL, NULL);
+	weston_config_section_get_int(s, "repaint-window", &window,
+				      DEFAULT_REPAINT_WINDOW);
+
+	if (output->name) {
+		s = weston_config_get_section(config,
+					      "output", "name", output->name);
+		weston_config_section_get_int(s, "repaint-window", &window,
+					      window);
+	}
+
+	output->repaint_window = window;
+	output->repaint_time_peak = 0;
+}
+
 WL_EXPORT void
 weston_output_init(struct weston_output *output, struct weston_compositor *c,
 		   int x, int y, int mm_width, int mm_height, uint32_t transform,
 		   int32_t scale)
 {
+	struct wl_event_loop *loop = wl_display_get_event_loop(c->wl_display);
+
 	output->compositor = c;
 	output->x = x;
 	output->y = y;
@@ -3395,6 +4282,18 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 	wl_signal_init(&output->move_signal);
 	wl_list_init(&output->animation_list);
 	wl_list_init(&output->resource_list);
+	wl_list_init(&output->feedback_list);
+	output->msc = 0;
+
+	weston_output_init_repaint_window(output);
+	output->repaint_timings = weston_repaint_timings_create();
+	output->damage_tiles = malloc(sizeof *output->damage_tiles);
+	if (output->damage_tiles)
+		tile_damage_init(output->damage_tiles);
+	output->repaint_timer =
+		wl_event_loop_add_timer(loop, output_repaint_timer_handler,
+					output);
+	clock_gettime(CLOCK_MONOTONIC, &output->frame_timestamp);
 
 	output->id = ffs(~output->compositor->output_id_pool) - 1;
 	output->compositor->output_id_pool |= 1 << output->id;
@@ -3579,6 +4478,104 @@ bind_scaler(struct wl_client *client,
 				       NULL, NULL);
 }
 
+static void
+destroy_presentation_feedback(struct wl_resource *feedback_resource)
+{
+	struct weston_presentation_feedback *feedback;
+
+	feedback = wl_resource_get_user_data(feedback_resource);
+
+	wl_list_remove(&feedback->link);
+	free(feedback);
+}
+
+static void
+presentation_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+presentation_feedback(struct wl_client *client,
+		      struct wl_resource *presentation_resource,
+		      struct wl_resource *surface_resource,
+		      uint32_t callback)
+{
+	struct weston_surface *surface;
+	struct weston_presentation_feedback *feedback;
+
+	surface = wl_resource_get_user_data(surface_resource);
+
+	feedback = zalloc(sizeof *feedback);
+	if (feedback == NULL)
+		goto err_calloc;
+
+	feedback->resource = wl_resource_create(client,
+					&presentation_feedback_interface,
+					1, callback);
+	if (!feedback->resource)
+		goto err_create;
+
+	wl_resource_set_implementation(feedback->resource, NULL, feedback,
+				       destroy_presentation_feedback);
+
+	wl_list_insert(&surface->pending.feedback_list, &feedback->link);
+
+	return;
+
+err_create:
+	free(feedback);
+
+err_calloc:
+	wl_client_post_no_memory(client);
+}
+
+static const struct presentation_interface presentation_implementation = {
+	presentation_destroy,
+	presentation_feedback
+};
+
+static void
+bind_presentation(struct wl_client *client,
+		  void *data, uint32_t version, uint32_t id)
+{
+	struct weston_compositor *compositor = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &presentation_interface,
+				      MIN(version, 1), id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &presentation_implementation,
+				       compositor, NULL);
+	presentation_send_clock_id(resource, compositor->presentation_clock);
+}
+
+WL_EXPORT void
+weston_compositor_set_presentation_clock(struct weston_compositor *compositor,
+					 clockid_t clk_id)
+{
+	compositor->presentation_clock = clk_id;
+}
+
+/* Read the current time of the clock that weston_output_finish_frame()
+ * timestamps are expected in.  For backends without hardware timestamps. */
+WL_EXPORT void
+weston_compositor_read_presentation_clock(
+			const struct weston_compositor *compositor,
+			struct timespec *ts)
+{
+	if (clock_gettime(compositor->presentation_clock, ts) < 0) {
+		ts->tv_sec = 0;
+		ts->tv_nsec = 0;
+		weston_log("Error: failure to read the presentation clock %#x\n",
+			   compositor->presentation_clock);
+	}
+}
+
 static void
 compositor_bind(struct wl_client *client,
 		void *data, uint32_t version, uint32_t id)
@@ -3631,6 +4628,16 @@ weston_environment_get_fd(const char *env)
 	return fd;
 }
 
+static void
+view_list_debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+			void *data)
+{
+	struct weston_compositor *ec = data;
+
+	weston_log("view list: %u rebuilds, %u rebuilds skipped\n",
+		   ec->view_list_rebuilds, ec->view_list_rebuilds_skipped);
+}
+
 WL_EXPORT int
 weston_compositor_init(struct weston_compositor *ec,
 		       struct wl_display *display,
@@ -3671,7 +4678,26 @@ weston_compositor_init(struct weston_compositor *ec,
 			      ec, bind_scaler))
 		return -1;
 
+	if (!wl_global_create(ec->wl_display, &presentation_interface, 1,
+			      ec, bind_presentation))
+		return -1;
+
+	weston_compositor_set_presentation_clock(ec, CLOCK_MONOTONIC);
+
 	wl_list_init(&ec->view_list);
+	wl_array_init(&ec->view_list_layer_views);
+	ec->view_list_dirty = 1;
+	wl_array_init(&ec->pick_views);
+	wl_array_init(&ec->pick_boxes);
+	wl_array_init(&ec->pick_dirty_views);
+	ec->pick_grid = malloc(sizeof *ec->pick_grid);
+	if (!ec->pick_grid)
+		return -1;
+	pick_grid_init(ec->pick_grid);
+	ec->damage_tiles = malloc(sizeof *ec->damage_tiles);
+	if (!ec->damage_tiles)
+		return -1;
+	tile_damage_init(ec->damage_tiles);
 	wl_list_init(&ec->plane_list);
 	wl_list_init(&ec->layer_list);
 	wl_list_init(&ec->seat_list);
@@ -3686,6 +4712,14 @@ weston_compositor_init(struct weston_compositor *ec,
 	weston_plane_init(&ec->primary_plane, ec, 0, 0);
 	weston_compositor_stack_plane(ec, &ec->primary_plane, NULL);
 
+	s = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_int(s, "damage-tile-threshold",
+				      &ec->damage_tile_threshold,
+				      DEFAULT_DAMAGE_TILE_THRESHOLD);
+	weston_config_section_get_int(s, "hidden-frame-interval",
+				      &ec->hidden_frame_interval,
+				      DEFAULT_HIDDEN_FRAME_INTERVAL);
+
 	s = weston_config_get_section(ec->config, "keyboard", NULL, NULL);
 	weston_config_section_get_string(s, "keymap_rules",
 					 (char **) &xkb_names.rules, NULL);
@@ -3704,6 +4738,7 @@ weston_compositor_init(struct weston_compositor *ec,
 	ec->ping_handler = NULL;
 
 	screenshooter_create(ec);
+	repaint_timing_create(ec);
 	text_backend_init(ec);
 
 	wl_data_device_manager_init(ec->wl_display);
@@ -3714,11 +4749,18 @@ weston_compositor_init(struct weston_compositor *ec,
 	ec->idle_source = wl_event_loop_add_timer(loop, idle_handler, ec);
 	wl_event_source_timer_update(ec->idle_source, ec->idle_time * 1000);
 
+	wl_list_init(&ec->frame_throttle_list);
+	ec->frame_throttle_timer =
+		wl_event_loop_add_timer(loop, frame_throttle_timer_handler, ec);
+
 	ec->input_loop = wl_event_loop_create();
 
 	weston_layer_init(&ec->fade_layer, &ec->layer_list);
 	weston_layer_init(&ec->cursor_layer, &ec->fade_layer.link);
 
+	weston_compositor_add_debug_binding(ec, KEY_L,
+					    view_list_debug_binding, ec);
+
 	weston_compositor_schedule_repaint(ec);
 
 	return 0;
@@ -3728,8 +4770,13 @@ WL_EXPORT void
 weston_compositor_shutdown(struct weston_compositor *ec)
 {
 	struct weston_output *output, *next;
+	struct weston_surface *surface, *snext;
 
 	wl_event_source_remove(ec->idle_source);
+	wl_event_source_remove(ec->frame_throttle_timer);
+	wl_list_for_each_safe(surface, snext, &ec->frame_throttle_list,
+			      frame_throttle_link)
+		wl_list_init(&surface->frame_throttle_link);
 	if (ec->input_loop_source)
 		wl_event_source_remove(ec->input_loop_source);
 
@@ -3748,6 +4795,15 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 
 	weston_plane_release(&ec->primary_plane);
 
+	wl_array_release(&ec->view_list_layer_views);
+	wl_array_release(&ec->pick_views);
+	wl_array_release(&ec->pick_boxes);
+	wl_array_release(&ec->pick_dirty_views);
+	pick_grid_release(ec->pick_grid);
+	free(ec->pick_grid);
+	tile_damage_release(ec->damage_tiles);
+	free(ec->damage_tiles);
+
 	wl_event_loop_destroy(ec->input_loop);
 
 	weston_config_destroy(ec->config);
@@ -3899,6 +4955,10 @@ on_caught_signal(int s, siginfo_t *siginfo, void *context)
 	 * will allow weston to switch back to gdb on crash and then
 	 * gdb will catch the crash with SIGTRAP.*/
 
+	/* Get queued log messages out before the backtrace, which is
+	 * then written synchronously. */
+	weston_log_flush();
+
 	weston_log("caught signal: %d\n", s);
 
 	print_backtrace();
@@ -4037,6 +5097,8 @@ usage(int error_code)
 		"  -i, --idle-time=SECS\tIdle time in seconds\n"
 		"  --modules\t\tLoad the comma-separated list of modules\n"
 		"  --log==FILE\t\tLog to the given file\n"
+		"  --trace=FILE\t\tRecord a binary event trace, written to\n"
+		"\t\t\t\tFILE on SIGRTMIN+1 and at exit\n"
 		"  -h, --help\t\tThis help message\n\n");
 
 	fprintf(stderr,
@@ -4131,6 +5193,7 @@ int main(int argc, char *argv[])
 	char *option_shell = NULL;
 	char *modules, *option_modules = NULL;
 	char *log = NULL;
+	char *trace = NULL;
 	int32_t idle_time = 300;
 	int32_t help = 0;
 	char *socket_name = "wayland-0";
@@ -4145,6 +5208,7 @@ int main(int argc, char *argv[])
 		{ WESTON_OPTION_INTEGER, "idle-time", 'i', &idle_time },
 		{ WESTON_OPTION_STRING, "modules", 0, &option_modules },
 		{ WESTON_OPTION_STRING, "log", 0, &log },
+		{ WESTON_OPTION_STRING, "trace", 0, &trace },
 		{ WESTON_OPTION_BOOLEAN, "help", 'h', &help },
 		{ WESTON_OPTION_BOOLEAN, "version", 0, &version },
 	};
@@ -4223,6 +5287,9 @@ int main(int argc, char *argv[])
 	catch_signals();
 	segv_compositor = ec;
 
+	if (trace)
+		weston_trace_create(ec, trace);
+
 	ec->idle_time = idle_time;
 	ec->default_pointer_grab = NULL;
 
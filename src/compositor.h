@@ -28,6 +28,7 @@
 extern "C" {
 #endif
 
+#include <time.h>
 #include <pixman.h>
 #include <xkbcommon/xkbcommon.h>
 
@@ -60,6 +61,9 @@ struct shell_surface;
 struct weston_seat;
 struct weston_output;
 struct input_method;
+struct pick_grid;
+struct tile_damage;
+struct weston_repaint_timings;
 
 enum weston_keyboard_modifier {
 	MODIFIER_CTRL = (1 << 0),
@@ -166,6 +170,18 @@ enum dpms_enum {
 	WESTON_DPMS_OFF
 };
 
+/* Keep in sync with repaint_timing_stage in protocol/repaint-timing.xml */
+enum weston_repaint_stage {
+	WESTON_REPAINT_STAGE_VIEW_LIST,
+	WESTON_REPAINT_STAGE_ASSIGN_PLANES,
+	WESTON_REPAINT_STAGE_FRAME_CALLBACKS,
+	WESTON_REPAINT_STAGE_ACCUMULATE_DAMAGE,
+	WESTON_REPAINT_STAGE_REPAINT_OUTPUT,
+	WESTON_REPAINT_STAGE_REPICK,
+	WESTON_REPAINT_STAGE_ANIMATIONS,
+	WESTON_REPAINT_STAGE_COUNT
+};
+
 enum weston_mode_switch_op {
 	WESTON_MODE_SWITCH_SET_NATIVE,
 	WESTON_MODE_SWITCH_SET_TEMPORARY,
@@ -184,6 +200,14 @@ struct weston_output {
 	struct weston_compositor *compositor;
 	struct weston_matrix matrix;
 	struct wl_list animation_list;
+
+	/* Presentation feedback of the content in the frame being shown,
+	 * delivered by weston_output_finish_frame().  msc counts the
+	 * refreshes of the output; backends with a hardware counter keep it
+	 * in sync, the others increment it with every frame they finish. */
+	struct wl_list feedback_list;
+	uint64_t msc;
+
 	int32_t x, y, width, height;
 	int32_t mm_width, mm_height;
 	pixman_region32_t region;
@@ -192,6 +216,7 @@ struct weston_output {
 	int repaint_scheduled;
 	struct weston_output_zoom zoom;
 	int dirty;
+	uint32_t geometry_generation; /* set by weston_output_update_matrix() */
 	struct wl_signal frame_signal;
 	struct wl_signal destroy_signal;
 	struct wl_signal move_signal;
@@ -200,6 +225,17 @@ struct weston_output {
 	int disable_planes;
 	int destroying;
 
+	/* Repaint scheduling: after a frame finishes, the repaint is held
+	 * back until repaint_window ms before the next predicted vblank.
+	 * The window grows to cover the slowest recent repaints. */
+	struct wl_event_source *repaint_timer;
+	struct timespec frame_timestamp;	/* CLOCK_MONOTONIC */
+	int32_t repaint_window;			/* ms, from weston.ini */
+	uint32_t repaint_time_peak;		/* us, decaying maximum */
+
+	struct weston_repaint_timings *repaint_timings;
+	struct tile_damage *damage_tiles;
+
 	char *make, *model, *serial_number;
 	uint32_t subpixel;
 	uint32_t transform;
@@ -535,11 +571,22 @@ struct weston_plane {
 	struct wl_list link;
 };
 
+typedef void (*weston_read_pixels_done_func_t)(void *pixels, void *data);
+
 struct weston_renderer {
 	int (*read_pixels)(struct weston_output *output,
 			       pixman_format_code_t format, void *pixels,
 			       uint32_t x, uint32_t y,
 			       uint32_t width, uint32_t height);
+	/* Optional; reads pixels like read_pixels() without waiting for
+	 * the GPU, and calls 'done' with them at the latest a refresh
+	 * later.  Reads on one output complete in order. */
+	int (*read_pixels_async)(struct weston_output *output,
+				 pixman_format_code_t format,
+				 uint32_t x, uint32_t y,
+				 uint32_t width, uint32_t height,
+				 weston_read_pixels_done_func_t done,
+				 void *data);
 	void (*repaint_output)(struct weston_output *output,
 			       pixman_region32_t *output_damage);
 	void (*flush_damage)(struct weston_surface *surface);
@@ -612,6 +659,45 @@ struct weston_compositor {
 	struct weston_plane primary_plane;
 	uint32_t capabilities; /* combination of enum weston_capability */
 
+	/* view_list is only rebuilt when view_list_dirty is set or the
+	 * top-level views found in the layers no longer match
+	 * view_list_layer_views, the snapshot taken at the last rebuild. */
+	int view_list_dirty;
+	struct wl_array view_list_layer_views;
+	uint32_t view_list_rebuilds;
+	uint32_t view_list_rebuilds_skipped;
+
+	/* Spatial index over view_list for weston_compositor_pick_view(),
+	 * built on demand.  Views whose geometry changed after the grid
+	 * was built are kept in pick_dirty_views and tested separately. */
+	struct pick_grid *pick_grid;
+	int pick_grid_valid;
+	int pick_grid_has_dirty;
+	struct wl_array pick_views;
+	struct wl_array pick_boxes;
+	struct wl_array pick_dirty_views;
+
+	/* Damage regions with more rectangles than damage_tile_threshold
+	 * are coarsened to a bitmap of tiles; 0 keeps exact regions. */
+	int32_t damage_tile_threshold;
+	struct tile_damage *damage_tiles;
+
+	/* Frame callbacks of hidden surfaces are sent at most this often,
+	 * in ms; 0 sends them with every repaint. */
+	int32_t hidden_frame_interval;
+	struct wl_list frame_throttle_list;
+	struct wl_event_source *frame_throttle_timer;
+
+	/* Clock of the presentation timestamps passed to
+	 * weston_output_finish_frame(). */
+	clockid_t presentation_clock;
+
+	/* Source of the geometry generations of views, outputs and
+	 * surface buffer viewports, so that renderers can tell when state
+	 * they derived from them is stale.  A new value is never reused,
+	 * even by a new object at the address of a destroyed one. */
+	uint32_t geometry_generation;
+
 	struct weston_renderer *renderer;
 
 	pixman_format_code_t read_format;
@@ -715,6 +801,9 @@ struct weston_subsurface {
 		/* wl_surface.frame */
 		struct wl_list frame_callback_list;
 
+		/* presentation.feedback */
+		struct wl_list feedback_list;
+
 		/* wl_surface.set_buffer_transform */
 		/* wl_surface.set_buffer_scale */
 		struct weston_buffer_viewport buffer_viewport;
@@ -764,6 +853,7 @@ struct weston_view {
 	struct wl_list link;
 	struct wl_list layer_link;
 	struct weston_plane *plane;
+	uint32_t pick_index; /* position in weston_compositor::pick_views */
 
 	pixman_region32_t clip;
 	float alpha;                     /* part of geometry, see below */
@@ -792,6 +882,7 @@ struct weston_view {
 	 */
 	struct {
 		int dirty;
+		uint32_t generation; /* set by weston_view_geometry_dirty() */
 
 		pixman_region32_t boundingbox;
 		pixman_region32_t opaque;
@@ -857,8 +948,19 @@ struct weston_surface {
 
 	struct wl_list frame_callback_list;
 
+	/* While the surface is hidden, its frame callbacks wait on the
+	 * compositor's frame_throttle_list instead of going out with every
+	 * repaint.  frame_callback_time is when they were last sent. */
+	struct wl_list frame_throttle_link;
+	struct timespec frame_callback_time;
+
+	/* Presentation feedback for the committed content, handed to the
+	 * output at its next repaint. */
+	struct wl_list feedback_list;
+
 	struct weston_buffer_reference buffer_ref;
 	struct weston_buffer_viewport buffer_viewport;
+	uint32_t buffer_viewport_generation; /* changes with buffer_viewport */
 	int keep_buffer; /* bool for backends to prevent early release */
 
 	/* wl_viewport resource for this surface */
@@ -885,6 +987,9 @@ struct weston_surface {
 		/* wl_surface.frame */
 		struct wl_list frame_callback_list;
 
+		/* presentation.feedback */
+		struct wl_list feedback_list;
+
 		/* wl_surface.set_buffer_transform */
 		/* wl_surface.set_scaling_factor */
 		/* wl_viewport.set */
@@ -1015,13 +1120,33 @@ weston_compositor_stack_plane(struct weston_compositor *ec,
 			      struct weston_plane *plane,
 			      struct weston_plane *above);
 
+/* Passed to weston_output_finish_frame() along with the
+ * presentation_feedback kind flags by backends that have no timings to
+ * report, when a frame they repainted is done rather than when a repaint
+ * loop starts.  It is never sent to clients. */
+#define WESTON_FINISH_FRAME_VBLANK (1u << 31)
+
 void
-weston_output_finish_frame(struct weston_output *output, uint32_t msecs);
+weston_output_finish_frame(struct weston_output *output,
+			   const struct timespec *stamp,
+			   uint32_t presented_flags);
+int
+weston_output_get_vblank_delay(struct weston_output *output);
 void
 weston_output_schedule_repaint(struct weston_output *output);
 void
 weston_output_damage(struct weston_output *output);
 void
+weston_output_simplify_damage(struct weston_output *output,
+			      pixman_region32_t *damage, int max_rects);
+int
+weston_output_read_pixels_async(struct weston_output *output,
+				pixman_format_code_t format,
+				uint32_t x, uint32_t y,
+				uint32_t width, uint32_t height,
+				weston_read_pixels_done_func_t done,
+				void *data);
+void
 weston_compositor_schedule_repaint(struct weston_compositor *compositor);
 void
 weston_compositor_fade(struct weston_compositor *compositor, float tint);
@@ -1201,6 +1326,14 @@ weston_buffer_reference(struct weston_buffer_reference *ref,
 uint32_t
 weston_compositor_get_time(void);
 
+void
+weston_compositor_set_presentation_clock(struct weston_compositor *compositor,
+					 clockid_t clk_id);
+void
+weston_compositor_read_presentation_clock(
+			const struct weston_compositor *compositor,
+			struct timespec *ts);
+
 int
 weston_compositor_init(struct weston_compositor *ec, struct wl_display *display,
 		       int *argc, char *argv[], struct weston_config *config);
@@ -1261,6 +1394,8 @@ void
 weston_log_file_open(const char *filename);
 void
 weston_log_file_close(void);
+void
+weston_log_flush(void);
 int
 weston_vlog(const char *fmt, va_list ap);
 int
@@ -1292,6 +1427,20 @@ tty_activate_vt(struct tty *tty, int vt);
 void
 screenshooter_create(struct weston_compositor *ec);
 
+void
+repaint_timing_create(struct weston_compositor *ec);
+void
+weston_trace_create(struct weston_compositor *ec, const char *filename);
+struct weston_repaint_timings *
+weston_repaint_timings_create(void);
+void
+weston_repaint_timings_destroy(struct weston_repaint_timings *timings);
+void
+weston_output_record_repaint_stage(struct weston_output *output,
+				   enum weston_repaint_stage stage,
+				   const struct timespec *begin,
+				   const struct timespec *end);
+
 struct clipboard *
 clipboard_create(struct weston_seat *seat);
 
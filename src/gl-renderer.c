@@ -25,8 +25,12 @@
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <unistd.h>
 #include <ctype.h>
 #include <float.h>
 #include <assert.h>
@@ -34,6 +38,8 @@
 
 #include "gl-renderer.h"
 #include "vertex-clipping.h"
+#include "shm-convert.h"
+#include "gl-stream.h"
 
 #include <EGL/eglext.h>
 #include "weston-egl-ext.h"
@@ -50,6 +56,10 @@ struct gl_shader {
 
 #define BUFFER_DAMAGE_COUNT 2
 
+/* Every damage rectangle is clipped against every surface rectangle and
+ * drawn separately, so keep the count low. */
+#define GL_RENDERER_MAX_DAMAGE_RECTS 16
+
 struct gl_border_image {
 	GLuint tex;
 	int32_t width, height;
@@ -62,6 +72,20 @@ struct gl_output_state {
 	EGLSurface egl_surface;
 	pixman_region32_t buffer_damage[BUFFER_DAMAGE_COUNT];
 	struct gl_border_image borders[4];
+
+	/* Reads into pixel pack buffers, completed on the next repaint
+	 * or by the timer a refresh later, whichever comes first. */
+	struct wl_list readbacks;
+	struct wl_event_source *readback_timer;
+};
+
+struct gl_readback {
+	struct wl_list link;
+	GLuint pbo;
+	GLsizeiptr size;
+	GLsizeiptr length;
+	weston_read_pixels_done_func_t done;
+	void *data;
 };
 
 enum buffer_type {
@@ -89,18 +113,45 @@ struct gl_surface_state {
 	int height; /* in pixels */
 	int y_inverted;
 
+	/* RGB copy of shm buffers in formats GL cannot upload, converted
+	 * as they get damaged and uploaded from instead. */
+	uint32_t shm_format;
+	uint32_t *convert_data;
+
+	/* The quadtree node of the block holding a small shm buffer in
+	 * the atlas, which textures[0] then is, or -1.  atlas_x and
+	 * atlas_y are where the buffer starts, inside a border of one
+	 * texel that repeats its edges; atlas_size is the side of the
+	 * block. */
+	int atlas_node;
+	int atlas_x, atlas_y;
+	int atlas_size;
+
 	struct weston_surface *surface;
 
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
 };
 
+#define ATLAS_SIZE		1024
+#define ATLAS_MIN_BLOCK		16
+#define ATLAS_LEVELS		7	/* blocks of 1024 down to 16 */
+#define ATLAS_NODES		((1 << (2 * ATLAS_LEVELS)) / 3)
+
+enum atlas_node_state {
+	ATLAS_NODE_FREE = 0,
+	ATLAS_NODE_SPLIT,
+	ATLAS_NODE_USED
+};
+
 struct gl_renderer {
 	struct weston_renderer base;
 	int fragment_shader_debug;
 	int fan_debug;
+	int upload_debug;
 	struct weston_binding *fragment_binding;
 	struct weston_binding *fan_binding;
+	struct weston_binding *upload_binding;
 
 	EGLDisplay egl_display;
 	EGLContext egl_context;
@@ -108,6 +159,9 @@ struct gl_renderer {
 
 	struct wl_array vertices;
 	struct wl_array vtxcnt;
+	struct wl_array indices;
+	struct gl_stream_buffer vertex_stream;
+	struct gl_stream_buffer index_stream;
 
 	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
 	PFNEGLCREATEIMAGEKHRPROC create_image;
@@ -115,6 +169,21 @@ struct gl_renderer {
 
 	int has_unpack_subimage;
 
+	/* With GL_NV_pixel_buffer_object, shm uploads are copied into a
+	 * stream buffer mapped unsynchronized, so the copy does not wait
+	 * for the previous frame to be drawn. */
+	int has_pbo;
+	PFNGLMAPBUFFERRANGEEXTPROC map_buffer_range;
+	PFNGLUNMAPBUFFEROESPROC unmap_buffer;
+	struct gl_stream_buffer upload_stream;
+	struct wl_array upload_boxes;
+	struct wl_list readback_pool;
+
+	/* Shm uploads since the last repaint, logged with upload_debug */
+	uint32_t upload_count;
+	uint64_t upload_bytes;
+	uint64_t upload_nsec;
+
 	PFNEGLBINDWAYLANDDISPLAYWL bind_display;
 	PFNEGLUNBINDWAYLANDDISPLAYWL unbind_display;
 	PFNEGLQUERYWAYLANDBUFFERWL query_buffer;
@@ -124,6 +193,21 @@ struct gl_renderer {
 
 	int has_egl_buffer_age;
 
+	/* Shm buffers up to 'gl-atlas-max-size' on either side share one
+	 * texture, allocated in square blocks of a quadtree; 0 disables
+	 * the atlas. */
+	int atlas_max_size;
+	GLuint atlas_texture;
+	uint8_t atlas_nodes[ATLAS_NODES];
+
+	/* With 'gl-program-cache', linked programs are kept as binaries
+	 * in this directory, keyed on the sources and the driver. */
+	char *program_cache_dir;
+	uint64_t program_cache_driver;
+	int program_cache_hits, program_cache_misses;
+	PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+	PFNGLPROGRAMBINARYOESPROC program_binary;
+
 	struct gl_shader texture_shader_rgba;
 	struct gl_shader texture_shader_rgbx;
 	struct gl_shader texture_shader_egl_external;
@@ -279,7 +363,7 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 	struct gl_surface_state *gs = get_surface_state(ev->surface);
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
-	GLfloat *v, inv_width, inv_height;
+	GLfloat *v, inv_width, inv_height, offset_x, offset_y;
 	unsigned int *vtxcnt, nvtx = 0;
 	pixman_box32_t *rects, *surf_rects;
 	int i, j, k, nrects, nsurf;
@@ -293,8 +377,17 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 	v = wl_array_add(&gr->vertices, nrects * nsurf * 8 * 4 * sizeof *v);
 	vtxcnt = wl_array_add(&gr->vtxcnt, nrects * nsurf * sizeof *vtxcnt);
 
-	inv_width = 1.0 / gs->pitch;
-        inv_height = 1.0 / gs->height;
+	if (gs->atlas_node >= 0) {
+		inv_width = 1.0 / ATLAS_SIZE;
+		inv_height = 1.0 / ATLAS_SIZE;
+		offset_x = gs->atlas_x;
+		offset_y = gs->atlas_y;
+	} else {
+		inv_width = 1.0 / gs->pitch;
+		inv_height = 1.0 / gs->height;
+		offset_x = 0;
+		offset_y = 0;
+	}
 
 	for (i = 0; i < nrects; i++) {
 		pixman_box32_t *rect = &rects[i];
@@ -333,9 +426,9 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 				weston_surface_to_buffer_float(ev->surface,
 							       sx, sy,
 							       &bx, &by);
-				*(v++) = bx * inv_width;
+				*(v++) = (offset_x + bx) * inv_width;
 				if (gs->y_inverted) {
-					*(v++) = by * inv_height;
+					*(v++) = (offset_y + by) * inv_height;
 				} else {
 					*(v++) = (gs->height - by) * inv_height;
 				}
@@ -388,6 +481,46 @@ triangle_fan_debug(struct weston_view *view, int first, int count)
 	free(buffer);
 }
 
+/* Initial size of the pixel unpack stream shm uploads are staged in */
+#define UPLOAD_STREAM_SIZE	(4 * 1024 * 1024)
+
+/* Damage boxes are uploaded as their bounding box when that adds at most
+ * this many percent of undamaged pixels. */
+#define UPLOAD_MERGE_WASTE	25
+
+/* The most vertices a draw can address with 16 bit indices */
+#define MAX_DRAW_VERTICES	65536
+
+/* Draw 'nfans' triangle fans of 'nvtx' vertices in total as one list of
+ * indexed triangles. */
+static void
+draw_triangle_fans(struct weston_view *ev, GLfloat *v, unsigned int *vtxcnt,
+		   int nfans, int nvtx)
+{
+	struct gl_renderer *gr = get_renderer(ev->surface->compositor);
+	GLushort *index;
+	int i, first;
+
+	gr->indices.size = 0;
+	index = wl_array_add(&gr->indices,
+			     triangle_fans_index_count(nfans, nvtx) *
+			     sizeof *index);
+	if (!index)
+		return;
+
+	stream_draw_triangle_fans(&gr->vertex_stream, &gr->index_stream,
+				  index, v, vtxcnt, nfans, nvtx);
+
+	if (gr->fan_debug) {
+		/* triangle_fan_debug() draws from client memory */
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		for (i = 0, first = 0; i < nfans; i++) {
+			triangle_fan_debug(ev, first, vtxcnt[i]);
+			first += vtxcnt[i];
+		}
+	}
+}
+
 static void
 repaint_region(struct weston_view *ev, pixman_region32_t *region,
 		pixman_region32_t *surf_region)
@@ -396,7 +529,7 @@ repaint_region(struct weston_view *ev, pixman_region32_t *region,
 	struct gl_renderer *gr = get_renderer(ec);
 	GLfloat *v;
 	unsigned int *vtxcnt;
-	int i, first, nfans;
+	int i, j, first, nfans, nvtx;
 
 	/* The final region to be painted is the intersection of
 	 * 'region' and 'surf_region'. However, 'region' is in the global
@@ -411,24 +544,25 @@ repaint_region(struct weston_view *ev, pixman_region32_t *region,
 	v = gr->vertices.data;
 	vtxcnt = gr->vtxcnt.data;
 
-	/* position: */
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
-	glEnableVertexAttribArray(0);
-
-	/* texcoord: */
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
-	glEnableVertexAttribArray(1);
+	/* The fans go through the stream buffers and are drawn with as
+	 * few calls as 16 bit indices allow, normally just one. */
+	for (i = 0, first = 0; i < nfans; i = j) {
+		nvtx = 0;
+		for (j = i; j < nfans &&
+			    nvtx + vtxcnt[j] <= MAX_DRAW_VERTICES; j++)
+			nvtx += vtxcnt[j];
 
-	for (i = 0, first = 0; i < nfans; i++) {
-		glDrawArrays(GL_TRIANGLE_FAN, first, vtxcnt[i]);
-		if (gr->fan_debug)
-			triangle_fan_debug(ev, first, vtxcnt[i]);
-		first += vtxcnt[i];
+		draw_triangle_fans(ev, &v[first * 4], &vtxcnt[i], j - i, nvtx);
+		first += nvtx;
 	}
 
 	glDisableVertexAttribArray(1);
 	glDisableVertexAttribArray(0);
 
+	/* The rest of the renderer draws from client memory */
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
 	gr->vertices.size = 0;
 	gr->vtxcnt.size = 0;
 }
@@ -755,6 +889,50 @@ output_rotate_damage(struct weston_output *output,
 	pixman_region32_copy(&go->buffer_damage[0], output_damage);
 }
 
+/* Hand the pending reads of the output to their callbacks.  By now the
+ * GPU has normally finished the frame they were issued after, so the
+ * mapping does not wait.  Without 'map', for when the context can not
+ * be made current, the callbacks get no pixels. */
+static void
+output_complete_readbacks(struct weston_output *output, int map)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_readback *rb, *next;
+	struct wl_list readbacks;
+	void *pixels = NULL;
+
+	if (wl_list_empty(&go->readbacks))
+		return;
+
+	/* Reads issued from the callbacks wait for the next round */
+	wl_list_init(&readbacks);
+	wl_list_insert_list(&readbacks, &go->readbacks);
+	wl_list_init(&go->readbacks);
+	wl_event_source_timer_update(go->readback_timer, 0);
+
+	wl_list_for_each_safe(rb, next, &readbacks, link) {
+		if (map) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, rb->pbo);
+			pixels = gr->map_buffer_range(GL_PIXEL_PACK_BUFFER_NV,
+						      0, rb->length,
+						      GL_MAP_READ_BIT_EXT);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+		}
+
+		rb->done(pixels, rb->data);
+
+		if (pixels) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, rb->pbo);
+			gr->unmap_buffer(GL_PIXEL_PACK_BUFFER_NV);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+		}
+
+		wl_list_remove(&rb->link);
+		wl_list_insert(&gr->readback_pool, &rb->link);
+	}
+}
+
 static void
 gl_renderer_repaint_output(struct weston_output *output,
 			      pixman_region32_t *output_damage)
@@ -775,6 +953,8 @@ gl_renderer_repaint_output(struct weston_output *output,
 	if (use_output(output) < 0)
 		return;
 
+	output_complete_readbacks(output, 1);
+
 	/* if debugging, redraw everything outside the damage to clean up
 	 * debug lines from the previous draw on this buffer:
 	 */
@@ -796,6 +976,8 @@ gl_renderer_repaint_output(struct weston_output *output,
 	output_rotate_damage(output, output_damage);
 
 	pixman_region32_union(&total_damage, &buffer_damage, output_damage);
+	weston_output_simplify_damage(output, &total_damage,
+				      GL_RENDERER_MAX_DAMAGE_RECTS);
 
 	repaint_views(output, &total_damage);
 
@@ -804,6 +986,14 @@ gl_renderer_repaint_output(struct weston_output *output,
 
 	draw_output_border(output);
 
+	if (gr->upload_debug && gr->upload_count)
+		weston_log("%s: %u shm uploads, %" PRIu64 " bytes in "
+			   "%" PRIu64 " us\n", output->name, gr->upload_count,
+			   gr->upload_bytes, gr->upload_nsec / 1000);
+	gr->upload_count = 0;
+	gr->upload_bytes = 0;
+	gr->upload_nsec = 0;
+
 	pixman_region32_copy(&output->previous_damage, output_damage);
 	wl_signal_emit(&output->frame_signal, output);
 
@@ -845,6 +1035,437 @@ gl_renderer_read_pixels(struct weston_output *output,
 	return 0;
 }
 
+static int
+readback_timer_handler(void *data)
+{
+	struct weston_output *output = data;
+
+	output_complete_readbacks(output, use_output(output) == 0);
+
+	return 0;
+}
+
+static int
+gl_renderer_read_pixels_async(struct weston_output *output,
+			      pixman_format_code_t format,
+			      uint32_t x, uint32_t y,
+			      uint32_t width, uint32_t height,
+			      weston_read_pixels_done_func_t done,
+			      void *data)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_readback *rb;
+	GLenum gl_format;
+	int refresh = 0;
+
+	switch (format) {
+	case PIXMAN_a8r8g8b8:
+		gl_format = GL_BGRA_EXT;
+		break;
+	case PIXMAN_a8b8g8r8:
+		gl_format = GL_RGBA;
+		break;
+	default:
+		return -1;
+	}
+
+	if (use_output(output) < 0)
+		return -1;
+
+	if (!wl_list_empty(&gr->readback_pool)) {
+		rb = container_of(gr->readback_pool.next,
+				  struct gl_readback, link);
+		wl_list_remove(&rb->link);
+	} else {
+		rb = calloc(1, sizeof *rb);
+		if (!rb)
+			return -1;
+		glGenBuffers(1, &rb->pbo);
+	}
+
+	rb->length = (GLsizeiptr) width * height * 4;
+	rb->done = done;
+	rb->data = data;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, rb->pbo);
+	if (rb->size < rb->length) {
+		glBufferData(GL_PIXEL_PACK_BUFFER_NV, rb->length, NULL,
+			     GL_STREAM_DRAW);
+		rb->size = rb->length;
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(x, y, width, height, gl_format,
+		     GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+
+	wl_list_insert(go->readbacks.prev, &rb->link);
+
+	if (output->current_mode->refresh > 0)
+		refresh = 1000000 / output->current_mode->refresh;
+	wl_event_source_timer_update(go->readback_timer,
+				     refresh > 0 ? refresh : 16);
+
+	return 0;
+}
+
+/* Find a free block at 'level' below 'node', which covers the block of
+ * 'size' at x, y, and mark it used. */
+static int
+atlas_alloc_node(uint8_t *nodes, int node, int level, int x, int y,
+		 int size, int *block_x, int *block_y)
+{
+	int i, found;
+
+	if (nodes[node] == ATLAS_NODE_USED)
+		return -1;
+
+	if (level == 0) {
+		if (nodes[node] != ATLAS_NODE_FREE)
+			return -1;
+		nodes[node] = ATLAS_NODE_USED;
+		*block_x = x;
+		*block_y = y;
+		return node;
+	}
+
+	nodes[node] = ATLAS_NODE_SPLIT;
+	size /= 2;
+	for (i = 0; i < 4; i++) {
+		found = atlas_alloc_node(nodes, 4 * node + 1 + i, level - 1,
+					 x + (i & 1) * size,
+					 y + (i >> 1) * size, size,
+					 block_x, block_y);
+		if (found >= 0)
+			return found;
+	}
+
+	return -1;
+}
+
+/* Free a block, merging it back with its siblings when all are free */
+static void
+atlas_free_node(uint8_t *nodes, int node)
+{
+	int parent, i;
+
+	nodes[node] = ATLAS_NODE_FREE;
+	while (node > 0) {
+		parent = (node - 1) / 4;
+		for (i = 0; i < 4; i++)
+			if (nodes[4 * parent + 1 + i] != ATLAS_NODE_FREE)
+				return;
+		nodes[parent] = ATLAS_NODE_FREE;
+		node = parent;
+	}
+}
+
+/* Only buffers uploaded as BGRA go in the atlas.  Without
+ * GL_EXT_unpack_subimage a buffer is uploaded whole, so its rows must
+ * not be wider than it is. */
+static int
+surface_state_wants_atlas(struct gl_renderer *gr, struct weston_buffer *buffer,
+			  uint32_t format, int pitch)
+{
+	if (buffer->width > gr->atlas_max_size ||
+	    buffer->height > gr->atlas_max_size)
+		return 0;
+
+	if (!gr->has_unpack_subimage && pitch != buffer->width)
+		return 0;
+
+	return format == WL_SHM_FORMAT_XRGB8888 ||
+	       format == WL_SHM_FORMAT_ARGB8888 ||
+	       shm_convert_supported(format);
+}
+
+static int
+surface_state_place_in_atlas(struct gl_renderer *gr,
+			     struct gl_surface_state *gs,
+			     struct weston_buffer *buffer)
+{
+	int size = ATLAS_SIZE, level = 0, node, x, y;
+
+	while (size / 2 >= ATLAS_MIN_BLOCK &&
+	       size / 2 >= buffer->width + 2 &&
+	       size / 2 >= buffer->height + 2) {
+		size /= 2;
+		level++;
+	}
+
+	if (!gr->atlas_texture) {
+		glGenTextures(1, &gr->atlas_texture);
+		glBindTexture(GL_TEXTURE_2D, gr->atlas_texture);
+		glTexParameteri(GL_TEXTURE_2D,
+				GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,
+				GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT,
+			     ATLAS_SIZE, ATLAS_SIZE, 0,
+			     GL_BGRA_EXT, GL_UNSIGNED_BYTE, NULL);
+	}
+
+	node = atlas_alloc_node(gr->atlas_nodes, 0, level, 0, 0, ATLAS_SIZE,
+				&x, &y);
+	if (node < 0)
+		return -1;
+
+	glDeleteTextures(gs->num_textures, gs->textures);
+	gs->textures[0] = gr->atlas_texture;
+	gs->num_textures = 1;
+	gs->atlas_node = node;
+	gs->atlas_x = x + 1;
+	gs->atlas_y = y + 1;
+	gs->atlas_size = size;
+
+	return 0;
+}
+
+/* Give the atlas block back; the surface has no texture after this. */
+static void
+surface_state_release_atlas(struct gl_renderer *gr,
+			    struct gl_surface_state *gs)
+{
+	if (gs->atlas_node < 0)
+		return;
+
+	atlas_free_node(gr->atlas_nodes, gs->atlas_node);
+	gs->atlas_node = -1;
+	gs->textures[0] = 0;
+	gs->num_textures = 0;
+}
+
+/* Upload rows y1 to y2 of column x of the buffer to column dst_x of
+ * the atlas, repeating the first and last row for the corners of the
+ * border. */
+static void
+atlas_upload_column(struct gl_surface_state *gs, uint32_t *pixels,
+		    int height, int x, int dst_x, int y1, int y2)
+{
+	uint32_t column[ATLAS_SIZE / 2];
+	int y, n = 0;
+
+	for (y = y1; y < y2; y++)
+		column[n++] = pixels[(y < 0 ? 0 : y < height ? y : height - 1) *
+				     gs->pitch + x];
+
+	glTexSubImage2D(GL_TEXTURE_2D, 0, dst_x, gs->atlas_y + y1, 1, n,
+			GL_BGRA_EXT, GL_UNSIGNED_BYTE, column);
+}
+
+/* Repeat the edges of 'box' of an atlas buffer that lie on the edges of
+ * the buffer into its border, so that linear filtering does not blend
+ * in the neighbouring blocks, like GL_CLAMP_TO_EDGE would. */
+static void
+atlas_upload_border(struct gl_renderer *gr, struct gl_surface_state *gs,
+		    struct weston_buffer *buffer, void *data,
+		    pixman_box32_t *box)
+{
+	uint32_t *pixels = data;
+	int width = buffer->width, height = buffer->height;
+	int y1, y2;
+
+#ifdef GL_EXT_unpack_subimage
+	if (gr->has_unpack_subimage) {
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	}
+#endif
+
+	if (box->y1 == 0)
+		glTexSubImage2D(GL_TEXTURE_2D, 0,
+				gs->atlas_x + box->x1, gs->atlas_y - 1,
+				box->x2 - box->x1, 1,
+				GL_BGRA_EXT, GL_UNSIGNED_BYTE,
+				&pixels[box->x1]);
+	if (box->y2 == height)
+		glTexSubImage2D(GL_TEXTURE_2D, 0,
+				gs->atlas_x + box->x1, gs->atlas_y + height,
+				box->x2 - box->x1, 1,
+				GL_BGRA_EXT, GL_UNSIGNED_BYTE,
+				&pixels[(height - 1) * gs->pitch + box->x1]);
+
+	/* The columns take the corners along */
+	y1 = box->y1 == 0 ? -1 : box->y1;
+	y2 = box->y2 == height ? height + 1 : box->y2;
+	if (box->x1 == 0)
+		atlas_upload_column(gs, pixels, height, 0,
+				    gs->atlas_x - 1, y1, y2);
+	if (box->x2 == width)
+		atlas_upload_column(gs, pixels, height, width - 1,
+				    gs->atlas_x + width, y1, y2);
+}
+
+/* Clip a damage rectangle to the buffer, as uploading past its edges
+ * would overwrite the neighbours of a buffer in the atlas. */
+static int
+clip_buffer_rect(pixman_box32_t *r, const pixman_box32_t *full)
+{
+	r->x1 = max(r->x1, full->x1);
+	r->y1 = max(r->y1, full->y1);
+	r->x2 = min(r->x2, full->x2);
+	r->y2 = min(r->y2, full->y2);
+
+	return r->x1 < r->x2 && r->y1 < r->y2;
+}
+
+/* Bring the conversion copy up to date with the texture damage, or all
+ * of it for a full upload. */
+static void
+convert_shm_damage(struct gl_surface_state *gs, struct weston_buffer *buffer)
+{
+	struct wl_shm_buffer *shm_buffer = buffer->shm_buffer;
+	pixman_box32_t *rectangles, box;
+	int i, n;
+
+	if (gs->needs_full_upload) {
+		box.x1 = 0;
+		box.y1 = 0;
+		box.x2 = buffer->width;
+		box.y2 = buffer->height;
+		shm_convert_box(gs->shm_format,
+				wl_shm_buffer_get_data(shm_buffer),
+				wl_shm_buffer_get_stride(shm_buffer),
+				buffer->height,
+				gs->convert_data, gs->pitch * 4, &box);
+		return;
+	}
+
+	rectangles = pixman_region32_rectangles(&gs->texture_damage, &n);
+	for (i = 0; i < n; i++) {
+		box = weston_surface_to_buffer_rect(gs->surface,
+						    rectangles[i]);
+		box.x1 = box.x1 > 0 ? box.x1 : 0;
+		box.y1 = box.y1 > 0 ? box.y1 : 0;
+		box.x2 = MIN(box.x2, buffer->width);
+		box.y2 = MIN(box.y2, buffer->height);
+
+		shm_convert_box(gs->shm_format,
+				wl_shm_buffer_get_data(shm_buffer),
+				wl_shm_buffer_get_stride(shm_buffer),
+				buffer->height,
+				gs->convert_data, gs->pitch * 4, &box);
+	}
+}
+
+static int64_t
+box_area(const pixman_box32_t *box)
+{
+	return (int64_t) (box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+/* Merge neighbouring boxes, in the order of region rectangles, into
+ * their bounding box while it adds at most UPLOAD_MERGE_WASTE percent of
+ * pixels that are not damaged.  Returns the new number of boxes. */
+static int
+merge_upload_boxes(pixman_box32_t *boxes, int n)
+{
+	pixman_box32_t merged, u;
+	int64_t used, area;
+	int i, count = 0;
+
+	if (n == 0)
+		return 0;
+
+	merged = boxes[0];
+	used = box_area(&merged);
+	for (i = 1; i < n; i++) {
+		u.x1 = min(merged.x1, boxes[i].x1);
+		u.y1 = min(merged.y1, boxes[i].y1);
+		u.x2 = max(merged.x2, boxes[i].x2);
+		u.y2 = max(merged.y2, boxes[i].y2);
+		area = box_area(&boxes[i]);
+
+		if (box_area(&u) * 100 <=
+		    (used + area) * (100 + UPLOAD_MERGE_WASTE)) {
+			merged = u;
+			used += area;
+		} else {
+			boxes[count++] = merged;
+			merged = boxes[i];
+			used = area;
+		}
+	}
+	boxes[count++] = merged;
+
+	return count;
+}
+
+/* Copy a box of 'data' into the upload stream and start the texture
+ * upload from there.  The rows are packed, so no unpack state beyond
+ * the alignment is needed. */
+static int
+upload_box_staged(struct gl_renderer *gr, struct gl_surface_state *gs,
+		  const uint8_t *data, int bpp, GLenum format, int pixel_type,
+		  int x0, int y0, const pixman_box32_t *box)
+{
+	int width = box->x2 - box->x1, height = box->y2 - box->y1;
+	int row = width * bpp, stride = (row + 3) & ~3;
+	GLsizeiptr offset;
+	uint8_t *dst;
+	int y;
+
+	offset = stream_buffer_reserve(&gr->upload_stream,
+				       (GLsizeiptr) stride * height);
+	dst = gr->map_buffer_range(GL_PIXEL_UNPACK_BUFFER_NV, offset,
+				   (GLsizeiptr) stride * height,
+				   GL_MAP_WRITE_BIT_EXT |
+				   GL_MAP_INVALIDATE_RANGE_BIT_EXT |
+				   GL_MAP_UNSYNCHRONIZED_BIT_EXT);
+	if (!dst) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		return -1;
+	}
+
+	data += ((size_t) box->y1 * gs->pitch + box->x1) * bpp;
+	for (y = 0; y < height; y++)
+		memcpy(dst + (size_t) y * stride,
+		       data + (size_t) y * gs->pitch * bpp, row);
+	gr->unmap_buffer(GL_PIXEL_UNPACK_BUFFER_NV);
+
+#ifdef GL_EXT_unpack_subimage
+	if (gr->has_unpack_subimage) {
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	}
+#endif
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x0 + box->x1, y0 + box->y1,
+			width, height, format, pixel_type,
+			(void *) (uintptr_t) offset);
+
+	return 0;
+}
+
+/* Upload a box of 'data', in buffer coordinates, to the texture at
+ * x0, y0.  Fails if the box could not be staged and there is no other
+ * way to upload part of the buffer. */
+static int
+upload_box(struct gl_renderer *gr, struct gl_surface_state *gs,
+	   const uint8_t *data, int bpp, GLenum format, int pixel_type,
+	   int x0, int y0, const pixman_box32_t *box)
+{
+	if (gr->has_pbo &&
+	    upload_box_staged(gr, gs, data, bpp, format, pixel_type,
+			      x0, y0, box) == 0)
+		return 0;
+
+	if (!gr->has_unpack_subimage)
+		return -1;
+
+#ifdef GL_EXT_unpack_subimage
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, gs->pitch);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, box->x1);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, box->y1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x0 + box->x1, y0 + box->y1,
+			box->x2 - box->x1, box->y2 - box->y1,
+			format, pixel_type, data);
+#endif
+
+	return 0;
+}
+
 static void
 gl_renderer_flush_damage(struct weston_surface *surface)
 {
@@ -855,12 +1476,12 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	int texture_used;
 	GLenum format;
 	int pixel_type;
-
-#ifdef GL_EXT_unpack_subimage
-	pixman_box32_t *rectangles;
 	void *data;
-	int i, n;
-#endif
+	pixman_box32_t full;
+	int x0 = 0, y0 = 0, width, bpp;
+	pixman_box32_t *rectangles, *boxes;
+	struct timespec begin, end;
+	int i, n, count;
 
 	pixman_region32_union(&gs->texture_damage,
 			      &gs->texture_damage, &surface->damage);
@@ -898,54 +1519,115 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 		pixel_type = GL_UNSIGNED_SHORT_5_6_5;
 		break;
 	default:
+		if (shm_convert_supported(gs->shm_format)) {
+			if (!gs->convert_data)
+				goto done;
+			format = GL_BGRA_EXT;
+			pixel_type = GL_UNSIGNED_BYTE;
+			break;
+		}
 		weston_log("warning: unknown shm buffer format\n");
 		format = GL_BGRA_EXT;
 		pixel_type = GL_UNSIGNED_BYTE;
 	}
 
-	glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
-
-	if (!gr->has_unpack_subimage) {
+	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	if (gs->convert_data) {
 		wl_shm_buffer_begin_access(buffer->shm_buffer);
-		glTexImage2D(GL_TEXTURE_2D, 0, format,
-			     gs->pitch, buffer->height, 0,
-			     format, pixel_type,
-			     wl_shm_buffer_get_data(buffer->shm_buffer));
+		convert_shm_damage(gs, buffer);
 		wl_shm_buffer_end_access(buffer->shm_buffer);
+		data = gs->convert_data;
+	}
 
-		goto done;
+	glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
+
+	/* A buffer in the atlas only owns its block of the texture */
+	full.x1 = 0;
+	full.y1 = 0;
+	full.x2 = buffer->width;
+	full.y2 = buffer->height;
+	width = gs->pitch;
+	if (gs->atlas_node >= 0) {
+		x0 = gs->atlas_x;
+		y0 = gs->atlas_y;
+		width = buffer->width;
 	}
 
-#ifdef GL_EXT_unpack_subimage
-	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, gs->pitch);
-	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	bpp = pixel_type == GL_UNSIGNED_SHORT_5_6_5 ? 2 : 4;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+
+	/* Without either extension, or for a texture that has to change
+	 * format, the whole buffer is specified again. */
+	if (!gr->has_unpack_subimage &&
+	    (!gr->has_pbo || format != GL_BGRA_EXT))
+		goto upload_whole;
 
+	/* The boxes to upload, in buffer coordinates */
+	gr->upload_boxes.size = 0;
 	if (gs->needs_full_upload) {
-		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
-		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
-		wl_shm_buffer_begin_access(buffer->shm_buffer);
-		glTexSubImage2D(GL_TEXTURE_2D, 0,
-				0, 0, gs->pitch, buffer->height,
-				format, pixel_type, data);
-		wl_shm_buffer_end_access(buffer->shm_buffer);
-		goto done;
+		n = 1;
+		boxes = wl_array_add(&gr->upload_boxes, sizeof *boxes);
+		if (!boxes)
+			goto end_access;
+		boxes[0] = full;
+		boxes[0].x2 = width;
+	} else {
+		rectangles = pixman_region32_rectangles(&gs->texture_damage,
+							&n);
+		boxes = wl_array_add(&gr->upload_boxes, n * sizeof *boxes);
+		if (!boxes)
+			goto end_access;
+
+		for (i = 0, count = 0; i < n; i++) {
+			boxes[count] =
+				weston_surface_to_buffer_rect(surface,
+							      rectangles[i]);
+			if (clip_buffer_rect(&boxes[count], &full))
+				count++;
+		}
+		n = merge_upload_boxes(boxes, count);
 	}
 
-	rectangles = pixman_region32_rectangles(&gs->texture_damage, &n);
-	wl_shm_buffer_begin_access(buffer->shm_buffer);
 	for (i = 0; i < n; i++) {
-		pixman_box32_t r;
+		if (upload_box(gr, gs, data, bpp, format, pixel_type,
+			       x0, y0, &boxes[i]) < 0)
+			break;
+		gr->upload_count++;
+		gr->upload_bytes += box_area(&boxes[i]) * bpp;
+	}
+	if (gr->has_pbo)
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+
+	/* Staging failed, and there is no other way to upload a part */
+	if (i < n)
+		goto upload_whole;
 
-		r = weston_surface_to_buffer_rect(surface, rectangles[i]);
+	/* After the boxes, as this changes the unpack state */
+	for (i = 0; gs->atlas_node >= 0 && i < n; i++)
+		atlas_upload_border(gr, gs, buffer, data, &boxes[i]);
 
-		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, r.x1);
-		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, r.y1);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x1, r.y1,
-				r.x2 - r.x1, r.y2 - r.y1,
+	goto end_access;
+
+upload_whole:
+	if (gs->atlas_node >= 0) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0,
+				width, buffer->height,
 				format, pixel_type, data);
+		atlas_upload_border(gr, gs, buffer, data, &full);
+	} else {
+		glTexImage2D(GL_TEXTURE_2D, 0, format,
+			     gs->pitch, buffer->height, 0,
+			     format, pixel_type, data);
 	}
+	gr->upload_count++;
+	gr->upload_bytes += (uint64_t) width * buffer->height * bpp;
+
+end_access:
 	wl_shm_buffer_end_access(buffer->shm_buffer);
-#endif
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	gr->upload_nsec += (end.tv_sec - begin.tv_sec) * 1000000000LL +
+		end.tv_nsec - begin.tv_nsec;
 
 done:
 	pixman_region32_fini(&gs->texture_damage);
@@ -982,13 +1664,14 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 	struct weston_compositor *ec = es->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
 	struct gl_surface_state *gs = get_surface_state(es);
+	uint32_t format = wl_shm_buffer_get_format(shm_buffer);
 	int pitch;
 
 	buffer->shm_buffer = shm_buffer;
 	buffer->width = wl_shm_buffer_get_width(shm_buffer);
 	buffer->height = wl_shm_buffer_get_height(shm_buffer);
 
-	switch (wl_shm_buffer_get_format(shm_buffer)) {
+	switch (format) {
 	case WL_SHM_FORMAT_XRGB8888:
 		gs->shader = &gr->texture_shader_rgbx;
 		pitch = wl_shm_buffer_get_stride(shm_buffer) / 4;
@@ -1002,6 +1685,14 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 		pitch = wl_shm_buffer_get_stride(shm_buffer) / 2;
 		break;
 	default:
+		if (shm_convert_supported(format)) {
+			if (shm_convert_has_alpha(format))
+				gs->shader = &gr->texture_shader_rgba;
+			else
+				gs->shader = &gr->texture_shader_rgbx;
+			pitch = buffer->width;
+			break;
+		}
 		weston_log("warning: unknown shm buffer format\n");
 		gs->shader = &gr->texture_shader_rgba;
 		pitch = wl_shm_buffer_get_stride(shm_buffer) / 4;
@@ -1009,10 +1700,16 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 
 	/* Only allocate a texture if it doesn't match existing one.
 	 * If a switch from DRM allocated buffer to a SHM buffer is
-	 * happening, we need to allocate a new texture buffer. */
+	 * happening, we need to allocate a new texture buffer.  Small
+	 * buffers get a block of the atlas instead, which the pitch
+	 * does not size, so a wider buffer may need a larger one. */
 	if (pitch != gs->pitch ||
 	    buffer->height != gs->height ||
-	    gs->buffer_type != BUFFER_TYPE_SHM) {
+	    gs->buffer_type != BUFFER_TYPE_SHM ||
+	    (gs->atlas_node >= 0 &&
+	     (!surface_state_wants_atlas(gr, buffer, format, pitch) ||
+	      buffer->width + 2 > gs->atlas_size ||
+	      buffer->height + 2 > gs->atlas_size))) {
 		gs->pitch = pitch;
 		gs->height = buffer->height;
 		gs->target = GL_TEXTURE_2D;
@@ -1022,11 +1719,31 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 
 		gs->surface = es;
 
-		ensure_textures(gs, 1);
-		glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT,
-			     gs->pitch, buffer->height, 0,
-			     GL_BGRA_EXT, GL_UNSIGNED_BYTE, NULL);
+		surface_state_release_atlas(gr, gs);
+		if (!surface_state_wants_atlas(gr, buffer, format, pitch) ||
+		    surface_state_place_in_atlas(gr, gs, buffer) < 0) {
+			ensure_textures(gs, 1);
+			glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT,
+				     gs->pitch, buffer->height, 0,
+				     GL_BGRA_EXT, GL_UNSIGNED_BYTE, NULL);
+		}
+	}
+
+	/* The conversion copy only holds what the last buffer showed if
+	 * that was converted the same way. */
+	if (format != gs->shm_format)
+		gs->needs_full_upload = 1;
+	gs->shm_format = format;
+
+	if (!shm_convert_supported(format)) {
+		free(gs->convert_data);
+		gs->convert_data = NULL;
+	} else if (!gs->convert_data || gs->needs_full_upload) {
+		free(gs->convert_data);
+		gs->convert_data = malloc(gs->pitch * gs->height * 4);
+		if (!gs->convert_data)
+			weston_log("failed to allocate shm conversion copy\n");
 	}
 }
 
@@ -1051,6 +1768,7 @@ gl_renderer_attach_egl(struct weston_surface *es, struct weston_buffer *buffer,
 	for (i = 0; i < gs->num_images; i++)
 		gr->destroy_image(gr->egl_display, gs->images[i]);
 	gs->num_images = 0;
+	surface_state_release_atlas(gr, gs);
 	gs->target = GL_TEXTURE_2D;
 	switch (format) {
 	case EGL_TEXTURE_RGB:
@@ -1124,6 +1842,7 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 			gs->images[i] = NULL;
 		}
 		gs->num_images = 0;
+		surface_state_release_atlas(gr, gs);
 		glDeleteTextures(gs->num_textures, gs->textures);
 		gs->num_textures = 0;
 		gs->buffer_type = BUFFER_TYPE_NULL;
@@ -1171,6 +1890,7 @@ surface_state_destroy(struct gl_surface_state *gs, struct gl_renderer *gr)
 
 	gs->surface->renderer_state = NULL;
 
+	surface_state_release_atlas(gr, gs);
 	glDeleteTextures(gs->num_textures, gs->textures);
 
 	for (i = 0; i < gs->num_images; i++)
@@ -1178,6 +1898,7 @@ surface_state_destroy(struct gl_surface_state *gs, struct gl_renderer *gr)
 
 	weston_buffer_reference(&gs->buffer_ref, NULL);
 	pixman_region32_fini(&gs->texture_damage);
+	free(gs->convert_data);
 	free(gs);
 }
 
@@ -1225,6 +1946,7 @@ gl_renderer_create_surface(struct weston_surface *surface)
 	 */
 	gs->pitch = 1;
 	gs->y_inverted = 1;
+	gs->atlas_node = -1;
 
 	gs->surface = surface;
 
@@ -1377,31 +2099,173 @@ compile_shader(GLenum type, int count, const char **sources)
 	return s;
 }
 
+#define PROGRAM_CACHE_MAGIC	0x57504243	/* "WPBC" */
+
+struct program_cache_header {
+	uint32_t magic;
+	uint32_t format;
+	uint64_t key;
+	uint32_t length;
+};
+
+/* FNV-1a, over the terminating null too, so that consecutive strings
+ * cannot run into each other. */
+static uint64_t
+hash_string(uint64_t hash, const char *str)
+{
+	do {
+		hash ^= (unsigned char) *str;
+		hash *= 0x100000001b3ULL;
+	} while (*str++);
+
+	return hash;
+}
+
+static uint64_t
+program_cache_key(struct gl_renderer *gr, const char *vertex_source,
+		  const char **fragment_sources, int count)
+{
+	uint64_t key = gr->program_cache_driver;
+	int i;
+
+	key = hash_string(key, vertex_source);
+	for (i = 0; i < count; i++)
+		key = hash_string(key, fragment_sources[i]);
+
+	return key;
+}
+
+static char *
+program_cache_path(struct gl_renderer *gr, uint64_t key)
+{
+	char *path;
+
+	if (asprintf(&path, "%s/weston-program-%016" PRIx64 ".bin",
+		     gr->program_cache_dir, key) < 0)
+		return NULL;
+
+	return path;
+}
+
+static void
+program_cache_log(struct gl_renderer *gr, const char *what, uint64_t key)
+{
+	weston_log("GL program cache: %s %016" PRIx64
+		   " (%d hits, %d misses)\n", what, key,
+		   gr->program_cache_hits, gr->program_cache_misses);
+}
+
+/* Create the program of 'shader' from the cached binary for 'key', if
+ * there is one the driver still accepts. */
 static int
-shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
-		   const char *vertex_source, const char *fragment_source)
+program_cache_load(struct gl_renderer *gr, struct gl_shader *shader,
+		   uint64_t key)
+{
+	struct program_cache_header header;
+	char *path;
+	void *binary = NULL;
+	FILE *fp;
+	GLuint program;
+	GLint status = 0;
+
+	path = program_cache_path(gr, key);
+	if (!path)
+		return -1;
+	fp = fopen(path, "rb");
+	free(path);
+
+	if (fp && fread(&header, sizeof header, 1, fp) == 1 &&
+	    header.magic == PROGRAM_CACHE_MAGIC && header.key == key &&
+	    (binary = malloc(header.length)) &&
+	    fread(binary, header.length, 1, fp) == 1) {
+		program = glCreateProgram();
+		gr->program_binary(program, header.format, binary,
+				   header.length);
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (status)
+			shader->program = program;
+		else
+			glDeleteProgram(program);
+	}
+
+	free(binary);
+	if (fp)
+		fclose(fp);
+
+	if (status) {
+		gr->program_cache_hits++;
+		program_cache_log(gr, "hit", key);
+		return 0;
+	}
+
+	gr->program_cache_misses++;
+	program_cache_log(gr, "miss", key);
+	return -1;
+}
+
+/* Save the binary of a freshly linked program under 'key'.  It is
+ * written aside and renamed into place, so that another compositor
+ * starting at the same time never reads half a file. */
+static void
+program_cache_store(struct gl_renderer *gr, GLuint program, uint64_t key)
+{
+	struct program_cache_header header;
+	char *path, *tmp;
+	void *binary;
+	GLint length = 0;
+	GLenum format;
+	FILE *fp;
+	int ok;
+
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+	if (length <= 0)
+		return;
+
+	binary = malloc(length);
+	if (!binary)
+		return;
+	gr->get_program_binary(program, length, &length, &format, binary);
+
+	path = program_cache_path(gr, key);
+	if (!path || asprintf(&tmp, "%s.%d", path, getpid()) < 0) {
+		free(path);
+		free(binary);
+		return;
+	}
+
+	header.magic = PROGRAM_CACHE_MAGIC;
+	header.format = format;
+	header.key = key;
+	header.length = length;
+
+	fp = fopen(tmp, "wb");
+	ok = fp && fwrite(&header, sizeof header, 1, fp) == 1 &&
+		fwrite(binary, length, 1, fp) == 1;
+	if (fp && fclose(fp) != 0)
+		ok = 0;
+
+	if (!ok || rename(tmp, path) < 0) {
+		weston_log("GL program cache: failed to write %s: %m\n",
+			   path);
+		unlink(tmp);
+	}
+
+	free(tmp);
+	free(path);
+	free(binary);
+}
+
+static int
+shader_link(struct gl_shader *shader, const char *vertex_source,
+	    const char **fragment_sources, int count)
 {
 	char msg[512];
 	GLint status;
-	int count;
-	const char *sources[3];
 
 	shader->vertex_shader =
 		compile_shader(GL_VERTEX_SHADER, 1, &vertex_source);
-
-	if (renderer->fragment_shader_debug) {
-		sources[0] = fragment_source;
-		sources[1] = fragment_debug;
-		sources[2] = fragment_brace;
-		count = 3;
-	} else {
-		sources[0] = fragment_source;
-		sources[1] = fragment_brace;
-		count = 2;
-	}
-
 	shader->fragment_shader =
-		compile_shader(GL_FRAGMENT_SHADER, count, sources);
+		compile_shader(GL_FRAGMENT_SHADER, count, fragment_sources);
 
 	shader->program = glCreateProgram();
 	glAttachShader(shader->program, shader->vertex_shader);
@@ -1417,6 +2281,40 @@ shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 		return -1;
 	}
 
+	return 0;
+}
+
+static int
+shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
+		   const char *vertex_source, const char *fragment_source)
+{
+	int count;
+	const char *sources[3];
+	uint64_t key = 0;
+
+	if (renderer->fragment_shader_debug) {
+		sources[0] = fragment_source;
+		sources[1] = fragment_debug;
+		sources[2] = fragment_brace;
+		count = 3;
+	} else {
+		sources[0] = fragment_source;
+		sources[1] = fragment_brace;
+		count = 2;
+	}
+
+	if (renderer->program_cache_dir)
+		key = program_cache_key(renderer, vertex_source,
+					sources, count);
+
+	if (!renderer->program_cache_dir ||
+	    program_cache_load(renderer, shader, key) < 0) {
+		if (shader_link(shader, vertex_source, sources, count) < 0)
+			return -1;
+		if (renderer->program_cache_dir)
+			program_cache_store(renderer, shader->program, key);
+	}
+
 	shader->proj_uniform = glGetUniformLocation(shader->program, "proj");
 	shader->tex_uniforms[0] = glGetUniformLocation(shader->program, "tex");
 	shader->tex_uniforms[1] = glGetUniformLocation(shader->program, "tex1");
@@ -1569,6 +2467,11 @@ gl_renderer_output_create(struct weston_output *output,
 	for (i = 0; i < BUFFER_DAMAGE_COUNT; i++)
 		pixman_region32_init(&go->buffer_damage[i]);
 
+	wl_list_init(&go->readbacks);
+	go->readback_timer =
+		wl_event_loop_add_timer(wl_display_get_event_loop(ec->wl_display),
+					readback_timer_handler, output);
+
 	output->renderer_state = go;
 
 	return 0;
@@ -1584,6 +2487,9 @@ gl_renderer_output_destroy(struct weston_output *output)
 	for (i = 0; i < 2; i++)
 		pixman_region32_fini(&go->buffer_damage[i]);
 
+	output_complete_readbacks(output, use_output(output) == 0);
+	wl_event_source_remove(go->readback_timer);
+
 	eglDestroySurface(gr->egl_display, go->egl_surface);
 
 	free(go);
@@ -1599,12 +2505,23 @@ static void
 gl_renderer_destroy(struct weston_compositor *ec)
 {
 	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_readback *rb, *next;
 
 	wl_signal_emit(&gr->destroy_signal, gr);
 
 	if (gr->has_bind_display)
 		gr->unbind_display(gr->egl_display, ec->wl_display);
 
+	stream_buffer_release(&gr->vertex_stream);
+	stream_buffer_release(&gr->index_stream);
+	stream_buffer_release(&gr->upload_stream);
+	wl_list_for_each_safe(rb, next, &gr->readback_pool, link) {
+		glDeleteBuffers(1, &rb->pbo);
+		free(rb);
+	}
+	if (gr->atlas_texture)
+		glDeleteTextures(1, &gr->atlas_texture);
+
 	/* Work around crash in egl_dri2.c's dri2_make_current() - when does this apply? */
 	eglMakeCurrent(gr->egl_display,
 		       EGL_NO_SURFACE, EGL_NO_SURFACE,
@@ -1615,10 +2532,14 @@ gl_renderer_destroy(struct weston_compositor *ec)
 
 	wl_array_release(&gr->vertices);
 	wl_array_release(&gr->vtxcnt);
+	wl_array_release(&gr->indices);
+	wl_array_release(&gr->upload_boxes);
 
 	weston_binding_destroy(gr->fragment_binding);
 	weston_binding_destroy(gr->fan_binding);
+	weston_binding_destroy(gr->upload_binding);
 
+	free(gr->program_cache_dir);
 	free(gr);
 }
 
@@ -1686,6 +2607,35 @@ static const EGLint gl_renderer_alpha_attribs[] = {
 	EGL_NONE
 };
 
+/* The program cache goes in 'gl-program-cache-dir', or else in the
+ * runtime directory.  The atlas takes blocks of up to half its size,
+ * border included. */
+static void
+read_config(struct gl_renderer *gr, struct weston_config *config)
+{
+	struct weston_config_section *section;
+	int enabled;
+
+	section = weston_config_get_section(config, "core", NULL, NULL);
+
+	weston_config_section_get_int(section, "gl-atlas-max-size",
+				      &gr->atlas_max_size, 64);
+	if (gr->atlas_max_size > ATLAS_SIZE / 2 - 2)
+		gr->atlas_max_size = ATLAS_SIZE / 2 - 2;
+
+	weston_config_section_get_bool(section, "gl-program-cache",
+				       &enabled, 0);
+	if (!enabled)
+		return;
+
+	weston_config_section_get_string(section, "gl-program-cache-dir",
+					 &gr->program_cache_dir, NULL);
+	if (!gr->program_cache_dir && getenv("XDG_RUNTIME_DIR"))
+		gr->program_cache_dir = strdup(getenv("XDG_RUNTIME_DIR"));
+	if (!gr->program_cache_dir)
+		weston_log("GL program cache: no directory to keep it in\n");
+}
+
 static int
 gl_renderer_create(struct weston_compositor *ec, EGLNativeDisplayType display,
 	const EGLint *attribs, const EGLint *visual_id)
@@ -1705,6 +2655,16 @@ gl_renderer_create(struct weston_compositor *ec, EGLNativeDisplayType display,
 	gr->base.surface_set_color = gl_renderer_surface_set_color;
 	gr->base.destroy = gl_renderer_destroy;
 
+	stream_buffer_init(&gr->vertex_stream, GL_ARRAY_BUFFER,
+			   VERTEX_STREAM_SIZE);
+	stream_buffer_init(&gr->index_stream, GL_ELEMENT_ARRAY_BUFFER,
+			   INDEX_STREAM_SIZE);
+	stream_buffer_init(&gr->upload_stream, GL_PIXEL_UNPACK_BUFFER_NV,
+			   UPLOAD_STREAM_SIZE);
+	wl_list_init(&gr->readback_pool);
+
+	read_config(gr, ec->config);
+
 	gr->egl_display = eglGetDisplay(display);
 	if (gr->egl_display == EGL_NO_DISPLAY) {
 		weston_log("failed to create display\n");
@@ -1726,6 +2686,10 @@ gl_renderer_create(struct weston_compositor *ec, EGLNativeDisplayType display,
 	ec->capabilities |= WESTON_CAP_CAPTURE_YFLIP;
 
 	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_RGB565);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_XRGB2101010);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_ARGB2101010);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_NV12);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_YUYV);
 
 	wl_signal_init(&gr->destroy_signal);
 
@@ -1733,6 +2697,7 @@ gl_renderer_create(struct weston_compositor *ec, EGLNativeDisplayType display,
 
 err_egl:
 	gl_renderer_print_egl_error_state();
+	free(gr->program_cache_dir);
 	free(gr);
 	return -1;
 }
@@ -1812,12 +2777,55 @@ fan_debug_repaint_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 	weston_compositor_damage_all(compositor);
 }
 
+static void
+upload_debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		     void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct gl_renderer *gr = get_renderer(compositor);
+
+	gr->upload_debug = !gr->upload_debug;
+}
+
+/* The cache is only used if the driver can hand out program binaries;
+ * they are only good for the driver that made them. */
+static void
+setup_program_cache(struct gl_renderer *gr, const char *extensions)
+{
+	const char *str;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	GLint formats = 0;
+
+	if (strstr(extensions, "GL_OES_get_program_binary"))
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+
+	gr->get_program_binary =
+		(void *) eglGetProcAddress("glGetProgramBinaryOES");
+	gr->program_binary = (void *) eglGetProcAddress("glProgramBinaryOES");
+
+	if (formats <= 0 || !gr->get_program_binary || !gr->program_binary) {
+		weston_log("GL program cache: not supported by the driver\n");
+		free(gr->program_cache_dir);
+		gr->program_cache_dir = NULL;
+		return;
+	}
+
+	str = (const char *) glGetString(GL_RENDERER);
+	hash = hash_string(hash, str ? str : "");
+	str = (const char *) glGetString(GL_VERSION);
+	hash = hash_string(hash, str ? str : "");
+	gr->program_cache_driver = hash;
+
+	weston_log("GL program cache: using %s\n", gr->program_cache_dir);
+}
+
 static int
 gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 {
 	struct gl_renderer *gr = get_renderer(ec);
 	const char *extensions;
 	EGLBoolean ret;
+	GLint max_texture_size;
 
 	static const EGLint context_attribs[] = {
 		EGL_CONTEXT_CLIENT_VERSION, 2,
@@ -1882,9 +2890,29 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		gr->has_unpack_subimage = 1;
 #endif
 
+	if (strstr(extensions, "GL_NV_pixel_buffer_object") &&
+	    strstr(extensions, "GL_EXT_map_buffer_range") &&
+	    strstr(extensions, "GL_OES_mapbuffer")) {
+		gr->map_buffer_range =
+			(void *) eglGetProcAddress("glMapBufferRangeEXT");
+		gr->unmap_buffer =
+			(void *) eglGetProcAddress("glUnmapBufferOES");
+		gr->has_pbo = gr->map_buffer_range && gr->unmap_buffer;
+	}
+
+	if (gr->has_pbo)
+		gr->base.read_pixels_async = gl_renderer_read_pixels_async;
+
 	if (strstr(extensions, "GL_OES_EGL_image_external"))
 		gr->has_egl_image_external = 1;
 
+	if (gr->program_cache_dir)
+		setup_program_cache(gr, extensions);
+
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+	if (max_texture_size < ATLAS_SIZE)
+		gr->atlas_max_size = 0;
+
 	extensions =
 		(const char *) eglQueryString(gr->egl_display, EGL_EXTENSIONS);
 	if (!extensions) {
@@ -1919,12 +2947,18 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		weston_compositor_add_debug_binding(ec, KEY_F,
 						    fan_debug_repaint_binding,
 						    ec);
+	gr->upload_binding =
+		weston_compositor_add_debug_binding(ec, KEY_U,
+						    upload_debug_binding,
+						    ec);
 
 	weston_log("GL ES 2 renderer features:\n");
 	weston_log_continue(STAMP_SPACE "read-back format: %s\n",
 		ec->read_format == PIXMAN_a8r8g8b8 ? "BGRA" : "RGBA");
 	weston_log_continue(STAMP_SPACE "wl_shm sub-image to texture: %s\n",
 			    gr->has_unpack_subimage ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "wl_shm upload through buffer object: %s\n",
+			    gr->has_pbo ? "yes" : "no");
 	weston_log_continue(STAMP_SPACE "EGL Wayland extension: %s\n",
 			    gr->has_bind_display ? "yes" : "no");
 
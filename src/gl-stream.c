@@ -0,0 +1,139 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stddef.h>
+
+#include "gl-stream.h"
+
+void
+stream_buffer_init(struct gl_stream_buffer *sb, GLenum target,
+		   GLsizeiptr size)
+{
+	sb->target = target;
+	sb->name = 0;
+	sb->size = size;
+	sb->offset = 0;
+}
+
+void
+stream_buffer_release(struct gl_stream_buffer *sb)
+{
+	if (sb->name)
+		glDeleteBuffers(1, &sb->name);
+	sb->name = 0;
+}
+
+/* Make room for 'size' bytes at the end of the stream buffer, which is
+ * left bound, and return their offset. */
+GLsizeiptr
+stream_buffer_reserve(struct gl_stream_buffer *sb, GLsizeiptr size)
+{
+	GLsizeiptr offset;
+
+	if (!sb->name) {
+		glGenBuffers(1, &sb->name);
+		glBindBuffer(sb->target, sb->name);
+		while (sb->size < size)
+			sb->size *= 2;
+		glBufferData(sb->target, sb->size, NULL, GL_STREAM_DRAW);
+	} else if (sb->offset + size > sb->size) {
+		glBindBuffer(sb->target, sb->name);
+		while (sb->size < size)
+			sb->size *= 2;
+		glBufferData(sb->target, sb->size, NULL, GL_STREAM_DRAW);
+		sb->offset = 0;
+	} else {
+		glBindBuffer(sb->target, sb->name);
+	}
+
+	offset = sb->offset;
+	sb->offset += (size + 3) & ~3;
+
+	return offset;
+}
+
+/* Append 'size' bytes to the stream buffer, which is left bound, and
+ * return the offset they were written at. */
+GLsizeiptr
+stream_buffer_write(struct gl_stream_buffer *sb, const void *data,
+		    GLsizeiptr size)
+{
+	GLsizeiptr offset;
+
+	offset = stream_buffer_reserve(sb, size);
+	glBufferSubData(sb->target, offset, size, data);
+
+	return offset;
+}
+
+/* Write the indices of the triangles making up 'nfans' consecutive
+ * triangle fans of vtxcnt[i] vertices each. */
+void
+triangle_fans_to_list(GLushort *index, const unsigned int *vtxcnt,
+		      int nfans)
+{
+	int i, k, first;
+
+	for (i = 0, first = 0; i < nfans; i++) {
+		for (k = 1; k < (int) vtxcnt[i] - 1; k++) {
+			*index++ = first;
+			*index++ = first + k;
+			*index++ = first + k + 1;
+		}
+		first += vtxcnt[i];
+	}
+}
+
+/* Draw 'nfans' triangle fans of 'nvtx' vertices in total as one list of
+ * indexed triangles.  The vertices are position and texcoord pairs for
+ * attributes 0 and 1, and 'index' is scratch space for
+ * triangle_fans_index_count() indices.  Both stream buffers are left
+ * bound. */
+void
+stream_draw_triangle_fans(struct gl_stream_buffer *vertex_stream,
+			  struct gl_stream_buffer *index_stream,
+			  GLushort *index, const GLfloat *v,
+			  const unsigned int *vtxcnt, int nfans, int nvtx)
+{
+	GLsizeiptr vertex_offset, index_offset;
+	int nidx = triangle_fans_index_count(nfans, nvtx);
+
+	triangle_fans_to_list(index, vtxcnt, nfans);
+
+	vertex_offset = stream_buffer_write(vertex_stream, v,
+					    nvtx * 4 * sizeof *v);
+	index_offset = stream_buffer_write(index_stream, index,
+					   nidx * sizeof *index);
+
+	/* position: */
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v,
+			      (void *) vertex_offset);
+	glEnableVertexAttribArray(0);
+
+	/* texcoord: */
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v,
+			      (void *) (vertex_offset + 2 * sizeof *v));
+	glEnableVertexAttribArray(1);
+
+	glDrawElements(GL_TRIANGLES, nidx, GL_UNSIGNED_SHORT,
+		       (void *) index_offset);
+}
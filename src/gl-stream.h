@@ -0,0 +1,74 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef _WESTON_GL_STREAM_H
+#define _WESTON_GL_STREAM_H
+
+#include <GLES2/gl2.h>
+
+/* A buffer object that is written front to back as a ring.  When the
+ * next write does not fit, the storage is orphaned with glBufferData(),
+ * so the driver can hand out fresh memory instead of waiting for the
+ * draws still using the old contents. */
+struct gl_stream_buffer {
+	GLenum target;
+	GLuint name;
+	GLsizeiptr size;
+	GLsizeiptr offset;
+};
+
+/* Initial sizes of the vertex and index stream buffers, which grow to
+ * fit the largest single write. */
+#define VERTEX_STREAM_SIZE	(256 * 1024)
+#define INDEX_STREAM_SIZE	(64 * 1024)
+
+void
+stream_buffer_init(struct gl_stream_buffer *sb, GLenum target,
+		   GLsizeiptr size);
+
+void
+stream_buffer_release(struct gl_stream_buffer *sb);
+
+GLsizeiptr
+stream_buffer_reserve(struct gl_stream_buffer *sb, GLsizeiptr size);
+
+GLsizeiptr
+stream_buffer_write(struct gl_stream_buffer *sb, const void *data,
+		    GLsizeiptr size);
+
+/* Number of indices triangle_fans_to_list() writes */
+static inline int
+triangle_fans_index_count(int nfans, int nvtx)
+{
+	return (nvtx - 2 * nfans) * 3;
+}
+
+void
+triangle_fans_to_list(GLushort *index, const unsigned int *vtxcnt,
+		      int nfans);
+
+void
+stream_draw_triangle_fans(struct gl_stream_buffer *vertex_stream,
+			  struct gl_stream_buffer *index_stream,
+			  GLushort *index, const GLfloat *v,
+			  const unsigned int *vtxcnt, int nfans, int nvtx);
+
+#endif
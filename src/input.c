@@ -33,6 +33,7 @@
 
 #include "../shared/os-compatibility.h"
 #include "compositor.h"
+#include "weston-trace.h"
 
 static void
 empty_region(pixman_region32_t *region)
@@ -915,6 +916,8 @@ notify_motion(struct weston_seat *seat,
 	struct weston_compositor *ec = seat->compositor;
 	struct weston_pointer *pointer = seat->pointer;
 
+	weston_trace(WESTON_TRACE_NOTIFY_MOTION, time, dx, dy);
+
 	weston_compositor_wake(ec);
 	pointer->grab->interface->motion(pointer->grab, time, pointer->x + dx, pointer->y + dy);
 }
@@ -1251,6 +1254,8 @@ notify_key(struct weston_seat *seat, uint32_t time, uint32_t key,
 	uint32_t serial = wl_display_next_serial(compositor->wl_display);
 	uint32_t *k, *end;
 
+	weston_trace(WESTON_TRACE_NOTIFY_KEY, time, key, state);
+
 	if (state == WL_KEYBOARD_KEY_STATE_PRESSED) {
 		if (compositor->ping_handler && focus)
 			compositor->ping_handler(focus, serial);
@@ -26,6 +26,10 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include <time.h>
 
@@ -33,40 +37,312 @@
 
 #include "compositor.h"
 
+/* Size of the in-memory log ring; must be a power of two. */
+#define LOG_RING_SIZE (256 * 1024)
+
+/* Longest single formatted message; longer ones are truncated. */
+#define LOG_MESSAGE_MAX 4096
+
+/*
+ * Log messages are formatted on the calling thread and copied into a
+ * bounded ring.  A writer thread drains the ring to the log file, so a
+ * slow disk or a congested pipe never stalls the compositor.  When the
+ * ring is full, messages are dropped and counted; the writer reports the
+ * count once there is room again.
+ */
+struct log_ring {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t writer;
+	int writer_running;
+	int quit;
+
+	/* Running byte counts; positions are taken modulo the size. */
+	uint64_t head;
+	uint64_t tail;
+	uint64_t claimed;	/* end of the run being written out */
+	uint32_t dropped;
+
+	char data[LOG_RING_SIZE];
+};
+
 static FILE *weston_logfile = NULL;
+static struct log_ring *log_ring;
+
+/* Set after a crash flush; everything is written out directly from then. */
+static int log_sync;
 
 static int cached_tm_mday = -1;
 
-static int weston_log_timestamp(void)
+static void
+log_write_fd(const char *data, size_t len)
+{
+	ssize_t n;
+	int fd = fileno(weston_logfile);
+
+	while (len > 0) {
+		n = write(fd, data, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+static void
+log_write_dropped(uint32_t dropped)
+{
+	char note[64];
+	int n;
+
+	if (dropped == 0)
+		return;
+
+	n = snprintf(note, sizeof note,
+		     "[%u log messages dropped]\n", dropped);
+	log_write_fd(note, n);
+}
+
+static void *
+log_writer_thread(void *data)
+{
+	struct log_ring *ring = data;
+	uint64_t tail, len;
+	uint32_t dropped;
+
+	pthread_mutex_lock(&ring->mutex);
+	for (;;) {
+		while (ring->head == ring->tail && ring->dropped == 0 &&
+		       !ring->quit)
+			pthread_cond_wait(&ring->cond, &ring->mutex);
+
+		if ((ring->head == ring->tail && ring->dropped == 0) ||
+		    log_sync)
+			break;
+
+		/* Write the longest contiguous run without holding the
+		 * lock, so producers only ever wait for a memcpy. */
+		tail = ring->tail;
+		len = ring->head - tail;
+		if ((tail % LOG_RING_SIZE) + len > LOG_RING_SIZE)
+			len = LOG_RING_SIZE - tail % LOG_RING_SIZE;
+		/* Report drops only between complete runs, not in the
+		 * middle of a message split by the wrap-around. */
+		dropped = 0;
+		if (tail + len == ring->head) {
+			dropped = ring->dropped;
+			ring->dropped = 0;
+		}
+		__atomic_store_n(&ring->claimed, tail + len, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&ring->mutex);
+
+		if (len > 0)
+			log_write_fd(&ring->data[tail % LOG_RING_SIZE], len);
+		log_write_dropped(dropped);
+
+		pthread_mutex_lock(&ring->mutex);
+		__atomic_store_n(&ring->tail, tail + len, __ATOMIC_RELEASE);
+
+		/* weston_log_flush() has taken over. */
+		if (log_sync)
+			break;
+	}
+	pthread_mutex_unlock(&ring->mutex);
+
+	return NULL;
+}
+
+/* A forked child has no writer thread and may have inherited a locked
+ * mutex, so it logs directly until it execs. */
+static void
+log_atfork_child(void)
+{
+	log_sync = 1;
+}
+
+static void
+log_ring_create(void)
+{
+	struct log_ring *ring;
+	sigset_t all, old;
+	int ret;
+
+	ring = zalloc(sizeof *ring);
+	if (ring == NULL)
+		return;
+
+	pthread_mutex_init(&ring->mutex, NULL);
+	pthread_cond_init(&ring->cond, NULL);
+
+	/* The writer starts before main() blocks the signals it handles
+	 * through the event loop; keep them all away from it. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	ret = pthread_create(&ring->writer, NULL, log_writer_thread, ring);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (ret != 0) {
+		pthread_cond_destroy(&ring->cond);
+		pthread_mutex_destroy(&ring->mutex);
+		free(ring);
+		return;
+	}
+
+	pthread_atfork(NULL, NULL, log_atfork_child);
+	log_ring = ring;
+}
+
+static void
+log_ring_destroy(void)
+{
+	struct log_ring *ring = log_ring;
+
+	if (ring == NULL)
+		return;
+
+	pthread_mutex_lock(&ring->mutex);
+	ring->quit = 1;
+	pthread_cond_signal(&ring->cond);
+	pthread_mutex_unlock(&ring->mutex);
+
+	pthread_join(ring->writer, NULL);
+
+	log_ring = NULL;
+	pthread_cond_destroy(&ring->cond);
+	pthread_mutex_destroy(&ring->mutex);
+	free(ring);
+}
+
+static void
+log_append(const char *data, size_t len)
+{
+	struct log_ring *ring = log_ring;
+	size_t pos, first;
+
+	if (ring == NULL || log_sync) {
+		if (weston_logfile)
+			log_write_fd(data, len);
+		return;
+	}
+
+	pthread_mutex_lock(&ring->mutex);
+	if (ring->head - ring->tail + len > LOG_RING_SIZE) {
+		ring->dropped++;
+	} else {
+		pos = ring->head % LOG_RING_SIZE;
+		first = len < LOG_RING_SIZE - pos ? len : LOG_RING_SIZE - pos;
+		memcpy(&ring->data[pos], data, first);
+		memcpy(ring->data, data + first, len - first);
+		ring->head += len;
+	}
+	pthread_cond_signal(&ring->cond);
+	pthread_mutex_unlock(&ring->mutex);
+}
+
+/* Write out whatever is still queued, bypassing the writer thread, and
+ * log synchronously from then on.  Used from the crash handler, so this
+ * must not take the ring lock: the crashed thread may hold it. */
+WL_EXPORT void
+weston_log_flush(void)
+{
+	struct log_ring *ring = log_ring;
+	struct timespec ts = { 0, 1000000 };
+	uint64_t head, tail, pos, len;
+	int i;
+
+	log_sync = 1;
+
+	if (ring == NULL || weston_logfile == NULL)
+		return;
+
+	/* Give the writer a moment to finish the run it is writing out,
+	 * so that nothing comes out twice or out of order.  If it is stuck,
+	 * leave that run to it and write the rest. */
+	for (i = 0; i < 100; i++) {
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (tail == __atomic_load_n(&ring->claimed, __ATOMIC_ACQUIRE))
+			break;
+		nanosleep(&ts, NULL);
+	}
+
+	tail = __atomic_load_n(&ring->claimed, __ATOMIC_ACQUIRE);
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if (head - tail > LOG_RING_SIZE)
+		return;
+
+	while (tail < head) {
+		pos = tail % LOG_RING_SIZE;
+		len = head - tail;
+		if (pos + len > LOG_RING_SIZE)
+			len = LOG_RING_SIZE - pos;
+		log_write_fd(&ring->data[pos], len);
+		tail += len;
+	}
+
+	log_write_dropped(__atomic_exchange_n(&ring->dropped, 0,
+					      __ATOMIC_ACQ_REL));
+}
+
+static int
+log_vformat(char *buf, size_t size, const char *prefix,
+	    const char *fmt, va_list ap)
+{
+	int l, n;
+
+	l = snprintf(buf, size, "%s", prefix);
+	n = vsnprintf(buf + l, size - l, fmt, ap);
+	if (n < 0)
+		return l;
+
+	return l + n;
+}
+
+static void
+log_emit(const char *buf, int l)
+{
+	if (l >= LOG_MESSAGE_MAX)
+		l = LOG_MESSAGE_MAX - 1;
+	log_append(buf, l);
+}
+
+static int weston_log_timestamp(char *buf, size_t size)
 {
 	struct timeval tv;
 	struct tm *brokendown_time;
 	char string[128];
+	int l = 0;
 
 	gettimeofday(&tv, NULL);
 
 	brokendown_time = localtime(&tv.tv_sec);
 	if (brokendown_time == NULL)
-		return fprintf(weston_logfile, "[(NULL)localtime] ");
+		return snprintf(buf, size, "[(NULL)localtime] ");
 
 	if (brokendown_time->tm_mday != cached_tm_mday) {
 		strftime(string, sizeof string, "%Y-%m-%d %Z", brokendown_time);
-		fprintf(weston_logfile, "Date: %s\n", string);
+		l = snprintf(buf, size, "Date: %s\n", string);
 
 		cached_tm_mday = brokendown_time->tm_mday;
 	}
 
 	strftime(string, sizeof string, "%H:%M:%S", brokendown_time);
 
-	return fprintf(weston_logfile, "[%s.%03li] ", string, tv.tv_usec/1000);
+	return l + snprintf(buf + l, size - l, "[%s.%03li] ",
+			    string, tv.tv_usec/1000);
 }
 
 static void
 custom_handler(const char *fmt, va_list arg)
 {
-	weston_log_timestamp();
-	fprintf(weston_logfile, "libwayland: ");
-	vfprintf(weston_logfile, fmt, arg);
+	char buf[LOG_MESSAGE_MAX];
+	char stamp[256];
+
+	weston_log_timestamp(stamp, sizeof stamp);
+	strncat(stamp, "libwayland: ", sizeof stamp - strlen(stamp) - 1);
+	log_emit(buf, log_vformat(buf, sizeof buf, stamp, fmt, arg));
 }
 
 void
@@ -79,13 +355,15 @@ weston_log_file_open(const char *filename)
 
 	if (weston_logfile == NULL)
 		weston_logfile = stderr;
-	else
-		setvbuf(weston_logfile, NULL, _IOLBF, 256);
+
+	log_ring_create();
 }
 
 void
 weston_log_file_close()
 {
+	log_ring_destroy();
+
 	if ((weston_logfile != stderr) && (weston_logfile != NULL))
 		fclose(weston_logfile);
 	weston_logfile = stderr;
@@ -94,10 +372,13 @@ weston_log_file_close()
 WL_EXPORT int
 weston_vlog(const char *fmt, va_list ap)
 {
+	char buf[LOG_MESSAGE_MAX];
+	char stamp[256];
 	int l;
 
-	l = weston_log_timestamp();
-	l += vfprintf(weston_logfile, fmt, ap);
+	weston_log_timestamp(stamp, sizeof stamp);
+	l = log_vformat(buf, sizeof buf, stamp, fmt, ap);
+	log_emit(buf, l);
 
 	return l;
 }
@@ -118,7 +399,13 @@ weston_log(const char *fmt, ...)
 WL_EXPORT int
 weston_vlog_continue(const char *fmt, va_list argp)
 {
-	return vfprintf(weston_logfile, fmt, argp);
+	char buf[LOG_MESSAGE_MAX];
+	int l;
+
+	l = log_vformat(buf, sizeof buf, "", fmt, argp);
+	log_emit(buf, l);
+
+	return l;
 }
 
 WL_EXPORT int
@@ -74,6 +74,7 @@ noop_renderer_init(struct weston_compositor *ec)
 		return -1;
 
 	renderer->read_pixels = noop_renderer_read_pixels;
+	renderer->read_pixels_async = NULL;
 	renderer->repaint_output = noop_renderer_repaint_output;
 	renderer->flush_damage = noop_renderer_flush_damage;
 	renderer->attach = noop_renderer_attach;
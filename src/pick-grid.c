@@ -0,0 +1,311 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "pick-grid.h"
+
+/* Cell size limits, as a power of two */
+#define PICK_GRID_MIN_SHIFT	5
+#define PICK_GRID_MAX_SHIFT	30
+
+/* At most this many cells per axis */
+#define PICK_GRID_MAX_CELLS	32
+
+/* Boxes covering more cells than this are tested for every point */
+#define PICK_GRID_MAX_BOX_CELLS	(PICK_GRID_MAX_CELLS * PICK_GRID_MAX_CELLS / 2)
+
+/* Boxes are grown by this much so that points rounded to the neighbouring
+ * pixel still find the box. */
+#define PICK_GRID_MARGIN	1
+
+void
+pick_grid_init(struct pick_grid *grid)
+{
+	grid->x = 0;
+	grid->y = 0;
+	grid->cell_shift = PICK_GRID_MIN_SHIFT;
+	grid->width = 0;
+	grid->height = 0;
+	grid->cell_start = NULL;
+	grid->entries = NULL;
+	grid->global = NULL;
+	grid->global_count = 0;
+	grid->cells_alloc = 0;
+	grid->entries_alloc = 0;
+	grid->global_alloc = 0;
+}
+
+void
+pick_grid_release(struct pick_grid *grid)
+{
+	free(grid->cell_start);
+	free(grid->entries);
+	free(grid->global);
+	pick_grid_init(grid);
+}
+
+static int
+ensure_alloc(uint32_t **array, uint32_t *alloc, uint32_t count)
+{
+	uint32_t *p;
+
+	if (count <= *alloc)
+		return 0;
+
+	p = realloc(*array, count * sizeof *p);
+	if (!p)
+		return -1;
+
+	*array = p;
+	*alloc = count;
+
+	return 0;
+}
+
+static int
+box_is_always(const struct pick_grid_box *box)
+{
+	return box->x1 == INT32_MIN;
+}
+
+static int
+box_is_empty(const struct pick_grid_box *box)
+{
+	return box->x1 >= box->x2 || box->y1 >= box->y2;
+}
+
+/* Returns the number of cells the box covers and its cell range. */
+static uint32_t
+box_cells(const struct pick_grid *grid, const struct pick_grid_box *box,
+	  int32_t *cx1, int32_t *cy1, int32_t *cx2, int32_t *cy2)
+{
+	int64_t x1 = (int64_t) box->x1 - PICK_GRID_MARGIN - grid->x;
+	int64_t y1 = (int64_t) box->y1 - PICK_GRID_MARGIN - grid->y;
+	int64_t x2 = (int64_t) box->x2 + PICK_GRID_MARGIN - grid->x;
+	int64_t y2 = (int64_t) box->y2 + PICK_GRID_MARGIN - grid->y;
+
+	*cx1 = x1 >> grid->cell_shift;
+	*cy1 = y1 >> grid->cell_shift;
+	*cx2 = (x2 - 1) >> grid->cell_shift;
+	*cy2 = (y2 - 1) >> grid->cell_shift;
+
+	return (*cx2 - *cx1 + 1) * (*cy2 - *cy1 + 1);
+}
+
+static void
+grid_set_extents(struct pick_grid *grid,
+		 const struct pick_grid_box *boxes, uint32_t count)
+{
+	int64_t x1 = INT64_MAX, y1 = INT64_MAX;
+	int64_t x2 = INT64_MIN, y2 = INT64_MIN;
+	int64_t w, h;
+	uint32_t i;
+	int shift;
+
+	for (i = 0; i < count; i++) {
+		if (box_is_always(&boxes[i]) || box_is_empty(&boxes[i]))
+			continue;
+
+		if (boxes[i].x1 < x1)
+			x1 = boxes[i].x1;
+		if (boxes[i].y1 < y1)
+			y1 = boxes[i].y1;
+		if (boxes[i].x2 > x2)
+			x2 = boxes[i].x2;
+		if (boxes[i].y2 > y2)
+			y2 = boxes[i].y2;
+	}
+
+	if (x1 > x2) {
+		grid->x = 0;
+		grid->y = 0;
+		grid->cell_shift = PICK_GRID_MIN_SHIFT;
+		grid->width = 0;
+		grid->height = 0;
+		return;
+	}
+
+	x1 -= PICK_GRID_MARGIN;
+	y1 -= PICK_GRID_MARGIN;
+	w = x2 + PICK_GRID_MARGIN - x1;
+	h = y2 + PICK_GRID_MARGIN - y1;
+
+	shift = PICK_GRID_MIN_SHIFT;
+	while (shift < PICK_GRID_MAX_SHIFT &&
+	       (((w - 1) >> shift) >= PICK_GRID_MAX_CELLS ||
+		((h - 1) >> shift) >= PICK_GRID_MAX_CELLS))
+		shift++;
+
+	grid->x = x1;
+	grid->y = y1;
+	grid->cell_shift = shift;
+	grid->width = ((w - 1) >> shift) + 1;
+	grid->height = ((h - 1) >> shift) + 1;
+	if (grid->width > PICK_GRID_MAX_CELLS)
+		grid->width = PICK_GRID_MAX_CELLS;
+	if (grid->height > PICK_GRID_MAX_CELLS)
+		grid->height = PICK_GRID_MAX_CELLS;
+}
+
+static int
+box_is_global(const struct pick_grid *grid, const struct pick_grid_box *box)
+{
+	int32_t cx1, cy1, cx2, cy2;
+
+	if (box_is_always(box))
+		return 1;
+
+	return box_cells(grid, box, &cx1, &cy1, &cx2, &cy2) >
+		PICK_GRID_MAX_BOX_CELLS;
+}
+
+/* Build the grid from scratch.  Returns -1 on allocation failure, in which
+ * case the grid is left empty and every box has to be tested by the
+ * caller. */
+int
+pick_grid_build(struct pick_grid *grid,
+		const struct pick_grid_box *boxes, uint32_t count)
+{
+	int32_t cx1, cy1, cx2, cy2, cx, cy;
+	uint32_t i, ncells, nentries, nglobal, c, start, next;
+
+	grid_set_extents(grid, boxes, count);
+	ncells = grid->width * grid->height;
+
+	if (ensure_alloc(&grid->cell_start, &grid->cells_alloc,
+			 ncells + 1) < 0)
+		goto err;
+
+	for (c = 0; c <= ncells; c++)
+		grid->cell_start[c] = 0;
+
+	/* Count the entries of every cell. */
+	nglobal = 0;
+	for (i = 0; i < count; i++) {
+		if (box_is_global(grid, &boxes[i])) {
+			nglobal++;
+			continue;
+		}
+
+		if (box_is_empty(&boxes[i]))
+			continue;
+
+		box_cells(grid, &boxes[i], &cx1, &cy1, &cx2, &cy2);
+		for (cy = cy1; cy <= cy2; cy++)
+			for (cx = cx1; cx <= cx2; cx++)
+				grid->cell_start[cy * grid->width + cx]++;
+	}
+
+	/* Turn the counts into start offsets. */
+	nentries = 0;
+	for (c = 0; c < ncells; c++) {
+		start = nentries;
+		nentries += grid->cell_start[c];
+		grid->cell_start[c] = start;
+	}
+	grid->cell_start[ncells] = nentries;
+
+	if (ensure_alloc(&grid->entries, &grid->entries_alloc,
+			 nentries) < 0 ||
+	    ensure_alloc(&grid->global, &grid->global_alloc, nglobal) < 0)
+		goto err;
+
+	/* Fill the cells in box order, which keeps every cell sorted.
+	 * This advances cell_start[c] to the start of cell c + 1. */
+	grid->global_count = 0;
+	for (i = 0; i < count; i++) {
+		if (box_is_global(grid, &boxes[i])) {
+			grid->global[grid->global_count++] = i;
+			continue;
+		}
+
+		if (box_is_empty(&boxes[i]))
+			continue;
+
+		box_cells(grid, &boxes[i], &cx1, &cy1, &cx2, &cy2);
+		for (cy = cy1; cy <= cy2; cy++) {
+			for (cx = cx1; cx <= cx2; cx++) {
+				c = cy * grid->width + cx;
+				grid->entries[grid->cell_start[c]++] = i;
+			}
+		}
+	}
+
+	/* Shift the offsets back. */
+	start = 0;
+	for (c = 0; c < ncells; c++) {
+		next = grid->cell_start[c];
+		grid->cell_start[c] = start;
+		start = next;
+	}
+
+	return 0;
+
+err:
+	grid->width = 0;
+	grid->height = 0;
+	grid->global_count = 0;
+
+	return -1;
+}
+
+void
+pick_grid_query(const struct pick_grid *grid, int32_t x, int32_t y,
+		struct pick_grid_iter *iter)
+{
+	int64_t cx = ((int64_t) x - grid->x) >> grid->cell_shift;
+	int64_t cy = ((int64_t) y - grid->y) >> grid->cell_shift;
+	uint32_t c;
+
+	iter->global = grid->global;
+	iter->global_end = grid->global + grid->global_count;
+
+	if (cx < 0 || cx >= grid->width || cy < 0 || cy >= grid->height) {
+		iter->cell = NULL;
+		iter->cell_end = NULL;
+		return;
+	}
+
+	c = cy * grid->width + cx;
+	iter->cell = grid->entries + grid->cell_start[c];
+	iter->cell_end = grid->entries + grid->cell_start[c + 1];
+}
+
+/* Returns the next candidate in ascending index order, merging the cell
+ * with the boxes that are tested everywhere. */
+int
+pick_grid_iter_next(struct pick_grid_iter *iter, uint32_t *index)
+{
+	int have_cell = iter->cell != iter->cell_end;
+	int have_global = iter->global != iter->global_end;
+
+	if (have_cell && (!have_global || *iter->cell < *iter->global))
+		*index = *iter->cell++;
+	else if (have_global)
+		*index = *iter->global++;
+	else
+		return 0;
+
+	return 1;
+}
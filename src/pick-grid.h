@@ -0,0 +1,83 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef _WESTON_PICK_GRID_H
+#define _WESTON_PICK_GRID_H
+
+#include <stdint.h>
+
+/*
+ * A uniform grid over the global coordinate space used to find the views
+ * that may contain a point without walking the whole view list.
+ *
+ * Boxes are identified by their index in the array passed to
+ * pick_grid_build(), which is expected to be in stacking order.  A query
+ * returns the candidate indices for a point in ascending order, so the
+ * caller can stop at the first one that really contains the point.
+ * Boxes covering a large part of the grid are not stored per cell but
+ * returned for every query; use PICK_GRID_BOX_ALWAYS for boxes that must
+ * always be tested.
+ */
+
+struct pick_grid_box {
+	int32_t x1, y1, x2, y2;
+};
+
+#define PICK_GRID_BOX_ALWAYS { INT32_MIN, INT32_MIN, INT32_MAX, INT32_MAX }
+
+struct pick_grid {
+	int32_t x, y;			/* origin of cell (0, 0) */
+	int cell_shift;			/* cell size is 1 << cell_shift */
+	int32_t width, height;		/* in cells */
+
+	uint32_t *cell_start;		/* width * height + 1 offsets */
+	uint32_t *entries;
+	uint32_t *global;
+	uint32_t global_count;
+
+	uint32_t cells_alloc;
+	uint32_t entries_alloc;
+	uint32_t global_alloc;
+};
+
+struct pick_grid_iter {
+	const uint32_t *cell, *cell_end;
+	const uint32_t *global, *global_end;
+};
+
+void
+pick_grid_init(struct pick_grid *grid);
+
+void
+pick_grid_release(struct pick_grid *grid);
+
+int
+pick_grid_build(struct pick_grid *grid,
+		const struct pick_grid_box *boxes, uint32_t count);
+
+void
+pick_grid_query(const struct pick_grid *grid, int32_t x, int32_t y,
+		struct pick_grid_iter *iter);
+
+int
+pick_grid_iter_next(struct pick_grid_iter *iter, uint32_t *index);
+
+#endif
@@ -25,23 +25,147 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
 
 #include "pixman-renderer.h"
+#include "band-pool.h"
+#include "vertex-clipping.h"
+#include "shm-convert.h"
 
 #include <linux/input.h>
 
+/* pixman walks the clip rectangles of each composite itself, which is
+ * cheap, so only badly fragmented damage is worth coarsening. */
+#define PIXMAN_RENDERER_MAX_DAMAGE_RECTS 32
+
+/* Repaints smaller than this many pixels are not worth waking the band
+ * workers for; bigger ones are cut into a few bands per thread, so that
+ * a thread that finishes early can pick up more work. */
+#define PIXMAN_RENDERER_MIN_THREADED_AREA	(256 * 256)
+#define PIXMAN_RENDERER_BANDS_PER_THREAD	2
+#define PIXMAN_RENDERER_MIN_BAND_HEIGHT		32
+
+/* How many frames back the damage is remembered, which is the oldest
+ * buffer the backend can hand back without a full repaint. */
+#define PIXMAN_RENDERER_BUFFER_HISTORY	4
+
+/* A view in the stack of an output, as far as the layer cache can tell
+ * whether it changed. */
+struct pixman_layer_view {
+	struct weston_view *view;
+	uint32_t generation;		/* of the view geometry */
+	uint32_t content_serial;	/* of the surface contents */
+	float alpha;
+	uint32_t stable_frames;
+};
+
 struct pixman_output_state {
+	int32_t width, height;
+
+	/* Only used when the hardware buffer cannot be painted directly,
+	 * and allocated on first use. */
 	void *shadow_buffer;
 	pixman_image_t *shadow_image;
+	int shadow_valid;
+
 	pixman_image_t *hw_buffer;
+
+	/* With 'pixman-layer-cache', the views at the bottom of the stack
+	 * that have not changed for a while are composited once into
+	 * layer_image, which then replaces them in every repaint until one
+	 * changes.  'stack' is the stack of the last frame, layer_views the
+	 * views in layer_image and layer_count the number of views the
+	 * current repaint takes from it. */
+	struct wl_array stack;
+	struct wl_array layer_views;
+	uint32_t layer_output_generation;
+	pixman_image_t *layer_image;
+	int layer_count;
+
+	/* When a pointer sprite is the topmost view, cursor_under holds
+	 * the pixels below it in cursor_box, as painted into cursor_target
+	 * in the last frame, which had cursor_stack_count views. */
+	pixman_image_t *cursor_under;
+	pixman_box32_t cursor_box;
+	pixman_image_t *cursor_target;
+	int cursor_stack_count;
+	uint32_t cursor_output_generation;
+	int cursor_saved;
+
+	/* The output damage of the last frames, newest first, and the
+	 * frame in which each recently seen buffer was painted. */
+	pixman_region32_t damage_history[PIXMAN_RENDERER_BUFFER_HISTORY];
+	struct {
+		pixman_image_t *image;
+		uint32_t frame;
+	} buffers[PIXMAN_RENDERER_BUFFER_HISTORY];
+	uint32_t frame;
+};
+
+#define PIXMAN_RENDERER_TRANSFORM_CACHE_SIZE 4
+
+/* Frames a view must stay unchanged before it goes into the layer cache */
+#define PIXMAN_RENDERER_LAYER_STABLE_FRAMES 3
+
+/* The source transform and filter of a view on an output, valid as long
+ * as the view, output and buffer viewport generations match. */
+struct pixman_transform_cache {
+	struct weston_view *view;
+	struct weston_output *output;
+	uint32_t view_generation;
+	uint32_t output_generation;
+	uint32_t viewport_generation;
+
+	pixman_transform_t transform;
+	pixman_filter_t filter;
+};
+
+#define PIXMAN_RENDERER_IMAGE_CACHE_SIZE 3
+
+/* An image on the pixels of a shm buffer the surface had attached, kept
+ * with its transform state for when the client attaches the buffer
+ * again, until the buffer is destroyed. */
+struct pixman_buffer_image {
+	struct pixman_surface_state *ps;
+	struct weston_buffer *buffer;	/* NULL for an unused entry */
+	void *data;
+	int32_t stride, width, height;
+	uint32_t format;
+
+	pixman_image_t *image;
+	struct pixman_transform_cache *transform;	/* set on 'image' */
+	struct wl_listener buffer_destroy_listener;
 };
 
 struct pixman_surface_state {
 	struct weston_surface *surface;
 
 	pixman_image_t *image;
+	pixman_color_t color;		/* for solid color surfaces */
 	struct weston_buffer_reference buffer_ref;
 
+	/* Transforms of the views of the surface, replaced round robin,
+	 * and the one currently set on 'image'. */
+	struct pixman_transform_cache transforms[PIXMAN_RENDERER_TRANSFORM_CACHE_SIZE];
+	int transforms_next;
+	struct pixman_transform_cache *image_transform;
+
+	/* Changes whenever the surface shows something new */
+	uint32_t content_serial;
+
+	/* Images of the recently attached buffers, replaced round robin,
+	 * and the one 'image' refers to. */
+	struct pixman_buffer_image buffer_images[PIXMAN_RENDERER_IMAGE_CACHE_SIZE];
+	int buffer_images_next;
+	struct pixman_buffer_image *buffer_image;
+
+	/* RGB copy of buffers in formats pixman cannot sample, converted
+	 * as they get damaged.  convert_full asks for all of it. */
+	pixman_image_t *convert_image;
+	int convert_full;
+
 	struct wl_listener buffer_destroy_listener;
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
@@ -51,12 +175,31 @@ struct pixman_renderer {
 	struct weston_renderer base;
 
 	int repaint_debug;
+	int force_shadow;
+	int layer_cache;
 	pixman_image_t *debug_color;
 	struct weston_binding *debug_binding;
 
+	struct band_pool *band_pool;
+
 	struct wl_signal destroy_signal;
 };
 
+/* Where repaint_region() paints.  The single threaded path paints into
+ * the shadow image or the hardware buffer itself, with the surfaces' own
+ * images as sources.  Each band of a threaded repaint uses its own images
+ * on the same pixels instead, because the clip region and the source
+ * transform are image state. */
+struct pixman_paint_target {
+	pixman_image_t *image;
+	pixman_image_t *debug_color;
+	int private_sources;
+};
+
+static const pixman_color_t debug_red = {
+	0x3fff, 0x0000, 0x0000, 0x3fff
+};
+
 static inline struct pixman_output_state *
 get_output_state(struct weston_output *output)
 {
@@ -127,6 +270,104 @@ pixman_renderer_read_pixels(struct weston_output *output,
 	return 0;
 }
 
+/* The output zoom as a magnification 'scale' followed by a translation
+ * by 'x', 'y', both in output buffer pixels; the same mapping that
+ * weston_output_update_matrix() applies to the GL clip space.  Returns 0
+ * when zoom is off. */
+static int
+output_get_zoom(struct weston_output *output,
+		double *scale, double *x, double *y)
+{
+	int32_t width = output->current_mode->width;
+	int32_t height = output->current_mode->height;
+
+	if (!output->zoom.active)
+		return 0;
+
+	*scale = 1.0 / (1.0 - output->zoom.spring_z.current);
+	*x = width / 2.0 * (1.0 - *scale * (1.0 + output->zoom.trans_x));
+	*y = height / 2.0 * (1.0 - *scale * (1.0 + output->zoom.trans_y));
+
+	return 1;
+}
+
+/* Scale and translate each box of 'region' by the output zoom.  An edge
+ * goes to the first pixel whose center it lies left of or above, so
+ * boxes sharing an edge still share it afterwards. */
+static void
+region_zoom(struct weston_output *output, pixman_region32_t *region)
+{
+	pixman_box32_t *rects, *zoomed;
+	double scale, x, y;
+	int i, n;
+
+	if (!output_get_zoom(output, &scale, &x, &y))
+		return;
+
+	rects = pixman_region32_rectangles(region, &n);
+	zoomed = malloc(n * sizeof *zoomed);
+	if (!zoomed)
+		return;
+
+	for (i = 0; i < n; i++) {
+		zoomed[i].x1 = ceil(rects[i].x1 * scale + x - 0.5);
+		zoomed[i].y1 = ceil(rects[i].y1 * scale + y - 0.5);
+		zoomed[i].x2 = ceil(rects[i].x2 * scale + x - 0.5);
+		zoomed[i].y2 = ceil(rects[i].y2 * scale + y - 0.5);
+	}
+
+	pixman_region32_fini(region);
+	pixman_region32_init_rects(region, zoomed, n);
+	pixman_region32_intersect_rect(region, region, 0, 0,
+				       output->current_mode->width,
+				       output->current_mode->height);
+	free(zoomed);
+}
+
+/* The part of the global space that is visible on a zoomed output. */
+static void
+zoom_visible_region(struct weston_output *output, pixman_region32_t *region)
+{
+	int32_t scale = output->current_scale;
+	int32_t width = output->current_mode->width / scale;
+	int32_t height = output->current_mode->height / scale;
+	enum wl_output_transform inverse = output->transform;
+	double zoom, zx, zy;
+	float x1, y1, x2, y2, t;
+
+	output_get_zoom(output, &zoom, &zx, &zy);
+
+	/* The output buffer area that ends up on screen, in the output's
+	 * logical pixels... */
+	x1 = -zx / zoom / scale;
+	y1 = -zy / zoom / scale;
+	x2 = (output->current_mode->width - zx) / zoom / scale;
+	y2 = (output->current_mode->height - zy) / zoom / scale;
+
+	/* ...and back to global coordinates through the inverse of the
+	 * output transform. */
+	if (inverse == WL_OUTPUT_TRANSFORM_90)
+		inverse = WL_OUTPUT_TRANSFORM_270;
+	else if (inverse == WL_OUTPUT_TRANSFORM_270)
+		inverse = WL_OUTPUT_TRANSFORM_90;
+
+	weston_transformed_coord(width, height, inverse, 1, x1, y1, &x1, &y1);
+	weston_transformed_coord(width, height, inverse, 1, x2, y2, &x2, &y2);
+
+	if (x1 > x2) {
+		t = x1; x1 = x2; x2 = t;
+	}
+	if (y1 > y2) {
+		t = y1; y1 = y2; y2 = t;
+	}
+
+	pixman_region32_init_rect(region,
+				  output->x + (int) floorf(x1),
+				  output->y + (int) floorf(y1),
+				  (int) ceilf(x2) - (int) floorf(x1),
+				  (int) ceilf(y2) - (int) floorf(y1));
+}
+
 static void
 region_global_to_output(struct weston_output *output, pixman_region32_t *region)
 {
@@ -134,59 +375,48 @@ region_global_to_output(struct weston_output *output, pixman_region32_t *region)
 	weston_transformed_region(output->width, output->height,
 				  output->transform, output->current_scale,
 				  region, region);
+	region_zoom(output, region);
+}
+
+/* A new image sharing the pixels of 'image', or for solid fills one of
+ * the same 'color'. */
+static pixman_image_t *
+image_alias(pixman_image_t *image, const pixman_color_t *color)
+{
+	if (!pixman_image_get_data(image))
+		return pixman_image_create_solid_fill(color);
+
+	return pixman_image_create_bits(pixman_image_get_format(image),
+					pixman_image_get_width(image),
+					pixman_image_get_height(image),
+					pixman_image_get_data(image),
+					pixman_image_get_stride(image));
 }
 
 #define D2F(v) pixman_double_to_fixed((double)v)
 
+/* Set up the source transformation based on the surface position, the
+ * output position/transform/scale/zoom and the client specified buffer
+ * transform/scale.  The result maps output buffer pixels to surface
+ * buffer pixels. */
 static void
-repaint_region(struct weston_view *ev, struct weston_output *output,
-	       pixman_region32_t *region, pixman_region32_t *surf_region,
-	       pixman_op_t pixman_op)
+view_compute_transform(struct weston_view *ev, struct weston_output *output,
+		       pixman_transform_t *transform)
 {
-	struct pixman_renderer *pr =
-		(struct pixman_renderer *) output->compositor->renderer;
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
-	struct pixman_output_state *po = get_output_state(output);
-	pixman_region32_t final_region;
-	float view_x, view_y;
-	pixman_transform_t transform;
 	pixman_fixed_t fw, fh;
-
-	/* The final region to be painted is the intersection of
-	 * 'region' and 'surf_region'. However, 'region' is in the global
-	 * coordinates, and 'surf_region' is in the surface-local
-	 * coordinates
-	 */
-	pixman_region32_init(&final_region);
-	if (surf_region) {
-		pixman_region32_copy(&final_region, surf_region);
-
-		/* Convert from surface to global coordinates */
-		if (!ev->transform.enabled) {
-			pixman_region32_translate(&final_region, ev->geometry.x, ev->geometry.y);
-		} else {
-			weston_view_to_global_float(ev, 0, 0, &view_x, &view_y);
-			pixman_region32_translate(&final_region, (int)view_x, (int)view_y);
-		}
-
-		/* We need to paint the intersection */
-		pixman_region32_intersect(&final_region, &final_region, region);
-	} else {
-		/* If there is no surface region, just use the global region */
-		pixman_region32_copy(&final_region, region);
+	double zoom, zoom_x, zoom_y;
+
+	pixman_transform_init_identity(transform);
+	if (output_get_zoom(output, &zoom, &zoom_x, &zoom_y)) {
+		pixman_transform_translate(transform, NULL,
+					   pixman_double_to_fixed(-zoom_x),
+					   pixman_double_to_fixed(-zoom_y));
+		pixman_transform_scale(transform, NULL,
+				       pixman_double_to_fixed(1.0 / zoom),
+				       pixman_double_to_fixed(1.0 / zoom));
 	}
-
-	/* Convert from global to output coord */
-	region_global_to_output(output, &final_region);
-
-	/* And clip to it */
-	pixman_image_set_clip_region32 (po->shadow_image, &final_region);
-
-	/* Set up the source transformation based on the surface
-	   position, the output position/transform/scale and the client
-	   specified buffer transform/scale */
-	pixman_transform_init_identity(&transform);
-	pixman_transform_scale(&transform, NULL,
+	pixman_transform_scale(transform, NULL,
 			       pixman_double_to_fixed ((double)1.0/output->current_scale),
 			       pixman_double_to_fixed ((double)1.0/output->current_scale));
 
@@ -199,18 +429,18 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 		break;
 	case WL_OUTPUT_TRANSFORM_90:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-		pixman_transform_rotate(&transform, NULL, 0, -pixman_fixed_1);
-		pixman_transform_translate(&transform, NULL, 0, fh);
+		pixman_transform_rotate(transform, NULL, 0, -pixman_fixed_1);
+		pixman_transform_translate(transform, NULL, 0, fh);
 		break;
 	case WL_OUTPUT_TRANSFORM_180:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-		pixman_transform_rotate(&transform, NULL, -pixman_fixed_1, 0);
-		pixman_transform_translate(&transform, NULL, fw, fh);
+		pixman_transform_rotate(transform, NULL, -pixman_fixed_1, 0);
+		pixman_transform_translate(transform, NULL, fw, fh);
 		break;
 	case WL_OUTPUT_TRANSFORM_270:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-		pixman_transform_rotate(&transform, NULL, 0, pixman_fixed_1);
-		pixman_transform_translate(&transform, NULL, fw, 0);
+		pixman_transform_rotate(transform, NULL, 0, pixman_fixed_1);
+		pixman_transform_translate(transform, NULL, fw, 0);
 		break;
 	}
 
@@ -219,14 +449,14 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-		pixman_transform_scale(&transform, NULL,
+		pixman_transform_scale(transform, NULL,
 				       pixman_int_to_fixed (-1),
 				       pixman_int_to_fixed (1));
-		pixman_transform_translate(&transform, NULL, fw, 0);
+		pixman_transform_translate(transform, NULL, fw, 0);
 		break;
 	}
 
-        pixman_transform_translate(&transform, NULL,
+	pixman_transform_translate(transform, NULL,
 				   pixman_double_to_fixed (output->x),
 				   pixman_double_to_fixed (output->y));
 
@@ -250,9 +480,9 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 			}};
 
 		pixman_transform_invert(&surface_transform, &surface_transform);
-		pixman_transform_multiply (&transform, &surface_transform, &transform);
+		pixman_transform_multiply (transform, &surface_transform, transform);
 	} else {
-		pixman_transform_translate(&transform, NULL,
+		pixman_transform_translate(transform, NULL,
 					   pixman_double_to_fixed ((double)-ev->geometry.x),
 					   pixman_double_to_fixed ((double)-ev->geometry.y));
 	}
@@ -269,14 +499,14 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 		ratio_x = viewport_width / ev->surface->buffer_viewport.dst_width;
 		ratio_y = viewport_height / ev->surface->buffer_viewport.dst_height;
 
-		pixman_transform_scale(&transform, NULL,
+		pixman_transform_scale(transform, NULL,
 				       pixman_double_to_fixed(ratio_x),
 				       pixman_double_to_fixed(ratio_y));
-		pixman_transform_translate(&transform, NULL, pixman_double_to_fixed(viewport_x),
+		pixman_transform_translate(transform, NULL, pixman_double_to_fixed(viewport_x),
 							     pixman_double_to_fixed(viewport_y));
 	}
 
-	pixman_transform_scale(&transform, NULL,
+	pixman_transform_scale(transform, NULL,
 			       pixman_double_to_fixed(ev->surface->buffer_viewport.scale),
 			       pixman_double_to_fixed(ev->surface->buffer_viewport.scale));
 
@@ -288,10 +518,10 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-		pixman_transform_scale(&transform, NULL,
+		pixman_transform_scale(transform, NULL,
 				       pixman_int_to_fixed (-1),
 				       pixman_int_to_fixed (1));
-		pixman_transform_translate(&transform, NULL, fw, 0);
+		pixman_transform_translate(transform, NULL, fw, 0);
 		break;
 	}
 
@@ -302,146 +532,1181 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 		break;
 	case WL_OUTPUT_TRANSFORM_90:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-		pixman_transform_rotate(&transform, NULL, 0, pixman_fixed_1);
-		pixman_transform_translate(&transform, NULL, fh, 0);
+		pixman_transform_rotate(transform, NULL, 0, pixman_fixed_1);
+		pixman_transform_translate(transform, NULL, fh, 0);
 		break;
 	case WL_OUTPUT_TRANSFORM_180:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-		pixman_transform_rotate(&transform, NULL, -pixman_fixed_1, 0);
-		pixman_transform_translate(&transform, NULL, fw, fh);
+		pixman_transform_rotate(transform, NULL, -pixman_fixed_1, 0);
+		pixman_transform_translate(transform, NULL, fw, fh);
 		break;
 	case WL_OUTPUT_TRANSFORM_270:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-		pixman_transform_rotate(&transform, NULL, 0, -pixman_fixed_1);
-		pixman_transform_translate(&transform, NULL, 0, fw);
+		pixman_transform_rotate(transform, NULL, 0, -pixman_fixed_1);
+		pixman_transform_translate(transform, NULL, 0, fw);
 		break;
 	}
+}
+
+/* Note that 'entry' is being replaced, so no image has it set anymore. */
+static void
+surface_state_forget_transform(struct pixman_surface_state *ps,
+			       struct pixman_transform_cache *entry)
+{
+	int i;
+
+	if (ps->image_transform == entry)
+		ps->image_transform = NULL;
+
+	for (i = 0; i < PIXMAN_RENDERER_IMAGE_CACHE_SIZE; i++)
+		if (ps->buffer_images[i].transform == entry)
+			ps->buffer_images[i].transform = NULL;
+}
+
+/* The cached source transform of the view on the output, computed anew
+ * if it is missing or stale.  The result is stored in the cache, unless
+ * 'scratch' is given, which keeps the cache untouched for the band
+ * threads. */
+static struct pixman_transform_cache *
+view_get_transform(struct weston_view *ev, struct weston_output *output,
+		   struct pixman_transform_cache *scratch)
+{
+	struct pixman_surface_state *ps = get_surface_state(ev->surface);
+	struct pixman_transform_cache *entry;
+	int i;
+
+	for (i = 0; i < PIXMAN_RENDERER_TRANSFORM_CACHE_SIZE; i++) {
+		entry = &ps->transforms[i];
+		if (entry->view == ev && entry->output == output &&
+		    entry->view_generation == ev->transform.generation &&
+		    entry->output_generation == output->geometry_generation &&
+		    entry->viewport_generation ==
+		    ev->surface->buffer_viewport_generation)
+			return entry;
+	}
+
+	if (scratch) {
+		entry = scratch;
+	} else {
+		entry = &ps->transforms[ps->transforms_next];
+		ps->transforms_next = (ps->transforms_next + 1) %
+			PIXMAN_RENDERER_TRANSFORM_CACHE_SIZE;
+		surface_state_forget_transform(ps, entry);
+	}
+
+	entry->view = ev;
+	entry->output = output;
+	entry->view_generation = ev->transform.generation;
+	entry->output_generation = output->geometry_generation;
+	entry->viewport_generation = ev->surface->buffer_viewport_generation;
+
+	view_compute_transform(ev, output, &entry->transform);
+
+	if (ev->transform.enabled || output->zoom.active ||
+	    output->current_scale != ev->surface->buffer_viewport.scale)
+		entry->filter = PIXMAN_FILTER_BILINEAR;
+	else
+		entry->filter = PIXMAN_FILTER_NEAREST;
+
+	return entry;
+}
+
+/* Forget the transforms when the surface image changes, as they depend
+ * on its size. */
+static void
+surface_state_reset_transforms(struct pixman_surface_state *ps)
+{
+	int i;
+
+	memset(ps->transforms, 0, sizeof ps->transforms);
+	ps->image_transform = NULL;
+
+	for (i = 0; i < PIXMAN_RENDERER_IMAGE_CACHE_SIZE; i++)
+		ps->buffer_images[i].transform = NULL;
+}
+
+/* Fill the solid color view into 'region', which must lie within the
+ * target, directly with its color premultiplied by the view alpha.  An
+ * opaque result is the same for OVER and SRC, and SRC is a plain fill. */
+static void
+fill_solid_view(struct weston_view *ev, struct pixman_paint_target *target,
+		pixman_region32_t *region, pixman_op_t pixman_op)
+{
+	struct pixman_surface_state *ps = get_surface_state(ev->surface);
+	pixman_box32_t *boxes;
+	pixman_color_t color;
+	int n;
+
+	color.red = ps->color.red * ev->alpha;
+	color.green = ps->color.green * ev->alpha;
+	color.blue = ps->color.blue * ev->alpha;
+	color.alpha = ps->color.alpha * ev->alpha;
+
+	if (color.alpha == 0xffff)
+		pixman_op = PIXMAN_OP_SRC;
+	else if (color.alpha == 0 && pixman_op == PIXMAN_OP_OVER)
+		return;
+
+	boxes = pixman_region32_rectangles(region, &n);
+	pixman_image_fill_boxes(pixman_op, target->image, &color, n, boxes);
+}
+
+/* An a8 mask of the coverage of 'tris' over 'box', in output buffer
+ * coordinates, scaled by 'alpha' if that is not NULL. */
+static pixman_image_t *
+create_coverage_mask(pixman_box32_t *box, pixman_triangle_t *tris, int n_tris,
+		     pixman_image_t *alpha)
+{
+	pixman_image_t *mask;
+	int width = box->x2 - box->x1;
+	int height = box->y2 - box->y1;
+
+	mask = pixman_image_create_bits(PIXMAN_a8, width, height, NULL, 0);
+	if (!mask)
+		return NULL;
+
+	pixman_add_triangles(mask, -box->x1, -box->y1, n_tris, tris);
+
+	if (alpha)
+		pixman_image_composite32(PIXMAN_OP_IN,
+					 alpha, NULL, mask,
+					 0, 0, 0, 0, 0, 0, width, height);
+
+	return mask;
+}
+
+/* Composite the view's buffer through 'mask' into 'box', in output
+ * buffer coordinates. */
+static void
+composite_source(struct weston_view *ev, struct weston_output *output,
+		 struct pixman_paint_target *target, pixman_op_t pixman_op,
+		 pixman_image_t *mask, pixman_box32_t *box)
+{
+	struct pixman_surface_state *ps = get_surface_state(ev->surface);
+	struct pixman_transform_cache scratch, *xform;
+	pixman_image_t *src;
+
+	if (target->private_sources) {
+		xform = view_get_transform(ev, output, &scratch);
+		src = image_alias(ps->image, &ps->color);
+		pixman_image_set_transform(src, &xform->transform);
+		pixman_image_set_filter(src, xform->filter, NULL, 0);
+	} else {
+		xform = view_get_transform(ev, output, NULL);
+		src = ps->image;
+		if (ps->image_transform != xform) {
+			pixman_image_set_transform(src, &xform->transform);
+			pixman_image_set_filter(src, xform->filter, NULL, 0);
+			ps->image_transform = xform;
+		}
+	}
+
+	if (ps->buffer_ref.buffer)
+		wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
+
+	pixman_image_composite32(pixman_op,
+				 src, /* src */
+				 mask, /* mask */
+				 target->image, /* dest */
+				 box->x1, box->y1, /* src_x, src_y */
+				 0, 0, /* mask_x, mask_y */
+				 box->x1, box->y1, /* dest_x, dest_y */
+				 box->x2 - box->x1, /* width */
+				 box->y2 - box->y1 /* height */);
+
+	if (ps->buffer_ref.buffer)
+		wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
+
+	if (target->private_sources)
+		pixman_image_unref(src);
+}
+
+/* Paint the view into 'region', in output buffer coordinates.  If
+ * 'tris' is given, only their coverage is painted.  A view alpha below
+ * 1.0 is applied through a solid mask, or folded into the coverage. */
+static void
+composite_view(struct weston_view *ev, struct weston_output *output,
+	       struct pixman_paint_target *target, pixman_region32_t *region,
+	       pixman_op_t pixman_op, pixman_triangle_t *tris, int n_tris)
+{
+	struct pixman_surface_state *ps = get_surface_state(ev->surface);
+	pixman_image_t *alpha = NULL, *mask = NULL;
+	pixman_color_t alpha_color = { 0, 0, 0, 0 };
+	pixman_region32_t final_region;
+	pixman_box32_t box;
+	int solid = !tris && !pixman_image_get_data(ps->image);
+
+	/* Keep the boxes within the target for the fills and masks */
+	pixman_region32_init_rect(&final_region, 0, 0,
+				  pixman_image_get_width(target->image),
+				  pixman_image_get_height(target->image));
+	pixman_region32_intersect(&final_region, &final_region, region);
+	if (!pixman_region32_not_empty(&final_region)) {
+		pixman_region32_fini(&final_region);
+		return;
+	}
+	box = *pixman_region32_extents(&final_region);
+
+	if (ev->alpha < 1.0 && !solid) {
+		alpha_color.alpha = ev->alpha * 0xffff;
+		alpha = pixman_image_create_solid_fill(&alpha_color);
+	}
+
+	if (tris)
+		mask = create_coverage_mask(&box, tris, n_tris, alpha);
+	else if (alpha)
+		mask = pixman_image_ref(alpha);
+
+	pixman_image_set_clip_region32 (target->image, &final_region);
+
+	if (solid)
+		fill_solid_view(ev, target, &final_region, pixman_op);
+	else if (mask || !tris)
+		composite_source(ev, output, target, pixman_op, mask, &box);
+
+	if (target->debug_color && (mask || !tris))
+		pixman_image_composite32(PIXMAN_OP_OVER,
+					 target->debug_color, /* src */
+					 tris ? mask : NULL, /* mask */
+					 target->image, /* dest */
+					 0, 0, /* src_x, src_y */
+					 0, 0, /* mask_x, mask_y */
+					 box.x1, box.y1, /* dest_x, dest_y */
+					 box.x2 - box.x1, /* width */
+					 box.y2 - box.y1 /* height */);
+
+	pixman_image_set_clip_region32 (target->image, NULL);
+
+	if (mask)
+		pixman_image_unref(mask);
+	if (alpha)
+		pixman_image_unref(alpha);
+	pixman_region32_fini(&final_region);
+}
+
+/* Convert a region from surface to global coordinates for a view that
+ * is at most translated and scaled.  Box edges are rounded to the
+ * nearest pixel boundary, as in region_zoom(). */
+static void
+region_surface_to_global(struct weston_view *ev, pixman_region32_t *region)
+{
+	pixman_box32_t *rects, *boxes;
+	float x1, y1, x2, y2, t;
+	int i, n;
+
+	if (!ev->transform.enabled) {
+		pixman_region32_translate(region, ev->geometry.x, ev->geometry.y);
+		return;
+	}
+
+	if (!(ev->transform.matrix.type & WESTON_MATRIX_TRANSFORM_SCALE)) {
+		weston_view_to_global_float(ev, 0, 0, &x1, &y1);
+		pixman_region32_translate(region, (int)x1, (int)y1);
+		return;
+	}
+
+	rects = pixman_region32_rectangles(region, &n);
+	boxes = malloc(n * sizeof *boxes);
+	if (!boxes)
+		return;
+
+	for (i = 0; i < n; i++) {
+		weston_view_to_global_float(ev, rects[i].x1, rects[i].y1,
+					    &x1, &y1);
+		weston_view_to_global_float(ev, rects[i].x2, rects[i].y2,
+					    &x2, &y2);
+		if (x1 > x2) {
+			t = x1; x1 = x2; x2 = t;
+		}
+		if (y1 > y2) {
+			t = y1; y1 = y2; y2 = t;
+		}
+
+		boxes[i].x1 = ceilf(x1 - 0.5f);
+		boxes[i].y1 = ceilf(y1 - 0.5f);
+		boxes[i].x2 = ceilf(x2 - 0.5f);
+		boxes[i].y2 = ceilf(y2 - 0.5f);
+	}
+
+	pixman_region32_fini(region);
+	pixman_region32_init_rects(region, boxes, n);
+	free(boxes);
+}
+
+static void
+repaint_region(struct weston_view *ev, struct weston_output *output,
+	       struct pixman_paint_target *target,
+	       pixman_region32_t *region, pixman_region32_t *surf_region,
+	       pixman_op_t pixman_op)
+{
+	pixman_region32_t final_region;
+
+	/* The final region to be painted is the intersection of
+	 * 'region' and 'surf_region'. However, 'region' is in the global
+	 * coordinates, and 'surf_region' is in the surface-local
+	 * coordinates
+	 */
+	pixman_region32_init(&final_region);
+	if (surf_region) {
+		pixman_region32_copy(&final_region, surf_region);
+
+		/* Convert from surface to global coordinates */
+		region_surface_to_global(ev, &final_region);
+
+		/* We need to paint the intersection */
+		pixman_region32_intersect(&final_region, &final_region, region);
+	} else {
+		/* If there is no surface region, just use the global region */
+		pixman_region32_copy(&final_region, region);
+	}
+
+	/* Convert from global to output coord */
+	region_global_to_output(output, &final_region);
+
+	composite_view(ev, output, target, &final_region, pixman_op, NULL, 0);
+
+	pixman_region32_fini(&final_region);
+}
+
+/* The exact counterpart of region_global_to_output() for a point. */
+static void
+global_to_output_float(struct weston_output *output, float x, float y,
+		       float *ox, float *oy)
+{
+	double zoom, zoom_x, zoom_y;
+
+	weston_transformed_coord(output->width, output->height,
+				 output->transform, output->current_scale,
+				 x - output->x, y - output->y, ox, oy);
+
+	if (output_get_zoom(output, &zoom, &zoom_x, &zoom_y)) {
+		*ox = *ox * zoom + zoom_x;
+		*oy = *oy * zoom + zoom_y;
+	}
+}
+
+/* Paint a rotated or projected view over 'region', in global
+ * coordinates, covering only the transformed surface quad instead of its
+ * whole bounding box.  The quad is clipped to the extents of 'region'
+ * grown by a pixel, so the clip edges stay outside the painted area and
+ * are not antialiased, and is then rasterized as a triangle fan. */
+static void
+repaint_region_complex(struct weston_view *ev, struct weston_output *output,
+		       struct pixman_paint_target *target,
+		       pixman_region32_t *region)
+{
+	struct clip_context ctx;
+	struct polygon8 surf = {
+		{ 0, ev->surface->width, ev->surface->width, 0 },
+		{ 0, 0, ev->surface->height, ev->surface->height },
+		4
+	};
+	pixman_region32_t final_region;
+	pixman_box32_t *extents;
+	pixman_triangle_t tris[6];
+	pixman_point_fixed_t p[8];
+	float ex[8], ey[8];
+	int i, n;
+
+	extents = pixman_region32_extents(region);
+	ctx.clip.x1 = extents->x1 - 1;
+	ctx.clip.y1 = extents->y1 - 1;
+	ctx.clip.x2 = extents->x2 + 1;
+	ctx.clip.y2 = extents->y2 + 1;
+
+	for (i = 0; i < surf.n; i++)
+		weston_view_to_global_float(ev, surf.x[i], surf.y[i],
+					    &surf.x[i], &surf.y[i]);
+
+	n = clip_transformed(&ctx, &surf, ex, ey);
+	if (n < 3)
+		return;
+
+	for (i = 0; i < n; i++) {
+		global_to_output_float(output, ex[i], ey[i], &ex[i], &ey[i]);
+		p[i].x = pixman_double_to_fixed(ex[i]);
+		p[i].y = pixman_double_to_fixed(ey[i]);
+	}
+
+	for (i = 0; i < n - 2; i++) {
+		tris[i].p1 = p[0];
+		tris[i].p2 = p[i + 1];
+		tris[i].p3 = p[i + 2];
+	}
+
+	pixman_region32_init(&final_region);
+	pixman_region32_copy(&final_region, region);
+	region_global_to_output(output, &final_region);
+
+	composite_view(ev, output, target, &final_region, PIXMAN_OP_OVER,
+		       tris, n - 2);
+
+	pixman_region32_fini(&final_region);
+}
+
+static void
+draw_view(struct weston_view *ev, struct weston_output *output,
+	  struct pixman_paint_target *target,
+	  pixman_region32_t *damage, /* in global coordinates */
+	  pixman_region32_t *clip) /* covered by the views above */
+{
+	struct pixman_surface_state *ps = get_surface_state(ev->surface);
+	/* repaint bounding region in global coordinates: */
+	pixman_region32_t repaint;
+	/* non-opaque region in surface coordinates: */
+	pixman_region32_t surface_blend;
+
+	/* No buffer attached */
+	if (!ps->image)
+		return;
+
+	pixman_region32_init(&repaint);
+	pixman_region32_intersect(&repaint,
+				  &ev->transform.boundingbox, damage);
+	pixman_region32_subtract(&repaint, &repaint, clip);
+
+	if (!pixman_region32_not_empty(&repaint))
+		goto out;
+
+	if (ev->transform.enabled &&
+	    ev->transform.matrix.type & (WESTON_MATRIX_TRANSFORM_ROTATE |
+					 WESTON_MATRIX_TRANSFORM_OTHER)) {
+		repaint_region_complex(ev, output, target, &repaint);
+	} else {
+		/* blended region is whole surface minus opaque region: */
+		pixman_region32_init_rect(&surface_blend, 0, 0,
+					  ev->surface->width, ev->surface->height);
+		pixman_region32_subtract(&surface_blend, &surface_blend, &ev->surface->opaque);
+
+		/* A translucent view blends its opaque region too */
+		if (pixman_region32_not_empty(&ev->surface->opaque)) {
+			repaint_region(ev, output, target, &repaint,
+				       &ev->surface->opaque,
+				       ev->alpha < 1.0 ? PIXMAN_OP_OVER :
+							 PIXMAN_OP_SRC);
+		}
+
+		if (pixman_region32_not_empty(&surface_blend)) {
+			repaint_region(ev, output, target, &repaint,
+				       &surface_blend, PIXMAN_OP_OVER);
+		}
+		pixman_region32_fini(&surface_blend);
+	}
+
+
+out:
+	pixman_region32_fini(&repaint);
+}
+static int
+view_in_layer_stack(struct weston_view *view, struct weston_output *output)
+{
+	return view->plane == &view->surface->compositor->primary_plane &&
+	       view->output_mask & (1 << output->id);
+}
+
+/* Paint 'damage', in global coordinates, from the layer cache */
+static void
+draw_layer_cache(struct weston_output *output,
+		 struct pixman_paint_target *target, pixman_region32_t *damage)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	pixman_region32_t region;
+	pixman_image_t *src;
+
+	pixman_region32_init(&region);
+	pixman_region32_copy(&region, damage);
+	region_global_to_output(output, &region);
+	pixman_image_set_clip_region32(target->image, &region);
+
+	if (target->private_sources)
+		src = image_alias(po->layer_image, NULL);
+	else
+		src = pixman_image_ref(po->layer_image);
+
+	pixman_image_composite32(PIXMAN_OP_SRC,
+				 src, /* src */
+				 NULL /* mask */,
+				 target->image, /* dest */
+				 0, 0, /* src_x, src_y */
+				 0, 0, /* mask_x, mask_y */
+				 0, 0, /* dest_x, dest_y */
+				 po->width, /* width */
+				 po->height /* height */);
+
+	pixman_image_unref(src);
+	pixman_image_set_clip_region32(target->image, NULL);
+	pixman_region32_fini(&region);
+}
+
+/* Paint 'damage', in global coordinates, leaving out 'hidden' if given */
+static void
+repaint_surfaces(struct weston_output *output,
+		 struct pixman_paint_target *target, pixman_region32_t *damage,
+		 struct weston_view *hidden)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct pixman_output_state *po = get_output_state(output);
+	struct weston_view *view;
+	int skip = po->layer_count;
+
+	if (skip)
+		draw_layer_cache(output, target, damage);
+
+	wl_list_for_each_reverse(view, &compositor->view_list, link) {
+		if (skip && view_in_layer_stack(view, output)) {
+			skip--;
+			continue;
+		}
+
+		if (view->plane == &compositor->primary_plane &&
+		    view != hidden)
+			draw_view(view, output, target, damage, &view->clip);
+	}
+}
+
+static int
+layer_view_equal(const struct pixman_layer_view *a,
+		 const struct pixman_layer_view *b)
+{
+	return a->view == b->view &&
+	       a->generation == b->generation &&
+	       a->content_serial == b->content_serial &&
+	       a->alpha == b->alpha;
+}
+
+/* Composite the bottom 'count' views of 'stack' over the whole output
+ * into the layer cache.  The views above them do not count in the
+ * occlusion, as they will be painted over the cache anyway. */
+static int
+build_layer_cache(struct weston_output *output,
+		  struct pixman_layer_view *stack, int count)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_paint_target target;
+	pixman_region32_t opaque, *clip;
+	pixman_color_t black = { 0, 0, 0, 0xffff };
+	pixman_box32_t box = { 0, 0, po->width, po->height };
+	struct pixman_layer_view *cached;
+	int i;
+
+	if (po->layer_image &&
+	    (pixman_image_get_width(po->layer_image) != po->width ||
+	     pixman_image_get_height(po->layer_image) != po->height)) {
+		pixman_image_unref(po->layer_image);
+		po->layer_image = NULL;
+	}
+
+	if (!po->layer_image) {
+		po->layer_image = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+							   po->width,
+							   po->height,
+							   NULL, 0);
+		if (!po->layer_image)
+			return -1;
+	}
+
+	clip = malloc(count * sizeof *clip);
+	if (!clip)
+		return -1;
+
+	po->layer_views.size = 0;
+	cached = wl_array_add(&po->layer_views, count * sizeof *cached);
+	if (!cached) {
+		free(clip);
+		return -1;
+	}
+	memcpy(cached, stack, count * sizeof *cached);
+	po->layer_output_generation = output->geometry_generation;
+
+	target.image = po->layer_image;
+	target.debug_color = NULL;
+	target.private_sources = 0;
+
+	pixman_image_fill_boxes(PIXMAN_OP_SRC, po->layer_image, &black,
+				1, &box);
+
+	/* The stack runs bottom to top.  Find what the cached views above
+	 * each one cover first, then paint them bottom up like
+	 * repaint_surfaces() does with view->clip. */
+	pixman_region32_init(&opaque);
+	for (i = count - 1; i >= 0; i--) {
+		pixman_region32_init(&clip[i]);
+		pixman_region32_copy(&clip[i], &opaque);
+		pixman_region32_union(&opaque, &opaque,
+				      &stack[i].view->transform.opaque);
+	}
+	pixman_region32_fini(&opaque);
+
+	for (i = 0; i < count; i++) {
+		draw_view(stack[i].view, output, &target, &output->region,
+			  &clip[i]);
+		pixman_region32_fini(&clip[i]);
+	}
+	free(clip);
+
+	return 0;
+}
+
+/* Take a snapshot of the stack of the output for this frame, counting
+ * for how many frames each view has stayed the same, as long as
+ * everything below it has too. */
+static void
+update_stack(struct weston_output *output)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct weston_compositor *compositor = output->compositor;
+	struct pixman_layer_view *prev, *e;
+	struct weston_view *view;
+	struct wl_array stack;
+	int n_prev, n, stable;
+
+	prev = po->stack.data;
+	n_prev = po->stack.size / sizeof *prev;
+
+	wl_array_init(&stack);
+	n = 0;
+	stable = 1;
+	wl_list_for_each_reverse(view, &compositor->view_list, link) {
+		if (!view_in_layer_stack(view, output))
+			continue;
+
+		e = wl_array_add(&stack, sizeof *e);
+		if (!e) {
+			wl_array_release(&stack);
+			po->stack.size = 0;
+			return;
+		}
+
+		e->view = view;
+		e->generation = view->transform.generation;
+		e->content_serial =
+			get_surface_state(view->surface)->content_serial;
+		e->alpha = view->alpha;
+		e->stable_frames = 0;
+
+		if (stable && n < n_prev && layer_view_equal(e, &prev[n]))
+			e->stable_frames = prev[n].stable_frames + 1;
+		else
+			stable = 0;
+		n++;
+	}
+
+	wl_array_release(&po->stack);
+	po->stack = stack;
+}
+
+/* Decide how much of the stack the repaint takes from the layer cache,
+ * rebuilding the cache when the views that have been stable for a while
+ * are not the ones in it.  The pointer sprite under save-under, if any,
+ * stays out of it. */
+static void
+prepare_layer_cache(struct weston_output *output, struct weston_view *cursor)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_layer_view *cached, *e;
+	int n, i, j;
+
+	po->layer_count = 0;
+	if (!pr->layer_cache || pr->repaint_debug)
+		return;
+
+	e = po->stack.data;
+	n = po->stack.size / sizeof *e;
+	if (cursor)
+		n--;
+
+	for (i = 0; i < n; i++)
+		if (e[i].stable_frames < PIXMAN_RENDERER_LAYER_STABLE_FRAMES)
+			break;
+	if (i == 0)
+		return;
+
+	cached = po->layer_views.data;
+	if (po->layer_views.size == i * sizeof *cached &&
+	    po->layer_output_generation == output->geometry_generation) {
+		for (j = 0; j < i; j++)
+			if (!layer_view_equal(&cached[j], &e[j]))
+				break;
+		if (j == i) {
+			po->layer_count = i;
+			return;
+		}
+	}
 
-	pixman_image_set_transform(ps->image, &transform);
+	if (build_layer_cache(output, e, i) == 0)
+		po->layer_count = i;
+}
 
-	if (ev->transform.enabled || output->current_scale != ev->surface->buffer_viewport.scale)
-		pixman_image_set_filter(ps->image, PIXMAN_FILTER_BILINEAR, NULL, 0);
-	else
-		pixman_image_set_filter(ps->image, PIXMAN_FILTER_NEAREST, NULL, 0);
+static void
+copy_to_hw_buffer(struct weston_output *output, pixman_image_t *shadow,
+		  pixman_image_t *hw_buffer, pixman_region32_t *region)
+{
+	pixman_region32_t output_region;
 
-	if (ps->buffer_ref.buffer)
-		wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
+	pixman_region32_init(&output_region);
+	pixman_region32_copy(&output_region, region);
 
-	pixman_image_composite32(pixman_op,
-				 ps->image, /* src */
+	region_global_to_output(output, &output_region);
+
+	pixman_image_set_clip_region32 (hw_buffer, &output_region);
+
+	pixman_image_composite32(PIXMAN_OP_SRC,
+				 shadow, /* src */
 				 NULL /* mask */,
-				 po->shadow_image, /* dest */
+				 hw_buffer, /* dest */
 				 0, 0, /* src_x, src_y */
 				 0, 0, /* mask_x, mask_y */
 				 0, 0, /* dest_x, dest_y */
-				 pixman_image_get_width (po->shadow_image), /* width */
-				 pixman_image_get_height (po->shadow_image) /* height */);
+				 pixman_image_get_width (hw_buffer), /* width */
+				 pixman_image_get_height (hw_buffer) /* height */);
 
-	if (ps->buffer_ref.buffer)
-		wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
+	pixman_image_set_clip_region32 (hw_buffer, NULL);
+	pixman_region32_fini(&output_region);
+}
+
+struct pixman_band_job {
+	struct weston_output *output;
+	pixman_image_t *target;
+	pixman_region32_t *paint;	/* in global coordinates */
+	pixman_region32_t *copy;	/* ditto, NULL when painting direct */
+	pixman_box32_t extents;
+	int bands;
+};
+
+/* Paint and copy out one horizontal band of the damage.  Runs on the
+ * band pool threads; the bands are disjoint, so each thread only writes
+ * pixels no other thread touches, and only copies out what it painted
+ * itself. */
+static void
+repaint_band(int band, void *data)
+{
+	struct pixman_band_job *job = data;
+	struct weston_output *output = job->output;
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_paint_target target;
+	pixman_image_t *hw_buffer;
+	pixman_region32_t band_region, damage;
+	int y1, y2;
+
+	band_get_rows(job->extents.y1, job->extents.y2, job->bands, band,
+		      &y1, &y2);
+
+	pixman_region32_init_rect(&band_region, job->extents.x1, y1,
+				  job->extents.x2 - job->extents.x1, y2 - y1);
+	pixman_region32_init(&damage);
+	pixman_region32_intersect(&damage, &band_region, job->paint);
 
+	target.image = image_alias(job->target, NULL);
+	target.debug_color = NULL;
 	if (pr->repaint_debug)
-		pixman_image_composite32(PIXMAN_OP_OVER,
-					 pr->debug_color, /* src */
-					 NULL /* mask */,
-					 po->shadow_image, /* dest */
-					 0, 0, /* src_x, src_y */
-					 0, 0, /* mask_x, mask_y */
-					 0, 0, /* dest_x, dest_y */
-					 pixman_image_get_width (po->shadow_image), /* width */
-					 pixman_image_get_height (po->shadow_image) /* height */);
+		target.debug_color = pixman_image_create_solid_fill(&debug_red);
+	target.private_sources = 1;
+
+	if (pixman_region32_not_empty(&damage))
+		repaint_surfaces(output, &target, &damage, NULL);
+
+	if (job->copy) {
+		pixman_region32_intersect(&damage, &band_region, job->copy);
+		hw_buffer = image_alias(po->hw_buffer, NULL);
+		if (pixman_region32_not_empty(&damage))
+			copy_to_hw_buffer(output, target.image, hw_buffer,
+					  &damage);
+		pixman_image_unref(hw_buffer);
+	}
 
-	pixman_image_set_clip_region32 (po->shadow_image, NULL);
+	if (target.debug_color)
+		pixman_image_unref(target.debug_color);
+	pixman_image_unref(target.image);
+	pixman_region32_fini(&damage);
+	pixman_region32_fini(&band_region);
+}
 
-	pixman_region32_fini(&final_region);
+static int
+repaint_output_bands(struct weston_output *output, pixman_image_t *target,
+		     pixman_region32_t *paint, pixman_region32_t *copy)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct pixman_renderer *pr = get_renderer(compositor);
+	struct pixman_band_job job;
+	struct weston_view *view;
+	pixman_region32_t all;
+	pixman_box32_t *extents;
+	int height;
+
+	pixman_region32_init(&all);
+	pixman_region32_copy(&all, paint);
+	if (copy)
+		pixman_region32_union(&all, &all, copy);
+	job.extents = *pixman_region32_extents(&all);
+	pixman_region32_fini(&all);
+
+	extents = &job.extents;
+	height = extents->y2 - extents->y1;
+	if ((extents->x2 - extents->x1) * height <
+	    PIXMAN_RENDERER_MIN_THREADED_AREA)
+		return -1;
+
+	job.bands = band_pool_get_threads(pr->band_pool) *
+		PIXMAN_RENDERER_BANDS_PER_THREAD;
+	if (job.bands > height / PIXMAN_RENDERER_MIN_BAND_HEIGHT)
+		job.bands = height / PIXMAN_RENDERER_MIN_BAND_HEIGHT;
+	if (job.bands < 2)
+		return -1;
+
+	job.output = output;
+	job.target = target;
+	job.paint = paint;
+	job.copy = copy;
+
+	/* The surface state and the transform cache are filled lazily,
+	 * which the band threads must not race on. */
+	wl_list_for_each(view, &compositor->view_list, link)
+		if (view->plane == &compositor->primary_plane &&
+		    get_surface_state(view->surface)->image)
+			view_get_transform(view, output, NULL);
+
+	band_pool_run(pr->band_pool, job.bands, repaint_band, &job);
+
+	return 0;
 }
 
+/* Paint 'paint' into 'target', then copy 'copy' from it to the hardware
+ * buffer unless 'target' is the hardware buffer itself. */
 static void
-draw_view(struct weston_view *ev, struct weston_output *output,
-	  pixman_region32_t *damage) /* in global coordinates */
+repaint_output_regions(struct weston_output *output, pixman_image_t *target,
+		       pixman_region32_t *paint, pixman_region32_t *copy)
 {
-	struct pixman_surface_state *ps = get_surface_state(ev->surface);
-	/* repaint bounding region in global coordinates: */
-	pixman_region32_t repaint;
-	/* non-opaque region in surface coordinates: */
-	pixman_region32_t surface_blend;
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_paint_target paint_target;
 
-	/* No buffer attached */
-	if (!ps->image)
+	if (band_pool_get_threads(pr->band_pool) > 1 &&
+	    repaint_output_bands(output, target, paint, copy) == 0)
 		return;
 
-	pixman_region32_init(&repaint);
-	pixman_region32_intersect(&repaint,
-				  &ev->transform.boundingbox, damage);
-	pixman_region32_subtract(&repaint, &repaint, &ev->clip);
+	paint_target.image = target;
+	paint_target.debug_color = pr->repaint_debug ? pr->debug_color : NULL;
+	paint_target.private_sources = 0;
 
-	if (!pixman_region32_not_empty(&repaint))
-		goto out;
+	repaint_surfaces(output, &paint_target, paint, NULL);
+	if (copy)
+		copy_to_hw_buffer(output, target, po->hw_buffer, copy);
+}
 
-	if (output->zoom.active) {
-		weston_log("pixman renderer does not support zoom\n");
-		goto out;
+/* The hardware buffer can be painted directly if it has the layout the
+ * shadow image would have; other formats are painted in the shadow and
+ * converted when copying out, so that blending is done at full depth. */
+static int
+can_repaint_direct(struct weston_output *output)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_output_state *po = get_output_state(output);
+
+	return !pr->force_shadow &&
+		pixman_image_get_format(po->hw_buffer) == PIXMAN_x8r8g8b8 &&
+		pixman_image_get_width(po->hw_buffer) == po->width &&
+		pixman_image_get_height(po->hw_buffer) == po->height;
+}
+
+/* How many frames ago the current hardware buffer was painted, or 0 if
+ * we have not seen it yet. */
+static uint32_t
+get_buffer_age(struct weston_output *output)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	uint32_t age = 0;
+	int i;
+
+	for (i = 0; i < PIXMAN_RENDERER_BUFFER_HISTORY; i++)
+		if (po->buffers[i].image == po->hw_buffer)
+			age = po->frame + 1 - po->buffers[i].frame;
+
+	return age;
+}
+
+/* Add to 'damage' what has changed since the current hardware buffer was
+ * last painted, going by the damage history of the buffers the backend
+ * has handed us.  Buffers we have not seen, or not recently enough, are
+ * repainted in full. */
+static void
+add_buffer_age_damage(struct weston_output *output,
+		      pixman_region32_t *damage)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	uint32_t age = get_buffer_age(output);
+	int i;
+
+	if (age == 0 || age > PIXMAN_RENDERER_BUFFER_HISTORY) {
+		pixman_region32_union(damage, damage, &output->region);
+		return;
 	}
 
-	/* TODO: Implement repaint_region_complex() using pixman_composite_trapezoids() */
-	if (ev->transform.enabled &&
-	    ev->transform.matrix.type != WESTON_MATRIX_TRANSFORM_TRANSLATE) {
-		repaint_region(ev, output, &repaint, NULL, PIXMAN_OP_OVER);
-	} else {
-		/* blended region is whole surface minus opaque region: */
-		pixman_region32_init_rect(&surface_blend, 0, 0,
-					  ev->surface->width, ev->surface->height);
-		pixman_region32_subtract(&surface_blend, &surface_blend, &ev->surface->opaque);
+	for (i = 0; i < (int) age - 1; i++)
+		pixman_region32_union(damage, damage, &po->damage_history[i]);
+}
 
-		if (pixman_region32_not_empty(&ev->surface->opaque)) {
-			repaint_region(ev, output, &repaint, &ev->surface->opaque, PIXMAN_OP_SRC);
+static void
+record_buffer_age_damage(struct weston_output *output,
+			 pixman_region32_t *output_damage)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	pixman_region32_t oldest;
+	int i, slot = 0;
+
+	oldest = po->damage_history[PIXMAN_RENDERER_BUFFER_HISTORY - 1];
+	for (i = PIXMAN_RENDERER_BUFFER_HISTORY - 1; i > 0; i--)
+		po->damage_history[i] = po->damage_history[i - 1];
+	po->damage_history[0] = oldest;
+	pixman_region32_copy(&po->damage_history[0], output_damage);
+
+	po->frame++;
+
+	/* Reuse the slot of this buffer, or else the least recently
+	 * painted one.  Holding a reference keeps the address from being
+	 * reused by a new image. */
+	for (i = 0; i < PIXMAN_RENDERER_BUFFER_HISTORY; i++) {
+		if (po->buffers[i].image == po->hw_buffer) {
+			slot = i;
+			break;
 		}
+		if (po->buffers[i].frame < po->buffers[slot].frame)
+			slot = i;
+	}
 
-		if (pixman_region32_not_empty(&surface_blend)) {
-			repaint_region(ev, output, &repaint, &surface_blend, PIXMAN_OP_OVER);
-		}
-		pixman_region32_fini(&surface_blend);
+	if (po->buffers[slot].image != po->hw_buffer) {
+		if (po->buffers[slot].image)
+			pixman_image_unref(po->buffers[slot].image);
+		po->buffers[slot].image = pixman_image_ref(po->hw_buffer);
 	}
+	po->buffers[slot].frame = po->frame;
+}
 
+static int
+create_shadow(struct weston_output *output)
+{
+	struct pixman_output_state *po = get_output_state(output);
 
-out:
-	pixman_region32_fini(&repaint);
+	po->shadow_buffer = malloc(po->width * po->height * 4);
+	if (!po->shadow_buffer)
+		return -1;
+
+	po->shadow_image =
+		pixman_image_create_bits(PIXMAN_x8r8g8b8,
+					 po->width, po->height,
+					 po->shadow_buffer, po->width * 4);
+	if (!po->shadow_image) {
+		free(po->shadow_buffer);
+		po->shadow_buffer = NULL;
+		return -1;
+	}
+
+	po->shadow_valid = 0;
+
+	return 0;
 }
-static void
-repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
+
+/* The pointer sprite of a seat, if it is the topmost view of the
+ * output, so that the pixels below it can be kept aside.  A sprite with
+ * an opaque region hides what is below it from the repaint. */
+static struct weston_view *
+find_cursor_view(struct weston_output *output)
 {
 	struct weston_compositor *compositor = output->compositor;
+	struct pixman_renderer *pr = get_renderer(compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_layer_view *stack = po->stack.data;
+	int n = po->stack.size / sizeof *stack;
 	struct weston_view *view;
+	struct weston_seat *seat;
+
+	if (n == 0 || output->zoom.active || pr->repaint_debug)
+		return NULL;
+
+	view = stack[n - 1].view;
+	if (!get_surface_state(view->surface)->image ||
+	    pixman_region32_not_empty(&view->transform.opaque))
+		return NULL;
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	wl_list_for_each(seat, &compositor->seat_list, link)
+		if (seat->pointer && seat->pointer->sprite == view)
+			return view;
+
+	return NULL;
 }
 
-static void
-copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
+/* The part of the output the view covers, in global coordinates in
+ * 'region' and as a box in output buffer coordinates in 'box'. */
+static int
+get_cursor_area(struct weston_output *output, struct weston_view *view,
+		pixman_region32_t *region, pixman_box32_t *box)
 {
-	struct pixman_output_state *po = get_output_state(output);
 	pixman_region32_t output_region;
 
+	pixman_region32_intersect(region, &view->transform.boundingbox,
+				  &output->region);
+
 	pixman_region32_init(&output_region);
 	pixman_region32_copy(&output_region, region);
-
 	region_global_to_output(output, &output_region);
+	*box = *pixman_region32_extents(&output_region);
+	pixman_region32_fini(&output_region);
+
+	return box->x1 < box->x2 && box->y1 < box->y2;
+}
 
-	pixman_image_set_clip_region32 (po->hw_buffer, &output_region);
+/* Copy the pixels in 'box' of 'target' aside, as the ones below the
+ * pointer sprite. */
+static void
+save_under_cursor(struct weston_output *output, pixman_image_t *target,
+		  pixman_box32_t *box)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	int width = box->x2 - box->x1;
+	int height = box->y2 - box->y1;
+
+	if (po->cursor_under &&
+	    (pixman_image_get_width(po->cursor_under) < width ||
+	     pixman_image_get_height(po->cursor_under) < height)) {
+		pixman_image_unref(po->cursor_under);
+		po->cursor_under = NULL;
+	}
+
+	if (!po->cursor_under) {
+		po->cursor_under = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+							    width, height,
+							    NULL, 0);
+		if (!po->cursor_under) {
+			po->cursor_saved = 0;
+			return;
+		}
+	}
 
 	pixman_image_composite32(PIXMAN_OP_SRC,
-				 po->shadow_image, /* src */
+				 target, /* src */
 				 NULL /* mask */,
-				 po->hw_buffer, /* dest */
-				 0, 0, /* src_x, src_y */
+				 po->cursor_under, /* dest */
+				 box->x1, box->y1, /* src_x, src_y */
 				 0, 0, /* mask_x, mask_y */
 				 0, 0, /* dest_x, dest_y */
-				 pixman_image_get_width (po->hw_buffer), /* width */
-				 pixman_image_get_height (po->hw_buffer) /* height */);
+				 width, height);
+
+	po->cursor_box = *box;
+	po->cursor_target = target;
+	po->cursor_stack_count =
+		po->stack.size / sizeof(struct pixman_layer_view);
+	po->cursor_output_generation = output->geometry_generation;
+	po->cursor_saved = 1;
+}
+
+/* Put back the pixels the pointer sprite covered in the last frame */
+static void
+restore_under_cursor(struct weston_output *output, pixman_image_t *target)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	pixman_box32_t *box = &po->cursor_box;
+
+	pixman_image_composite32(PIXMAN_OP_SRC,
+				 po->cursor_under, /* src */
+				 NULL /* mask */,
+				 target, /* dest */
+				 0, 0, /* src_x, src_y */
+				 0, 0, /* mask_x, mask_y */
+				 box->x1, box->y1, /* dest_x, dest_y */
+				 box->x2 - box->x1, box->y2 - box->y1);
+}
+
+/* Whether this frame can be painted by moving the pointer sprite alone:
+ * 'target' still holds the last frame, nothing below the sprite has
+ * changed since, and all the damage is where the sprite was or is. */
+static int
+can_restore_under_cursor(struct weston_output *output, pixman_image_t *target,
+			 pixman_region32_t *output_damage, pixman_box32_t *box)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_layer_view *stack = po->stack.data;
+	int n = po->stack.size / sizeof *stack;
+	pixman_region32_t damage, sprite;
+	int covered;
+
+	if (!po->cursor_saved || po->cursor_target != target ||
+	    po->cursor_stack_count != n ||
+	    po->cursor_output_generation != output->geometry_generation)
+		return 0;
+
+	if (n > 1 && stack[n - 2].stable_frames == 0)
+		return 0;
+
+	if (target == po->shadow_image ? !po->shadow_valid :
+					 get_buffer_age(output) != 1)
+		return 0;
+
+	pixman_region32_init(&damage);
+	pixman_region32_copy(&damage, output_damage);
+	region_global_to_output(output, &damage);
+
+	pixman_region32_init_rect(&sprite, box->x1, box->y1,
+				  box->x2 - box->x1, box->y2 - box->y1);
+	pixman_region32_subtract(&damage, &damage, &sprite);
+	pixman_region32_fini(&sprite);
+
+	box = &po->cursor_box;
+	pixman_region32_init_rect(&sprite, box->x1, box->y1,
+				  box->x2 - box->x1, box->y2 - box->y1);
+	pixman_region32_subtract(&damage, &damage, &sprite);
+	pixman_region32_fini(&sprite);
+
+	covered = !pixman_region32_not_empty(&damage);
+	pixman_region32_fini(&damage);
+
+	return covered;
+}
+
+/* Paint the frame into 'target', then copy 'copy' out as
+ * repaint_output_regions() does.  While a pointer sprite is the topmost
+ * view, the pixels below it are kept aside, and a frame in which only
+ * the sprite moved or changed is painted by restoring its old rectangle
+ * and drawing it in the new one.  Otherwise the frame is painted as
+ * usual, and the sprite rectangle once more without the sprite to save
+ * what is below it, which leaves the same pixels as before. */
+static void
+repaint_output_target(struct weston_output *output, pixman_image_t *target,
+		      struct weston_view *cursor,
+		      pixman_region32_t *output_damage,
+		      pixman_region32_t *paint, pixman_region32_t *copy)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_paint_target paint_target;
+	pixman_region32_t area;
+	pixman_box32_t box;
+
+	pixman_region32_init(&area);
+	if (!cursor || !get_cursor_area(output, cursor, &area, &box)) {
+		po->cursor_saved = 0;
+		repaint_output_regions(output, target, paint, copy);
+		pixman_region32_fini(&area);
+		return;
+	}
 
-	pixman_image_set_clip_region32 (po->hw_buffer, NULL);
+	paint_target.image = target;
+	paint_target.debug_color = NULL;
+	paint_target.private_sources = 0;
+
+	if (can_restore_under_cursor(output, target, output_damage, &box)) {
+		restore_under_cursor(output, target);
+		save_under_cursor(output, target, &box);
+		draw_view(cursor, output, &paint_target, &area, &cursor->clip);
+		if (copy)
+			copy_to_hw_buffer(output, target, po->hw_buffer, copy);
+	} else {
+		repaint_output_regions(output, target, paint, copy);
+		repaint_surfaces(output, &paint_target, &area, cursor);
+		save_under_cursor(output, target, &box);
+		draw_view(cursor, output, &paint_target, &area, &cursor->clip);
+	}
+
+	pixman_region32_fini(&area);
 }
 
 static void
@@ -449,12 +1714,58 @@ pixman_renderer_repaint_output(struct weston_output *output,
 			     pixman_region32_t *output_damage)
 {
 	struct pixman_output_state *po = get_output_state(output);
+	struct weston_view *cursor;
+	pixman_region32_t buffer_damage, shadow_damage, visible;
 
 	if (!po->hw_buffer)
 		return;
 
-	repaint_surfaces(output, output_damage);
-	copy_to_hw_buffer(output, output_damage);
+	weston_output_simplify_damage(output, output_damage,
+				      PIXMAN_RENDERER_MAX_DAMAGE_RECTS);
+
+	pixman_region32_init(&buffer_damage);
+	pixman_region32_copy(&buffer_damage, output_damage);
+	add_buffer_age_damage(output, &buffer_damage);
+
+	/* What to paint into the shadow, which is out of date after
+	 * painting direct. */
+	pixman_region32_init(&shadow_damage);
+	if (po->shadow_valid)
+		pixman_region32_copy(&shadow_damage, output_damage);
+	else
+		pixman_region32_copy(&shadow_damage, &output->region);
+
+	/* When zoomed in, only a part of the damage is on screen. */
+	if (output->zoom.active) {
+		zoom_visible_region(output, &visible);
+		pixman_region32_intersect(&buffer_damage,
+					  &buffer_damage, &visible);
+		pixman_region32_intersect(&shadow_damage,
+					  &shadow_damage, &visible);
+		pixman_region32_fini(&visible);
+	}
+
+	update_stack(output);
+	cursor = find_cursor_view(output);
+	prepare_layer_cache(output, cursor);
+
+	if (can_repaint_direct(output)) {
+		repaint_output_target(output, po->hw_buffer, cursor,
+				      output_damage, &buffer_damage, NULL);
+		po->shadow_valid = 0;
+	} else if (po->shadow_image || create_shadow(output) == 0) {
+		repaint_output_target(output, po->shadow_image, cursor,
+				      output_damage, &shadow_damage,
+				      &buffer_damage);
+		po->shadow_valid = 1;
+	} else {
+		weston_log("pixman renderer: failed to allocate a shadow "
+			   "buffer\n");
+	}
+
+	record_buffer_age_damage(output, output_damage);
+	pixman_region32_fini(&shadow_damage);
+	pixman_region32_fini(&buffer_damage);
 
 	pixman_region32_copy(&output->previous_damage, output_damage);
 	wl_signal_emit(&output->frame_signal, output);
@@ -462,10 +1773,63 @@ pixman_renderer_repaint_output(struct weston_output *output,
 	/* Actual flip should be done by caller */
 }
 
+static void
+convert_buffer_box(struct pixman_surface_state *ps,
+		   struct weston_buffer *buffer, pixman_box32_t *box)
+{
+	struct wl_shm_buffer *shm_buffer = buffer->shm_buffer;
+
+	shm_convert_box(wl_shm_buffer_get_format(shm_buffer),
+			wl_shm_buffer_get_data(shm_buffer),
+			wl_shm_buffer_get_stride(shm_buffer),
+			buffer->height,
+			pixman_image_get_data(ps->convert_image),
+			pixman_image_get_stride(ps->convert_image),
+			box);
+}
+
 static void
 pixman_renderer_flush_damage(struct weston_surface *surface)
 {
-	/* No-op for pixman renderer */
+	struct pixman_surface_state *ps = get_surface_state(surface);
+	struct weston_buffer *buffer = ps->buffer_ref.buffer;
+	pixman_box32_t *rects, box;
+	int i, n;
+
+	if (pixman_region32_not_empty(&surface->damage))
+		ps->content_serial++;
+
+	/* Only the converted copies need updating */
+	if (!buffer || !ps->image || ps->image != ps->convert_image)
+		return;
+
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+
+	if (ps->convert_full) {
+		box.x1 = 0;
+		box.y1 = 0;
+		box.x2 = buffer->width;
+		box.y2 = buffer->height;
+		convert_buffer_box(ps, buffer, &box);
+		ps->convert_full = 0;
+		goto out;
+	}
+
+	rects = pixman_region32_rectangles(&surface->damage, &n);
+	for (i = 0; i < n; i++) {
+		box = weston_surface_to_buffer_rect(surface, rects[i]);
+
+		/* The rounding to buffer pixels can cut off edge pixels,
+		 * and converting a few extra ones is harmless. */
+		box.x1 = box.x1 > 0 ? box.x1 - 1 : 0;
+		box.y1 = box.y1 > 0 ? box.y1 - 1 : 0;
+		box.x2 = MIN(box.x2 + 1, buffer->width);
+		box.y2 = MIN(box.y2 + 1, buffer->height);
+		convert_buffer_box(ps, buffer, &box);
+	}
+
+out:
+	wl_shm_buffer_end_access(buffer->shm_buffer);
 }
 
 static void
@@ -484,27 +1848,149 @@ buffer_state_handle_buffer_destroy(struct wl_listener *listener, void *data)
 	ps->buffer_destroy_listener.notify = NULL;
 }
 
+static void
+buffer_image_release(struct pixman_buffer_image *bi)
+{
+	if (!bi->buffer)
+		return;
+
+	if (bi->ps->buffer_image == bi)
+		bi->ps->buffer_image = NULL;
+
+	wl_list_remove(&bi->buffer_destroy_listener.link);
+	pixman_image_unref(bi->image);
+	bi->image = NULL;
+	bi->transform = NULL;
+	bi->buffer = NULL;
+}
+
+static void
+buffer_image_handle_buffer_destroy(struct wl_listener *listener, void *data)
+{
+	struct pixman_buffer_image *bi;
+
+	bi = container_of(listener, struct pixman_buffer_image,
+			  buffer_destroy_listener);
+
+	buffer_image_release(bi);
+}
+
+/* The cached image of 'buffer', or a new one on its pixels.  An image is
+ * reused only while the buffer still has the same pixels, which move
+ * when the client resizes the pool. */
+static struct pixman_buffer_image *
+surface_state_get_buffer_image(struct pixman_surface_state *ps,
+			       struct weston_buffer *buffer,
+			       pixman_format_code_t format)
+{
+	struct wl_shm_buffer *shm_buffer = buffer->shm_buffer;
+	void *data = wl_shm_buffer_get_data(shm_buffer);
+	int32_t stride = wl_shm_buffer_get_stride(shm_buffer);
+	struct pixman_buffer_image *bi;
+	int i;
+
+	for (i = 0; i < PIXMAN_RENDERER_IMAGE_CACHE_SIZE; i++) {
+		bi = &ps->buffer_images[i];
+		if (bi->buffer != buffer)
+			continue;
+
+		if (bi->data == data && bi->stride == stride &&
+		    bi->width == buffer->width &&
+		    bi->height == buffer->height &&
+		    bi->format == format)
+			return bi;
+
+		buffer_image_release(bi);
+		break;
+	}
+
+	if (i == PIXMAN_RENDERER_IMAGE_CACHE_SIZE) {
+		bi = &ps->buffer_images[ps->buffer_images_next];
+		ps->buffer_images_next = (ps->buffer_images_next + 1) %
+			PIXMAN_RENDERER_IMAGE_CACHE_SIZE;
+		buffer_image_release(bi);
+	}
+
+	bi->image = pixman_image_create_bits(format,
+					     buffer->width, buffer->height,
+					     data, stride);
+	if (!bi->image)
+		return NULL;
+
+	bi->ps = ps;
+	bi->buffer = buffer;
+	bi->data = data;
+	bi->stride = stride;
+	bi->width = buffer->width;
+	bi->height = buffer->height;
+	bi->format = format;
+	bi->transform = NULL;
+
+	bi->buffer_destroy_listener.notify = buffer_image_handle_buffer_destroy;
+	wl_signal_add(&buffer->destroy_signal, &bi->buffer_destroy_listener);
+
+	return bi;
+}
+
+/* Make sure the conversion copy fits the buffer.  A new copy needs a
+ * full conversion. */
+static int
+surface_state_ensure_convert_image(struct pixman_surface_state *ps,
+				   struct weston_buffer *buffer,
+				   pixman_format_code_t format)
+{
+	if (ps->convert_image &&
+	    pixman_image_get_width(ps->convert_image) == buffer->width &&
+	    pixman_image_get_height(ps->convert_image) == buffer->height &&
+	    pixman_image_get_format(ps->convert_image) == format)
+		return 1;
+
+	if (ps->convert_image)
+		pixman_image_unref(ps->convert_image);
+
+	ps->convert_image = pixman_image_create_bits(format, buffer->width,
+						     buffer->height, NULL, 0);
+	ps->convert_full = 1;
+
+	return ps->convert_image != NULL;
+}
+
 static void
 pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 {
 	struct pixman_surface_state *ps = get_surface_state(es);
 	struct wl_shm_buffer *shm_buffer;
+	struct pixman_buffer_image *bi;
 	pixman_format_code_t pixman_format;
+	uint32_t format;
+	int width = 0, height = 0;
+	int was_converted = ps->image && ps->image == ps->convert_image;
 
 	weston_buffer_reference(&ps->buffer_ref, buffer);
+	ps->content_serial++;
 
 	if (ps->buffer_destroy_listener.notify) {
 		wl_list_remove(&ps->buffer_destroy_listener.link);
 		ps->buffer_destroy_listener.notify = NULL;
 	}
 
+	if (ps->buffer_image) {
+		ps->buffer_image->transform = ps->image_transform;
+		ps->buffer_image = NULL;
+	}
+
 	if (ps->image) {
+		width = pixman_image_get_width(ps->image);
+		height = pixman_image_get_height(ps->image);
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	ps->image_transform = NULL;
 
-	if (!buffer)
+	if (!buffer) {
+		surface_state_reset_transforms(ps);
 		return;
+	}
 	
 	shm_buffer = wl_shm_buffer_get(buffer->resource);
 
@@ -514,7 +2000,8 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 		return;
 	}
 
-	switch (wl_shm_buffer_get_format(shm_buffer)) {
+	format = wl_shm_buffer_get_format(shm_buffer);
+	switch (format) {
 	case WL_SHM_FORMAT_XRGB8888:
 		pixman_format = PIXMAN_x8r8g8b8;
 		break;
@@ -524,7 +2011,18 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	case WL_SHM_FORMAT_RGB565:
 		pixman_format = PIXMAN_r5g6b5;
 		break;
+	case WL_SHM_FORMAT_XRGB2101010:
+		pixman_format = PIXMAN_x2r10g10b10;
+		break;
+	case WL_SHM_FORMAT_ARGB2101010:
+		pixman_format = PIXMAN_a2r10g10b10;
+		break;
 	default:
+		if (shm_convert_supported(format)) {
+			pixman_format = shm_convert_has_alpha(format) ?
+				PIXMAN_a8r8g8b8 : PIXMAN_x8r8g8b8;
+			break;
+		}
 		weston_log("Unsupported SHM buffer format\n");
 		weston_buffer_reference(&ps->buffer_ref, NULL);
 		return;
@@ -535,11 +2033,39 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	buffer->width = wl_shm_buffer_get_width(shm_buffer);
 	buffer->height = wl_shm_buffer_get_height(shm_buffer);
 
-	ps->image = pixman_image_create_bits(pixman_format,
-		buffer->width, buffer->height,
-		wl_shm_buffer_get_data(shm_buffer),
-		wl_shm_buffer_get_stride(shm_buffer));
+	if (shm_convert_supported(format)) {
+		if (!surface_state_ensure_convert_image(ps, buffer,
+							pixman_format)) {
+			weston_buffer_reference(&ps->buffer_ref, NULL);
+			return;
+		}
+
+		/* The damage is relative to what the copy shows */
+		if (!was_converted)
+			ps->convert_full = 1;
+
+		if (width != buffer->width || height != buffer->height)
+			surface_state_reset_transforms(ps);
+
+		ps->image = pixman_image_ref(ps->convert_image);
+		goto out;
+	}
+
+	bi = surface_state_get_buffer_image(ps, buffer, pixman_format);
+	if (!bi) {
+		weston_buffer_reference(&ps->buffer_ref, NULL);
+		return;
+	}
+
+	/* The cached transforms depend on the image size only */
+	if (width != buffer->width || height != buffer->height)
+		surface_state_reset_transforms(ps);
+
+	ps->image = pixman_image_ref(bi->image);
+	ps->image_transform = bi->transform;
+	ps->buffer_image = bi;
 
+out:
 	ps->buffer_destroy_listener.notify =
 		buffer_state_handle_buffer_destroy;
 	wl_signal_add(&buffer->destroy_signal,
@@ -549,6 +2075,8 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 static void
 pixman_renderer_surface_state_destroy(struct pixman_surface_state *ps)
 {
+	int i;
+
 	wl_list_remove(&ps->surface_destroy_listener.link);
 	wl_list_remove(&ps->renderer_destroy_listener.link);
 	if (ps->buffer_destroy_listener.notify) {
@@ -558,6 +2086,12 @@ pixman_renderer_surface_state_destroy(struct pixman_surface_state *ps)
 
 	ps->surface->renderer_state = NULL;
 
+	for (i = 0; i < PIXMAN_RENDERER_IMAGE_CACHE_SIZE; i++)
+		buffer_image_release(&ps->buffer_images[i]);
+
+	if (ps->convert_image)
+		pixman_image_unref(ps->convert_image);
+
 	if (ps->image) {
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
@@ -626,11 +2160,15 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	color.green = green * 0xffff;
 	color.blue = blue * 0xffff;
 	color.alpha = alpha * 0xffff;
+	ps->color = color;
+	ps->content_serial++;
 	
 	if (ps->image) {
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	ps->buffer_image = NULL;
+	surface_state_reset_transforms(ps);
 
 	ps->image = pixman_image_create_solid_fill(&color);
 }
@@ -642,6 +2180,7 @@ pixman_renderer_destroy(struct weston_compositor *ec)
 
 	wl_signal_emit(&pr->destroy_signal, pr);
 	weston_binding_destroy(pr->debug_binding);
+	band_pool_destroy(pr->band_pool);
 	free(pr);
 
 	ec->renderer = NULL;
@@ -657,11 +2196,7 @@ debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 	pr->repaint_debug ^= 1;
 
 	if (pr->repaint_debug) {
-		pixman_color_t red = {
-			0x3fff, 0x0000, 0x0000, 0x3fff
-		};
-
-		pr->debug_color = pixman_image_create_solid_fill(&red);
+		pr->debug_color = pixman_image_create_solid_fill(&debug_red);
 	} else {
 		pixman_image_unref(pr->debug_color);
 		weston_compositor_damage_all(ec);
@@ -672,11 +2207,27 @@ WL_EXPORT int
 pixman_renderer_init(struct weston_compositor *ec)
 {
 	struct pixman_renderer *renderer;
+	struct weston_config_section *section;
+	int threads;
 
 	renderer = calloc(1, sizeof *renderer);
 	if (renderer == NULL)
 		return -1;
 
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_int(section, "pixman-threads", &threads, 1);
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > 1) {
+		renderer->band_pool = band_pool_create(threads);
+		weston_log("pixman renderer: painting with %d threads\n",
+			   band_pool_get_threads(renderer->band_pool));
+	}
+	weston_config_section_get_bool(section, "pixman-shadow",
+				       &renderer->force_shadow, 0);
+	weston_config_section_get_bool(section, "pixman-layer-cache",
+				       &renderer->layer_cache, 0);
+
 	renderer->repaint_debug = 0;
 	renderer->debug_color = NULL;
 	renderer->base.read_pixels = pixman_renderer_read_pixels;
@@ -694,6 +2245,10 @@ pixman_renderer_init(struct weston_compositor *ec)
 						    debug_binding, ec);
 
 	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_RGB565);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_XRGB2101010);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_ARGB2101010);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_NV12);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_YUYV);
 
 	wl_signal_init(&renderer->destroy_signal);
 
@@ -719,31 +2274,19 @@ WL_EXPORT int
 pixman_renderer_output_create(struct weston_output *output)
 {
 	struct pixman_output_state *po = calloc(1, sizeof *po);
-	int w, h;
+	int i;
 
 	if (!po)
 		return -1;
 
-	/* set shadow image transformation */
-	w = output->current_mode->width;
-	h = output->current_mode->height;
-
-	po->shadow_buffer = malloc(w * h * 4);
+	po->width = output->current_mode->width;
+	po->height = output->current_mode->height;
 
-	if (!po->shadow_buffer) {
-		free(po);
-		return -1;
-	}
-
-	po->shadow_image =
-		pixman_image_create_bits(PIXMAN_x8r8g8b8, w, h,
-					 po->shadow_buffer, w * 4);
+	wl_array_init(&po->stack);
+	wl_array_init(&po->layer_views);
 
-	if (!po->shadow_image) {
-		free(po->shadow_buffer);
-		free(po);
-		return -1;
-	}
+	for (i = 0; i < PIXMAN_RENDERER_BUFFER_HISTORY; i++)
+		pixman_region32_init(&po->damage_history[i]);
 
 	output->renderer_state = po;
 
@@ -754,8 +2297,25 @@ WL_EXPORT void
 pixman_renderer_output_destroy(struct weston_output *output)
 {
 	struct pixman_output_state *po = get_output_state(output);
+	int i;
+
+	for (i = 0; i < PIXMAN_RENDERER_BUFFER_HISTORY; i++) {
+		pixman_region32_fini(&po->damage_history[i]);
+		if (po->buffers[i].image)
+			pixman_image_unref(po->buffers[i].image);
+	}
+
+	if (po->shadow_image)
+		pixman_image_unref(po->shadow_image);
+	free(po->shadow_buffer);
+
+	if (po->layer_image)
+		pixman_image_unref(po->layer_image);
+	wl_array_release(&po->layer_views);
+	wl_array_release(&po->stack);
 
-	pixman_image_unref(po->shadow_image);
+	if (po->cursor_under)
+		pixman_image_unref(po->cursor_under);
 
 	if (po->hw_buffer)
 		pixman_image_unref(po->hw_buffer);
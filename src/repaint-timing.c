@@ -0,0 +1,251 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <linux/input.h>
+
+#include "compositor.h"
+#include "repaint-timing-server-protocol.h"
+
+/* Number of repaints the statistics are computed over */
+#define REPAINT_TIMING_WINDOW 256
+
+struct stage_history {
+	uint32_t samples[REPAINT_TIMING_WINDOW];	/* ns */
+	uint32_t count;
+	uint32_t next;
+};
+
+struct weston_repaint_timings {
+	struct stage_history stages[WESTON_REPAINT_STAGE_COUNT];
+};
+
+struct stage_stats {
+	uint32_t samples;
+	uint32_t min, avg, p99, max;
+};
+
+struct repaint_timing {
+	struct weston_compositor *ec;
+	struct wl_global *global;
+	struct wl_listener destroy_listener;
+};
+
+static const char * const stage_names[] = {
+	[WESTON_REPAINT_STAGE_VIEW_LIST] = "view list",
+	[WESTON_REPAINT_STAGE_ASSIGN_PLANES] = "assign planes",
+	[WESTON_REPAINT_STAGE_FRAME_CALLBACKS] = "frame callbacks",
+	[WESTON_REPAINT_STAGE_ACCUMULATE_DAMAGE] = "accumulate damage",
+	[WESTON_REPAINT_STAGE_REPAINT_OUTPUT] = "repaint output",
+	[WESTON_REPAINT_STAGE_REPICK] = "repick",
+	[WESTON_REPAINT_STAGE_ANIMATIONS] = "animations",
+};
+
+WL_EXPORT struct weston_repaint_timings *
+weston_repaint_timings_create(void)
+{
+	return zalloc(sizeof(struct weston_repaint_timings));
+}
+
+WL_EXPORT void
+weston_repaint_timings_destroy(struct weston_repaint_timings *timings)
+{
+	free(timings);
+}
+
+WL_EXPORT void
+weston_output_record_repaint_stage(struct weston_output *output,
+				   enum weston_repaint_stage stage,
+				   const struct timespec *begin,
+				   const struct timespec *end)
+{
+	struct stage_history *history;
+	int64_t nsec;
+
+	if (!output->repaint_timings)
+		return;
+
+	nsec = (int64_t) (end->tv_sec - begin->tv_sec) * 1000000000 +
+		end->tv_nsec - begin->tv_nsec;
+	if (nsec < 0)
+		nsec = 0;
+	else if (nsec > UINT32_MAX)
+		nsec = UINT32_MAX;
+
+	history = &output->repaint_timings->stages[stage];
+	history->samples[history->next] = nsec;
+	history->next = (history->next + 1) % REPAINT_TIMING_WINDOW;
+	if (history->count < REPAINT_TIMING_WINDOW)
+		history->count++;
+}
+
+static int
+compare_samples(const void *a, const void *b)
+{
+	uint32_t sa = *(const uint32_t *) a, sb = *(const uint32_t *) b;
+
+	return sa < sb ? -1 : sa > sb;
+}
+
+static void
+stage_history_get_stats(const struct stage_history *history,
+			struct stage_stats *stats)
+{
+	uint32_t sorted[REPAINT_TIMING_WINDOW];
+	uint64_t sum = 0;
+	uint32_t i, n = history->count;
+
+	stats->samples = n;
+	if (n == 0) {
+		stats->min = stats->avg = stats->p99 = stats->max = 0;
+		return;
+	}
+
+	/* Before the window fills up the samples start at index 0. */
+	for (i = 0; i < n; i++) {
+		sorted[i] = history->samples[i];
+		sum += sorted[i];
+	}
+	qsort(sorted, n, sizeof sorted[0], compare_samples);
+
+	stats->min = sorted[0];
+	stats->avg = sum / n;
+	stats->p99 = sorted[(n * 99 + 99) / 100 - 1];
+	stats->max = sorted[n - 1];
+}
+
+static void
+repaint_timing_query(struct wl_client *client,
+		     struct wl_resource *resource,
+		     struct wl_resource *output_resource)
+{
+	struct weston_output *output =
+		wl_resource_get_user_data(output_resource);
+	struct stage_stats stats;
+	int i;
+
+	for (i = 0; i < WESTON_REPAINT_STAGE_COUNT; i++) {
+		if (output && output->repaint_timings)
+			stage_history_get_stats(
+				&output->repaint_timings->stages[i], &stats);
+		else
+			memset(&stats, 0, sizeof stats);
+
+		repaint_timing_send_stage(resource, i, stats.samples,
+					  stats.min, stats.avg,
+					  stats.p99, stats.max);
+	}
+
+	repaint_timing_send_done(resource);
+}
+
+static const struct repaint_timing_interface repaint_timing_implementation = {
+	repaint_timing_query
+};
+
+static void
+bind_repaint_timing(struct wl_client *client,
+		    void *data, uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &repaint_timing_interface,
+				      1, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource,
+				       &repaint_timing_implementation,
+				       data, NULL);
+}
+
+static void
+repaint_timing_debug_binding(struct weston_seat *seat, uint32_t time,
+			     uint32_t key, void *data)
+{
+	struct repaint_timing *timing = data;
+	struct weston_output *output;
+	struct stage_stats stats;
+	int i;
+
+	wl_list_for_each(output, &timing->ec->output_list, link) {
+		if (!output->repaint_timings)
+			continue;
+
+		weston_log("repaint timings for output %s, in us:\n",
+			   output->name ? output->name : "(unnamed)");
+		weston_log_continue(STAMP_SPACE "%-18s %7s %9s %9s %9s %9s\n",
+				    "stage", "samples",
+				    "min", "avg", "p99", "max");
+
+		for (i = 0; i < WESTON_REPAINT_STAGE_COUNT; i++) {
+			stage_history_get_stats(
+				&output->repaint_timings->stages[i], &stats);
+			weston_log_continue(STAMP_SPACE
+					    "%-18s %7u %9.1f %9.1f %9.1f %9.1f\n",
+					    stage_names[i], stats.samples,
+					    stats.min / 1000.0,
+					    stats.avg / 1000.0,
+					    stats.p99 / 1000.0,
+					    stats.max / 1000.0);
+		}
+	}
+}
+
+static void
+repaint_timing_destroy(struct wl_listener *listener, void *data)
+{
+	struct repaint_timing *timing =
+		container_of(listener, struct repaint_timing,
+			     destroy_listener);
+
+	wl_global_destroy(timing->global);
+	free(timing);
+}
+
+void
+repaint_timing_create(struct weston_compositor *ec)
+{
+	struct repaint_timing *timing;
+
+	timing = malloc(sizeof *timing);
+	if (timing == NULL)
+		return;
+
+	timing->ec = ec;
+	timing->global = wl_global_create(ec->wl_display,
+					  &repaint_timing_interface, 1,
+					  timing, bind_repaint_timing);
+	weston_compositor_add_debug_binding(ec, KEY_T,
+					    repaint_timing_debug_binding,
+					    timing);
+
+	timing->destroy_listener.notify = repaint_timing_destroy;
+	wl_signal_add(&ec->destroy_signal, &timing->destroy_listener);
+}
@@ -45,6 +45,8 @@ struct screenshooter {
 
 struct screenshooter_frame_listener {
 	struct wl_listener listener;
+	struct wl_listener buffer_destroy_listener;
+	struct weston_output *output;
 	struct weston_buffer *buffer;
 	struct wl_resource *resource;
 };
@@ -113,20 +115,31 @@ copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
 }
 
 static void
-screenshooter_frame_notify(struct wl_listener *listener, void *data)
+screenshooter_buffer_destroyed(struct wl_listener *listener, void *data)
 {
 	struct screenshooter_frame_listener *l =
-		container_of(listener,
-			     struct screenshooter_frame_listener, listener);
-	struct weston_output *output = data;
+		container_of(listener, struct screenshooter_frame_listener,
+			     buffer_destroy_listener);
+
+	l->buffer = NULL;
+}
+
+static void
+screenshooter_read_done(void *pixels, void *data)
+{
+	struct screenshooter_frame_listener *l = data;
+	struct weston_output *output = l->output;
 	struct weston_compositor *compositor = output->compositor;
 	int32_t stride;
-	uint8_t *pixels, *d, *s;
+	uint8_t *d, *s;
 
-	output->disable_planes--;
-	wl_list_remove(&listener->link);
-	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
-	pixels = malloc(stride * l->buffer->height);
+	/* The client went away, or no longer wants the shot */
+	if (l->buffer == NULL) {
+		free(l);
+		return;
+	}
+
+	wl_list_remove(&l->buffer_destroy_listener.link);
 
 	if (pixels == NULL) {
 		wl_resource_post_no_memory(l->resource);
@@ -134,15 +147,10 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 		return;
 	}
 
-	compositor->renderer->read_pixels(output,
-			     compositor->read_format, pixels,
-			     0, 0, output->current_mode->width,
-			     output->current_mode->height);
-
 	stride = wl_shm_buffer_get_stride(l->buffer->shm_buffer);
 
 	d = wl_shm_buffer_get_data(l->buffer->shm_buffer);
-	s = pixels + stride * (l->buffer->height - 1);
+	s = (uint8_t *) pixels + stride * (output->current_mode->height - 1);
 
 	wl_shm_buffer_begin_access(l->buffer->shm_buffer);
 
@@ -168,10 +176,38 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 	wl_shm_buffer_end_access(l->buffer->shm_buffer);
 
 	screenshooter_send_done(l->resource);
-	free(pixels);
 	free(l);
 }
 
+static void
+screenshooter_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct screenshooter_frame_listener *l =
+		container_of(listener,
+			     struct screenshooter_frame_listener, listener);
+	struct weston_output *output = data;
+	struct weston_compositor *compositor = output->compositor;
+
+	output->disable_planes--;
+	wl_list_remove(&listener->link);
+
+	/* The buffer is only filled once the pixels arrive, after the
+	 * next frame with the GL renderer. */
+	l->output = output;
+	l->buffer_destroy_listener.notify = screenshooter_buffer_destroyed;
+	wl_signal_add(&l->buffer->destroy_signal,
+		      &l->buffer_destroy_listener);
+
+	if (weston_output_read_pixels_async(output, compositor->read_format,
+					    0, 0, output->current_mode->width,
+					    output->current_mode->height,
+					    screenshooter_read_done, l) < 0) {
+		wl_list_remove(&l->buffer_destroy_listener.link);
+		wl_resource_post_no_memory(l->resource);
+		free(l);
+	}
+}
+
 static void
 screenshooter_shoot(struct wl_client *client,
 		    struct wl_resource *resource,
@@ -199,6 +235,12 @@ screenshooter_shoot(struct wl_client *client,
 	    buffer->height < output->current_mode->height)
 		return;
 
+	/* The rows are copied as they are read back */
+	if (wl_shm_buffer_get_stride(buffer->shm_buffer) !=
+	    output->current_mode->width *
+	    (PIXMAN_FORMAT_BPP(output->compositor->read_format) / 8))
+		return;
+
 	l = malloc(sizeof *l);
 	if (l == NULL) {
 		wl_resource_post_no_memory(resource);
@@ -263,13 +305,23 @@ screenshooter_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 struct weston_recorder {
 	struct weston_output *output;
 	uint32_t *frame, *rect;
-	uint32_t *tmpbuf;
 	uint32_t total;
 	int fd;
 	struct wl_listener frame_listener;
+	struct wl_list frames;
 	int count, destroying;
 };
 
+/* The damage of a frame that is being read back.  The rectangles are
+ * written out in order as their pixels arrive; those that could not be
+ * read are written as unchanged. */
+struct weston_recorder_frame {
+	struct wl_list link;
+	uint32_t msecs;
+	int nrects, issued, written, issuing;
+	pixman_box32_t *rects;
+};
+
 static uint32_t *
 output_run(uint32_t *p, uint32_t delta, int run)
 {
@@ -305,31 +357,130 @@ static void
 weston_recorder_destroy(struct weston_recorder *recorder);
 
 static void
-weston_recorder_frame_notify(struct wl_listener *listener, void *data)
+weston_recorder_write_rect(struct weston_recorder *recorder,
+			   struct weston_recorder_frame *frame,
+			   uint32_t *pixels)
 {
-	struct weston_recorder *recorder =
-		container_of(listener, struct weston_recorder, frame_listener);
-	struct weston_output *output = data;
+	struct weston_output *output = recorder->output;
 	struct weston_compositor *compositor = output->compositor;
-	uint32_t msecs = output->frame_time;
-	pixman_box32_t *r;
-	pixman_region32_t damage, transformed_damage;
-	int i, j, k, n, width, height, run, stride;
+	pixman_box32_t *r = &frame->rects[frame->written];
+	int j, k, width, height, run, stride, y_orig, do_yflip;
 	uint32_t delta, prev, *d, *s, *p, next;
 	struct {
 		uint32_t msecs;
 		uint32_t nrects;
 	} header;
 	struct iovec v[2];
+
+	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+
+	if (frame->written == 0) {
+		header.msecs = frame->msecs;
+		header.nrects = frame->nrects;
+		v[0].iov_base = &header;
+		v[0].iov_len = sizeof header;
+		v[1].iov_base = frame->rects;
+		v[1].iov_len = frame->nrects * sizeof *frame->rects;
+		recorder->total += writev(recorder->fd, v, 2);
+	}
+
+	stride = output->current_mode->width;
+	width = r->x2 - r->x1;
+	height = r->y2 - r->y1;
+
+	s = pixels;
+	p = recorder->rect;
+	run = prev = 0; /* quiet gcc */
+	for (j = 0; j < height; j++) {
+		if (do_yflip)
+			y_orig = r->y2 - j - 1;
+		else
+			y_orig = r->y1 + j;
+		d = recorder->frame + stride * y_orig + r->x1;
+
+		for (k = 0; k < width; k++) {
+			next = s ? *s++ : *d;
+			delta = component_delta(next, *d);
+			*d++ = next;
+			if (run == 0 || delta == prev) {
+				run++;
+			} else {
+				p = output_run(p, prev, run);
+				run = 1;
+			}
+			prev = delta;
+		}
+	}
+
+	p = output_run(p, prev, run);
+
+	recorder->total += write(recorder->fd,
+				 recorder->rect, (p - recorder->rect) * 4);
+
+#if 0
+	fprintf(stderr,
+		"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
+		width, height, r->x1, r->y1,
+		width * height * 4, (int) (p - recorder->rect) * 4,
+		(float) (p - recorder->rect) / (width * height),
+		recorder->total / 1024 / 1024);
+#endif
+
+	frame->written++;
+}
+
+/* Finish the frames at the head of the queue whose reads are all done.
+ * Once the recorder is stopped and nothing is left, destroy it. */
+static void
+weston_recorder_flush(struct weston_recorder *recorder)
+{
+	struct weston_recorder_frame *frame, *next;
+
+	wl_list_for_each_safe(frame, next, &recorder->frames, link) {
+		if (frame->issuing || frame->written < frame->issued)
+			return;
+
+		while (frame->written < frame->nrects)
+			weston_recorder_write_rect(recorder, frame, NULL);
+
+		wl_list_remove(&frame->link);
+		free(frame);
+	}
+
+	if (recorder->destroying &&
+	    wl_list_empty(&recorder->frame_listener.link))
+		weston_recorder_destroy(recorder);
+}
+
+static void
+weston_recorder_read_done(void *pixels, void *data)
+{
+	struct weston_recorder *recorder = data;
+	struct weston_recorder_frame *frame;
+
+	/* Reads complete in the order they were issued */
+	frame = container_of(recorder->frames.next,
+			     struct weston_recorder_frame, link);
+	weston_recorder_write_rect(recorder, frame, pixels);
+
+	weston_recorder_flush(recorder);
+}
+
+static void
+weston_recorder_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct weston_recorder *recorder =
+		container_of(listener, struct weston_recorder, frame_listener);
+	struct weston_output *output = data;
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_recorder_frame *frame;
+	pixman_box32_t *r;
+	pixman_region32_t damage, transformed_damage;
+	int i, n, width, height;
 	int do_yflip;
 	int y_orig;
-	uint32_t *outbuf;
 
 	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
-	if (do_yflip)
-		outbuf = recorder->rect;
-	else
-		outbuf = recorder->tmpbuf;
 
 	pixman_region32_init(&damage);
 	pixman_region32_init(&transformed_damage);
@@ -342,77 +493,52 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 	pixman_region32_fini(&damage);
 
 	r = pixman_region32_rectangles(&transformed_damage, &n);
-	if (n == 0) {
-		pixman_region32_fini(&transformed_damage);
-		return;
-	}
-
-	header.msecs = msecs;
-	header.nrects = n;
-	v[0].iov_base = &header;
-	v[0].iov_len = sizeof header;
-	v[1].iov_base = r;
-	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current_mode->width;
-
-	for (i = 0; i < n; i++) {
-		width = r[i].x2 - r[i].x1;
-		height = r[i].y2 - r[i].y1;
-
-		if (do_yflip)
-			y_orig = output->current_mode->height - r[i].y2;
-		else
-			y_orig = r[i].y1;
+	frame = NULL;
+	if (n > 0)
+		frame = malloc(sizeof *frame + n * sizeof *r);
+
+	if (frame) {
+		frame->rects = (pixman_box32_t *) (frame + 1);
+		memcpy(frame->rects, r, n * sizeof *r);
+		frame->msecs = output->frame_time;
+		frame->nrects = n;
+		frame->issued = 0;
+		frame->written = 0;
+		frame->issuing = 1;
+		wl_list_insert(recorder->frames.prev, &frame->link);
+
+		/* The pixels arrive a frame later, so reading them back
+		 * does not wait for this one to be drawn. */
+		for (i = 0; i < n; i++) {
+			width = r[i].x2 - r[i].x1;
+			height = r[i].y2 - r[i].y1;
 
-		compositor->renderer->read_pixels(output,
-				compositor->read_format, recorder->rect,
-				r[i].x1, y_orig, width, height);
-
-		s = recorder->rect;
-		p = outbuf;
-		run = prev = 0; /* quiet gcc */
-		for (j = 0; j < height; j++) {
 			if (do_yflip)
-				y_orig = r[i].y2 - j - 1;
+				y_orig = output->current_mode->height - r[i].y2;
 			else
-				y_orig = r[i].y1 + j;
-			d = recorder->frame + stride * y_orig + r[i].x1;
-
-			for (k = 0; k < width; k++) {
-				next = *s++;
-				delta = component_delta(next, *d);
-				*d++ = next;
-				if (run == 0 || delta == prev) {
-					run++;
-				} else {
-					p = output_run(p, prev, run);
-					run = 1;
-				}
-				prev = delta;
-			}
+				y_orig = r[i].y1;
+
+			if (weston_output_read_pixels_async(output,
+					compositor->read_format,
+					r[i].x1, y_orig, width, height,
+					weston_recorder_read_done,
+					recorder) < 0)
+				break;
+			frame->issued++;
 		}
 
-		p = output_run(p, prev, run);
-
-		recorder->total += write(recorder->fd,
-					 outbuf, (p - outbuf) * 4);
-
-#if 0
-		fprintf(stderr,
-			"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
-			width, height, r[i].x1, r[i].y1,
-			width * height * 4, (int) (p - outbuf) * 4,
-			(float) (p - outbuf) / (width * height),
-			recorder->total / 1024 / 1024);
-#endif
+		frame->issuing = 0;
+		recorder->count++;
 	}
 
 	pixman_region32_fini(&transformed_damage);
-	recorder->count++;
 
-	if (recorder->destroying)
-		weston_recorder_destroy(recorder);
+	if (recorder->destroying) {
+		wl_list_remove(&listener->link);
+		wl_list_init(&listener->link);
+	}
+
+	weston_recorder_flush(recorder);
 }
 
 static void
@@ -422,9 +548,6 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	struct weston_recorder *recorder;
 	int stride, size;
 	struct { uint32_t magic, format, width, height; } header;
-	int do_yflip;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
 
 	recorder = malloc(sizeof *recorder);
 
@@ -441,11 +564,7 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	recorder->count = 0;
 	recorder->destroying = 0;
 	recorder->output = output;
-
-	if (do_yflip)
-		recorder->tmpbuf = NULL;
-	else
-		recorder->tmpbuf = malloc(size);
+	wl_list_init(&recorder->frames);
 
 	header.magic = WCAP_HEADER_MAGIC;
 
@@ -460,7 +579,6 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	default:
 		weston_log("unknown recorder format\n");
 		free(recorder->rect);
-		free(recorder->tmpbuf);
 		free(recorder->frame);
 		free(recorder);
 		return;
@@ -472,7 +590,6 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	if (recorder->fd < 0) {
 		weston_log("problem opening output file %s: %m\n", filename);
 		free(recorder->rect);
-		free(recorder->tmpbuf);
 		free(recorder->frame);
 		free(recorder);
 		return;
@@ -493,7 +610,6 @@ weston_recorder_destroy(struct weston_recorder *recorder)
 {
 	wl_list_remove(&recorder->frame_listener.link);
 	close(recorder->fd);
-	free(recorder->tmpbuf);
 	free(recorder->frame);
 	free(recorder->rect);
 	recorder->output->disable_planes--;
@@ -0,0 +1,329 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <wayland-server.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "shm-convert.h"
+
+WL_EXPORT int
+shm_convert_supported(uint32_t format)
+{
+	switch (format) {
+	case WL_SHM_FORMAT_NV12:
+	case WL_SHM_FORMAT_YUYV:
+	case WL_SHM_FORMAT_XRGB2101010:
+	case WL_SHM_FORMAT_ARGB2101010:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+WL_EXPORT int
+shm_convert_has_alpha(uint32_t format)
+{
+	return format == WL_SHM_FORMAT_ARGB2101010;
+}
+
+static inline uint32_t
+clamp_byte(int32_t v)
+{
+	if (v < 0)
+		return 0;
+	if (v > 255)
+		return 255;
+	return v;
+}
+
+static inline uint32_t
+yuv_to_xrgb(int32_t y, int32_t u, int32_t v)
+{
+	int32_t c = y - 16, d = u - 128, e = v - 128;
+	uint32_t r, g, b;
+
+	r = clamp_byte((298 * c + 409 * e + 128) >> 8);
+	g = clamp_byte((298 * c - 100 * d - 208 * e + 128) >> 8);
+	b = clamp_byte((298 * c + 516 * d + 128) >> 8);
+
+	return 0xff000000 | r << 16 | g << 8 | b;
+}
+
+void
+shm_convert_nv12_row_scalar(uint32_t *dst, const uint8_t *y,
+			    const uint8_t *uv, int32_t x, int32_t width)
+{
+	int32_t i, c;
+
+	for (i = x; i < x + width; i++) {
+		c = i & ~1;
+		dst[i] = yuv_to_xrgb(y[i], uv[c], uv[c + 1]);
+	}
+}
+
+void
+shm_convert_yuyv_row_scalar(uint32_t *dst, const uint8_t *yuyv,
+			    int32_t x, int32_t width)
+{
+	int32_t i, m;
+
+	for (i = x; i < x + width; i++) {
+		m = (i & ~1) * 2;
+		dst[i] = yuv_to_xrgb(yuyv[i * 2], yuyv[m + 1], yuyv[m + 3]);
+	}
+}
+
+void
+shm_convert_2101010_row_scalar(uint32_t *dst, const uint32_t *src,
+			       int32_t x, int32_t width, int alpha)
+{
+	uint32_t p, a;
+	int32_t i;
+
+	for (i = x; i < x + width; i++) {
+		p = src[i];
+		a = alpha ? (p >> 30) * 0x55 : 0xff;
+		dst[i] = a << 24 |
+			 ((p >> 6) & 0x00ff0000) |
+			 ((p >> 4) & 0x0000ff00) |
+			 ((p >> 2) & 0x000000ff);
+	}
+}
+
+#ifdef __SSE2__
+
+/* Eight pixels from eight luma samples and the four CbCr pairs covering
+ * them, as 16-bit lanes Y0..Y7 and U0 V0 U1 V1 U2 V2 U3 V3.  The sums
+ * are done in 32 bits with pmaddwd, so this rounds and clamps exactly
+ * like yuv_to_xrgb(). */
+static inline void
+yuv_to_xrgb_sse2(uint32_t *dst, __m128i y16, __m128i uv16)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i k_r = _mm_setr_epi16(298, 409, 298, 409,
+					   298, 409, 298, 409);
+	const __m128i k_g = _mm_setr_epi16(298, -208, 298, -208,
+					   298, -208, 298, -208);
+	const __m128i k_gu = _mm_setr_epi16(-100, 0, -100, 0,
+					    -100, 0, -100, 0);
+	const __m128i k_b = _mm_setr_epi16(298, 516, 298, 516,
+					   298, 516, 298, 516);
+	const __m128i round = _mm_set1_epi32(128);
+	const __m128i alpha = _mm_set1_epi8((char) 0xff);
+	__m128i c, d, e, ce, cd, d0, r[2], g[2], b[2], r8, g8, b8, bg, ra;
+	int i;
+
+	c = _mm_sub_epi16(y16, _mm_set1_epi16(16));
+	uv16 = _mm_sub_epi16(uv16, _mm_set1_epi16(128));
+	d = _mm_shufflelo_epi16(uv16, _MM_SHUFFLE(2, 2, 0, 0));
+	d = _mm_shufflehi_epi16(d, _MM_SHUFFLE(2, 2, 0, 0));
+	e = _mm_shufflelo_epi16(uv16, _MM_SHUFFLE(3, 3, 1, 1));
+	e = _mm_shufflehi_epi16(e, _MM_SHUFFLE(3, 3, 1, 1));
+
+	for (i = 0; i < 2; i++) {
+		if (i == 0) {
+			ce = _mm_unpacklo_epi16(c, e);
+			cd = _mm_unpacklo_epi16(c, d);
+			d0 = _mm_unpacklo_epi16(d, zero);
+		} else {
+			ce = _mm_unpackhi_epi16(c, e);
+			cd = _mm_unpackhi_epi16(c, d);
+			d0 = _mm_unpackhi_epi16(d, zero);
+		}
+
+		r[i] = _mm_add_epi32(_mm_madd_epi16(ce, k_r), round);
+		g[i] = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(ce, k_g),
+						   _mm_madd_epi16(d0, k_gu)),
+				     round);
+		b[i] = _mm_add_epi32(_mm_madd_epi16(cd, k_b), round);
+
+		r[i] = _mm_srai_epi32(r[i], 8);
+		g[i] = _mm_srai_epi32(g[i], 8);
+		b[i] = _mm_srai_epi32(b[i], 8);
+	}
+
+	r8 = _mm_packs_epi32(r[0], r[1]);
+	g8 = _mm_packs_epi32(g[0], g[1]);
+	b8 = _mm_packs_epi32(b[0], b[1]);
+	r8 = _mm_packus_epi16(r8, r8);
+	g8 = _mm_packus_epi16(g8, g8);
+	b8 = _mm_packus_epi16(b8, b8);
+
+	bg = _mm_unpacklo_epi8(b8, g8);
+	ra = _mm_unpacklo_epi8(r8, alpha);
+	_mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128((__m128i *) (dst + 4), _mm_unpackhi_epi16(bg, ra));
+}
+
+/* The SIMD loops start on an even pixel, so that the pixels of a chroma
+ * sample are converted together, and leave the rest to the scalar
+ * kernels. */
+void
+shm_convert_nv12_row(uint32_t *dst, const uint8_t *y, const uint8_t *uv,
+		     int32_t x, int32_t width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int32_t end = x + width;
+	__m128i y16, uv16;
+
+	if (x & 1 && width > 0) {
+		shm_convert_nv12_row_scalar(dst, y, uv, x, 1);
+		x++;
+	}
+
+	for (; x + 8 <= end; x += 8) {
+		y16 = _mm_loadl_epi64((const __m128i *) (y + x));
+		uv16 = _mm_loadl_epi64((const __m128i *) (uv + x));
+		yuv_to_xrgb_sse2(dst + x,
+				 _mm_unpacklo_epi8(y16, zero),
+				 _mm_unpacklo_epi8(uv16, zero));
+	}
+
+	if (x < end)
+		shm_convert_nv12_row_scalar(dst, y, uv, x, end - x);
+}
+
+void
+shm_convert_yuyv_row(uint32_t *dst, const uint8_t *yuyv,
+		     int32_t x, int32_t width)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	int32_t end = x + width;
+	__m128i v;
+
+	if (x & 1 && width > 0) {
+		shm_convert_yuyv_row_scalar(dst, yuyv, x, 1);
+		x++;
+	}
+
+	/* As 16-bit lanes, Y0 U0 Y1 V0 ... is Y in the low bytes and
+	 * the CbCr pairs in the high bytes. */
+	for (; x + 8 <= end; x += 8) {
+		v = _mm_loadu_si128((const __m128i *) (yuyv + x * 2));
+		yuv_to_xrgb_sse2(dst + x, _mm_and_si128(v, mask),
+				 _mm_srli_epi16(v, 8));
+	}
+
+	if (x < end)
+		shm_convert_yuyv_row_scalar(dst, yuyv, x, end - x);
+}
+
+void
+shm_convert_2101010_row(uint32_t *dst, const uint32_t *src,
+			int32_t x, int32_t width, int alpha)
+{
+	const __m128i r_mask = _mm_set1_epi32(0x00ff0000);
+	const __m128i g_mask = _mm_set1_epi32(0x0000ff00);
+	const __m128i b_mask = _mm_set1_epi32(0x000000ff);
+	const __m128i opaque = _mm_set1_epi32(0xff000000);
+	int32_t end = x + width;
+	__m128i p, a, out;
+
+	for (; x + 4 <= end; x += 4) {
+		p = _mm_loadu_si128((const __m128i *) (src + x));
+		out = _mm_or_si128(
+			_mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 6), r_mask),
+				     _mm_and_si128(_mm_srli_epi32(p, 4), g_mask)),
+			_mm_and_si128(_mm_srli_epi32(p, 2), b_mask));
+
+		if (alpha) {
+			/* a * 0x55 replicates the two bits */
+			a = _mm_srli_epi32(p, 30);
+			a = _mm_or_si128(a, _mm_slli_epi32(a, 2));
+			a = _mm_or_si128(a, _mm_slli_epi32(a, 4));
+			out = _mm_or_si128(out, _mm_slli_epi32(a, 24));
+		} else {
+			out = _mm_or_si128(out, opaque);
+		}
+
+		_mm_storeu_si128((__m128i *) (dst + x), out);
+	}
+
+	if (x < end)
+		shm_convert_2101010_row_scalar(dst, src, x, end - x, alpha);
+}
+
+#else
+
+void
+shm_convert_nv12_row(uint32_t *dst, const uint8_t *y, const uint8_t *uv,
+		     int32_t x, int32_t width)
+{
+	shm_convert_nv12_row_scalar(dst, y, uv, x, width);
+}
+
+void
+shm_convert_yuyv_row(uint32_t *dst, const uint8_t *yuyv,
+		     int32_t x, int32_t width)
+{
+	shm_convert_yuyv_row_scalar(dst, yuyv, x, width);
+}
+
+void
+shm_convert_2101010_row(uint32_t *dst, const uint32_t *src,
+			int32_t x, int32_t width, int alpha)
+{
+	shm_convert_2101010_row_scalar(dst, src, x, width, alpha);
+}
+
+#endif
+
+WL_EXPORT void
+shm_convert_box(uint32_t format, const void *src, int32_t src_stride,
+		int32_t src_height, void *dst, int32_t dst_stride,
+		const pixman_box32_t *box)
+{
+	const uint8_t *s = src;
+	const uint8_t *chroma = s + src_stride * src_height;
+	uint8_t *d = dst;
+	int32_t width = box->x2 - box->x1;
+	uint32_t *row;
+	int32_t y;
+
+	if (width <= 0)
+		return;
+
+	for (y = box->y1; y < box->y2; y++) {
+		row = (uint32_t *) (d + y * dst_stride);
+
+		switch (format) {
+		case WL_SHM_FORMAT_NV12:
+			shm_convert_nv12_row(row, s + y * src_stride,
+					     chroma + y / 2 * src_stride,
+					     box->x1, width);
+			break;
+		case WL_SHM_FORMAT_YUYV:
+			shm_convert_yuyv_row(row, s + y * src_stride,
+					     box->x1, width);
+			break;
+		case WL_SHM_FORMAT_XRGB2101010:
+		case WL_SHM_FORMAT_ARGB2101010:
+			shm_convert_2101010_row(row, (const uint32_t *)
+						(s + y * src_stride),
+						box->x1, width,
+						shm_convert_has_alpha(format));
+			break;
+		}
+	}
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef _WESTON_SHM_CONVERT_H
+#define _WESTON_SHM_CONVERT_H
+
+#include <stdint.h>
+#include <pixman.h>
+
+/*
+ * Conversion of the shm formats that the renderers cannot sample
+ * directly into 32-bit xRGB or premultiplied ARGB, so that only the
+ * damaged part of a buffer needs converting into a cached RGB copy.
+ *
+ * YUV formats are BT.601 limited range, with each chroma sample used for
+ * the pixels it covers.  NV12 stores its interleaved CbCr plane right
+ * after the luma plane, with the same stride.  The 10-bit formats keep
+ * the top 8 bits of each channel.
+ *
+ * The row kernels convert 'width' pixels starting at pixel 'x' of a
+ * row, with all pointers at the start of their row.  They use SSE2
+ * where the compiler targets it; the _scalar variants are the portable
+ * versions, which the SIMD ones must match exactly.
+ */
+
+int
+shm_convert_supported(uint32_t format);
+
+int
+shm_convert_has_alpha(uint32_t format);
+
+void
+shm_convert_box(uint32_t format, const void *src, int32_t src_stride,
+		int32_t src_height, void *dst, int32_t dst_stride,
+		const pixman_box32_t *box);
+
+void
+shm_convert_nv12_row(uint32_t *dst, const uint8_t *y, const uint8_t *uv,
+		     int32_t x, int32_t width);
+
+void
+shm_convert_yuyv_row(uint32_t *dst, const uint8_t *yuyv,
+		     int32_t x, int32_t width);
+
+void
+shm_convert_2101010_row(uint32_t *dst, const uint32_t *src,
+			int32_t x, int32_t width, int alpha);
+
+void
+shm_convert_nv12_row_scalar(uint32_t *dst, const uint8_t *y,
+			    const uint8_t *uv, int32_t x, int32_t width);
+
+void
+shm_convert_yuyv_row_scalar(uint32_t *dst, const uint8_t *yuyv,
+			    int32_t x, int32_t width);
+
+void
+shm_convert_2101010_row_scalar(uint32_t *dst, const uint32_t *src,
+			       int32_t x, int32_t width, int alpha);
+
+#endif
@@ -0,0 +1,383 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "tile-damage.h"
+
+void
+tile_damage_init(struct tile_damage *td)
+{
+	memset(td, 0, sizeof *td);
+}
+
+void
+tile_damage_release(struct tile_damage *td)
+{
+	free(td->bits);
+	free(td->boxes);
+	memset(td, 0, sizeof *td);
+}
+
+static int32_t
+tile_floor(int32_t v, int shift)
+{
+	return (int32_t) ((int64_t) v >> shift);
+}
+
+static int32_t
+tile_ceil(int32_t v, int shift)
+{
+	return (int32_t) (((int64_t) v + (1 << shift) - 1) >> shift);
+}
+
+/* Set up an empty bitmap covering 'bounds'.  Damage outside of the bounds
+ * is dropped. */
+int
+tile_damage_reset(struct tile_damage *td, const pixman_box32_t *bounds)
+{
+	int64_t columns, rows;
+	uint32_t words;
+	uint64_t *bits;
+	int shift = TILE_DAMAGE_MIN_SHIFT;
+
+	td->bounds = *bounds;
+	if (bounds->x2 <= bounds->x1 || bounds->y2 <= bounds->y1) {
+		td->columns = td->rows = td->stride = 0;
+		return 0;
+	}
+
+	for (;;) {
+		columns = tile_ceil(bounds->x2, shift) -
+			  tile_floor(bounds->x1, shift);
+		rows = tile_ceil(bounds->y2, shift) -
+		       tile_floor(bounds->y1, shift);
+		if (columns * rows <= TILE_DAMAGE_MAX_TILES)
+			break;
+		shift++;
+	}
+
+	td->tile_shift = shift;
+	td->x = tile_floor(bounds->x1, shift) << shift;
+	td->y = tile_floor(bounds->y1, shift) << shift;
+	td->columns = columns;
+	td->rows = rows;
+	td->stride = (columns + 63) / 64;
+
+	words = td->stride * td->rows;
+	if (words > td->bits_alloc) {
+		bits = realloc(td->bits, words * sizeof *bits);
+		if (bits == NULL) {
+			td->columns = td->rows = td->stride = 0;
+			return -1;
+		}
+		td->bits = bits;
+		td->bits_alloc = words;
+	}
+	memset(td->bits, 0, words * sizeof *td->bits);
+
+	return 0;
+}
+
+static void
+set_bits(uint64_t *row, int32_t c1, int32_t c2)
+{
+	int32_t w1 = c1 / 64, w2 = (c2 - 1) / 64, w;
+	uint64_t first = ~0ULL << (c1 % 64);
+	uint64_t last = ~0ULL >> (63 - (c2 - 1) % 64);
+
+	if (w1 == w2) {
+		row[w1] |= first & last;
+		return;
+	}
+
+	row[w1] |= first;
+	for (w = w1 + 1; w < w2; w++)
+		row[w] = ~0ULL;
+	row[w2] |= last;
+}
+
+void
+tile_damage_add_box(struct tile_damage *td, const pixman_box32_t *box)
+{
+	int32_t x1, y1, x2, y2, c1, c2, r1, r2, r;
+	int shift = td->tile_shift;
+
+	x1 = box->x1 > td->bounds.x1 ? box->x1 : td->bounds.x1;
+	y1 = box->y1 > td->bounds.y1 ? box->y1 : td->bounds.y1;
+	x2 = box->x2 < td->bounds.x2 ? box->x2 : td->bounds.x2;
+	y2 = box->y2 < td->bounds.y2 ? box->y2 : td->bounds.y2;
+	if (x1 >= x2 || y1 >= y2 || td->columns == 0)
+		return;
+
+	c1 = (x1 - td->x) >> shift;
+	c2 = ((x2 - td->x - 1) >> shift) + 1;
+	r1 = (y1 - td->y) >> shift;
+	r2 = ((y2 - td->y - 1) >> shift) + 1;
+
+	for (r = r1; r < r2; r++)
+		set_bits(td->bits + r * td->stride, c1, c2);
+}
+
+void
+tile_damage_add_region(struct tile_damage *td, pixman_region32_t *region)
+{
+	pixman_box32_t *rects;
+	int i, n;
+
+	rects = pixman_region32_rectangles(region, &n);
+	for (i = 0; i < n; i++)
+		tile_damage_add_box(td, &rects[i]);
+}
+
+/* Find the next run of set bits at or after column 'c' in a row.  Returns
+ * 0 when there is none. */
+static int
+next_span(const struct tile_damage *td, const uint64_t *row, int32_t c,
+	  int32_t *start, int32_t *end)
+{
+	int32_t w;
+	uint64_t word;
+
+	while (c < td->columns) {
+		w = c / 64;
+		word = row[w] & (~0ULL << (c % 64));
+		if (word == 0) {
+			c = (w + 1) * 64;
+			continue;
+		}
+		c = w * 64 + __builtin_ctzll(word);
+		*start = c;
+
+		/* Extend over the run of set bits. */
+		for (;;) {
+			w = c / 64;
+			word = ~row[w] & (~0ULL << (c % 64));
+			if (word != 0) {
+				c = w * 64 + __builtin_ctzll(word);
+				break;
+			}
+			c = (w + 1) * 64;
+			if (c >= td->columns)
+				break;
+		}
+		*end = c < td->columns ? c : td->columns;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+ensure_boxes(struct tile_damage *td, uint32_t count)
+{
+	pixman_box32_t *boxes;
+	uint32_t alloc;
+
+	if (count <= td->boxes_alloc)
+		return 0;
+
+	alloc = td->boxes_alloc ? td->boxes_alloc : 64;
+	while (alloc < count)
+		alloc *= 2;
+
+	boxes = realloc(td->boxes, alloc * sizeof *boxes);
+	if (boxes == NULL)
+		return -1;
+
+	td->boxes = boxes;
+	td->boxes_alloc = alloc;
+
+	return 0;
+}
+
+static void
+tile_box(const struct tile_damage *td, pixman_box32_t *box,
+	 int32_t c1, int32_t r1, int32_t c2, int32_t r2)
+{
+	int shift = td->tile_shift;
+
+	box->x1 = td->x + (c1 << shift);
+	box->y1 = td->y + (r1 << shift);
+	box->x2 = td->x + (c2 << shift);
+	box->y2 = td->y + (r2 << shift);
+
+	/* Tiles on the edges may stick out of the bounds. */
+	if (box->x1 < td->bounds.x1)
+		box->x1 = td->bounds.x1;
+	if (box->y1 < td->bounds.y1)
+		box->y1 = td->bounds.y1;
+	if (box->x2 > td->bounds.x2)
+		box->x2 = td->bounds.x2;
+	if (box->y2 > td->bounds.y2)
+		box->y2 = td->bounds.y2;
+}
+
+/*
+ * Turn the tile rows into y-x banded boxes.  With 'rows_per_band' == 1 and
+ * 'coarse' unset, every run of tiles becomes a box and identical
+ * neighbouring rows are merged.  'coarse' collapses each band to a single
+ * box from its leftmost to its rightmost tile.  Returns the box count, or
+ * -1 if more than 'max_boxes' would be needed.
+ */
+static int
+collect_boxes(struct tile_damage *td, int32_t rows_per_band, int coarse,
+	      int max_boxes)
+{
+	int32_t r, rr, r_end, c, start, end, left, right;
+	int count = 0, band_start = 0, band_count = 0, i, same;
+	const uint64_t *row;
+	pixman_box32_t box;
+
+	for (r = 0; r < td->rows; r += rows_per_band) {
+		r_end = r + rows_per_band;
+		if (r_end > td->rows)
+			r_end = td->rows;
+
+		if (coarse) {
+			left = td->columns;
+			right = 0;
+			for (rr = r; rr < r_end; rr++) {
+				row = td->bits + rr * td->stride;
+				c = 0;
+				while (next_span(td, row, c, &start, &end)) {
+					if (start < left)
+						left = start;
+					if (end > right)
+						right = end;
+					c = end;
+				}
+			}
+			if (left >= right) {
+				band_count = 0;
+				continue;
+			}
+
+			tile_box(td, &box, left, r, right, r_end);
+			if (band_count == 1 &&
+			    td->boxes[band_start].x1 == box.x1 &&
+			    td->boxes[band_start].x2 == box.x2 &&
+			    td->boxes[band_start].y2 == box.y1) {
+				td->boxes[band_start].y2 = box.y2;
+				continue;
+			}
+
+			if (count + 1 > max_boxes || ensure_boxes(td, count + 1))
+				return -1;
+			td->boxes[count] = box;
+			band_start = count++;
+			band_count = 1;
+			continue;
+		}
+
+		/* Does this row repeat the previous band exactly? */
+		row = td->bits + r * td->stride;
+		same = band_count > 0;
+		c = 0;
+		for (i = 0; same && i < band_count; i++) {
+			if (!next_span(td, row, c, &start, &end)) {
+				same = 0;
+				break;
+			}
+			tile_box(td, &box, start, r, end, r_end);
+			if (box.x1 != td->boxes[band_start + i].x1 ||
+			    box.x2 != td->boxes[band_start + i].x2 ||
+			    box.y1 != td->boxes[band_start + i].y2)
+				same = 0;
+			c = end;
+		}
+		if (same && next_span(td, row, c, &start, &end))
+			same = 0;
+
+		if (same) {
+			tile_box(td, &box, 0, r, 1, r_end);
+			for (i = 0; i < band_count; i++)
+				td->boxes[band_start + i].y2 = box.y2;
+			continue;
+		}
+
+		band_start = count;
+		band_count = 0;
+		c = 0;
+		while (next_span(td, row, c, &start, &end)) {
+			if (count + 1 > max_boxes || ensure_boxes(td, count + 1))
+				return -1;
+			tile_box(td, &td->boxes[count++], start, r, end, r_end);
+			band_count++;
+			c = end;
+		}
+	}
+
+	return count;
+}
+
+/* Replace 'region' with the damaged tiles, using at most 'max_rects'
+ * rectangles.  Detail is given up step by step: first every run of tiles
+ * is kept, then each tile row becomes one rectangle, and finally rows are
+ * grouped into at most 'max_rects' bands. */
+int
+tile_damage_to_region(struct tile_damage *td, pixman_region32_t *region,
+		      int max_rects)
+{
+	int32_t rows_per_band;
+	int count;
+
+	if (max_rects < 1)
+		max_rects = 1;
+
+	count = collect_boxes(td, 1, 0, max_rects);
+	if (count < 0)
+		count = collect_boxes(td, 1, 1, max_rects);
+	if (count < 0) {
+		rows_per_band = (td->rows + max_rects - 1) / max_rects;
+		count = collect_boxes(td, rows_per_band, 1, max_rects);
+	}
+	if (count < 0)
+		return -1;
+
+	pixman_region32_fini(region);
+	if (!pixman_region32_init_rects(region, td->boxes, count))
+		return -1;
+
+	return count;
+}
+
+/* Coarsen 'region' in place if it has more than 'max_rects' rectangles.
+ * The result covers at least the original region. */
+int
+tile_damage_simplify(struct tile_damage *td, pixman_region32_t *region,
+		     int max_rects)
+{
+	pixman_box32_t extents;
+
+	if (pixman_region32_n_rects(region) <= max_rects)
+		return 0;
+
+	extents = *pixman_region32_extents(region);
+	if (tile_damage_reset(td, &extents) < 0)
+		return -1;
+
+	tile_damage_add_region(td, region);
+
+	return tile_damage_to_region(td, region, max_rects) < 0 ? -1 : 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef _WESTON_TILE_DAMAGE_H
+#define _WESTON_TILE_DAMAGE_H
+
+#include <stdint.h>
+#include <pixman.h>
+
+/*
+ * Damage tracked as a bitmap of fixed-size tiles rather than as a list of
+ * rectangles.  Adding a rectangle costs the same no matter how many are
+ * already there, which keeps clients that post hundreds of small damage
+ * rectangles from making region operations quadratic.
+ *
+ * The tiles are 64x64 unless the bounds are so large that the bitmap
+ * would exceed TILE_DAMAGE_MAX_TILES, in which case the tile size is
+ * doubled until it fits.  Converting back to a region only ever grows
+ * the damage, never shrinks it.
+ */
+
+#define TILE_DAMAGE_MIN_SHIFT	6
+#define TILE_DAMAGE_MAX_TILES	16384
+
+struct tile_damage {
+	pixman_box32_t bounds;
+	int32_t x, y;			/* origin of tile (0, 0) */
+	int tile_shift;			/* tile size is 1 << tile_shift */
+	int32_t columns, rows;
+	int32_t stride;			/* 64-bit words per row */
+	uint64_t *bits;
+	uint32_t bits_alloc;		/* in words */
+
+	pixman_box32_t *boxes;
+	uint32_t boxes_alloc;
+};
+
+void
+tile_damage_init(struct tile_damage *td);
+
+void
+tile_damage_release(struct tile_damage *td);
+
+int
+tile_damage_reset(struct tile_damage *td, const pixman_box32_t *bounds);
+
+void
+tile_damage_add_box(struct tile_damage *td, const pixman_box32_t *box);
+
+void
+tile_damage_add_region(struct tile_damage *td, pixman_region32_t *region);
+
+int
+tile_damage_to_region(struct tile_damage *td, pixman_region32_t *region,
+		      int max_rects);
+
+int
+tile_damage_simplify(struct tile_damage *td, pixman_region32_t *region,
+		     int max_rects);
+
+#endif
@@ -0,0 +1,266 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/input.h>
+
+#include "compositor.h"
+#include "weston-trace.h"
+
+/* Records per thread; must be a power of two. */
+#define TRACE_RING_SIZE 65536
+
+/* SIGUSR1 and SIGUSR2 are taken by VT switching and logind. */
+#define TRACE_DUMP_SIGNAL (SIGRTMIN + 1)
+
+struct trace_ring {
+	struct trace_ring *next;
+	uint32_t thread_id;
+	/* Total number of records ever added.  Written only by the owning
+	 * thread, read by the dumper. */
+	uint64_t head;
+	struct weston_trace_record records[TRACE_RING_SIZE];
+};
+
+struct weston_trace {
+	struct weston_compositor *compositor;
+	char *filename;
+	struct wl_event_source *dump_source;
+	struct wl_listener destroy_listener;
+};
+
+WL_EXPORT int weston_trace_enabled;
+
+static struct trace_ring *trace_rings;
+static __thread struct trace_ring *thread_ring;
+
+static struct trace_ring *
+trace_ring_create(void)
+{
+	struct trace_ring *ring;
+
+	ring = zalloc(sizeof *ring);
+	if (ring == NULL)
+		return NULL;
+
+	ring->thread_id = syscall(SYS_gettid);
+
+	/* Rings are never freed, so a plain lock-free push is enough. */
+	ring->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&trace_rings, &ring->next, ring,
+					    1, __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+		;
+
+	return ring;
+}
+
+WL_EXPORT void
+weston_trace_add(uint32_t event, uint32_t arg0, uint64_t arg1, uint64_t arg2)
+{
+	struct trace_ring *ring = thread_ring;
+	struct weston_trace_record *r;
+	struct timespec ts;
+	uint64_t head;
+
+	if (ring == NULL) {
+		ring = thread_ring = trace_ring_create();
+		if (ring == NULL) {
+			weston_trace_enabled = 0;
+			return;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	head = ring->head;
+	r = &ring->records[head & (TRACE_RING_SIZE - 1)];
+	r->timestamp = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+	r->event = event;
+	r->arg0 = arg0;
+	r->arg1 = arg1;
+	r->arg2 = arg2;
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Copy out the records of one ring without stopping its writer.  Records
+ * that the writer may have overwritten while copying are dropped. */
+static uint32_t
+trace_ring_snapshot(struct trace_ring *ring, struct weston_trace_record *out)
+{
+	uint64_t start, end, first, i;
+
+	end = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	start = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+
+	for (i = start; i < end; i++)
+		out[i - start] = ring->records[i & (TRACE_RING_SIZE - 1)];
+
+	/* The writer may already be filling the slot of record 'head',
+	 * which clobbers record 'head - TRACE_RING_SIZE'. */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	first = __atomic_load_n(&ring->head, __ATOMIC_RELAXED) + 1;
+	first = first > TRACE_RING_SIZE ? first - TRACE_RING_SIZE : 0;
+	if (first < start)
+		first = start;
+	if (first > end)
+		first = end;
+
+	memmove(out, out + (first - start),
+		(end - first) * sizeof *out);
+
+	return end - first;
+}
+
+WL_EXPORT int
+weston_trace_dump(const char *filename)
+{
+	struct weston_trace_file_header header;
+	struct weston_trace_thread_header thread;
+	struct weston_trace_record *records;
+	struct trace_ring *ring;
+	FILE *fp;
+	int ret = 0;
+
+	records = malloc(TRACE_RING_SIZE * sizeof *records);
+	if (records == NULL)
+		return -1;
+
+	fp = fopen(filename, "w");
+	if (fp == NULL) {
+		free(records);
+		return -1;
+	}
+
+	header.magic = WESTON_TRACE_MAGIC;
+	header.version = WESTON_TRACE_VERSION;
+	header.record_size = sizeof *records;
+	header.thread_count = 0;
+	for (ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE);
+	     ring; ring = ring->next)
+		header.thread_count++;
+
+	if (fwrite(&header, sizeof header, 1, fp) != 1)
+		ret = -1;
+
+	for (ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE);
+	     ring && header.thread_count > 0 && ret == 0;
+	     ring = ring->next, header.thread_count--) {
+		thread.thread_id = ring->thread_id;
+		thread.record_count = trace_ring_snapshot(ring, records);
+
+		if (fwrite(&thread, sizeof thread, 1, fp) != 1 ||
+		    fwrite(records, sizeof *records,
+			   thread.record_count, fp) != thread.record_count)
+			ret = -1;
+	}
+
+	if (fclose(fp) != 0)
+		ret = -1;
+	free(records);
+
+	return ret;
+}
+
+static void
+trace_dump(struct weston_trace *trace)
+{
+	if (weston_trace_dump(trace->filename) < 0)
+		weston_log("failed to write trace to %s: %m\n",
+			   trace->filename);
+	else
+		weston_log("trace written to %s\n", trace->filename);
+}
+
+static int
+trace_dump_signal(int signal_number, void *data)
+{
+	trace_dump(data);
+
+	return 1;
+}
+
+static void
+trace_dump_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		   void *data)
+{
+	trace_dump(data);
+}
+
+static void
+trace_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_trace *trace =
+		container_of(listener, struct weston_trace, destroy_listener);
+
+	trace_dump(trace);
+	weston_trace_enabled = 0;
+
+	if (trace->dump_source)
+		wl_event_source_remove(trace->dump_source);
+	free(trace->filename);
+	free(trace);
+}
+
+WL_EXPORT void
+weston_trace_create(struct weston_compositor *ec, const char *filename)
+{
+	struct weston_trace *trace;
+	struct wl_event_loop *loop;
+
+	trace = zalloc(sizeof *trace);
+	if (trace == NULL)
+		return;
+
+	trace->compositor = ec;
+	trace->filename = strdup(filename);
+	if (trace->filename == NULL) {
+		free(trace);
+		return;
+	}
+
+	loop = wl_display_get_event_loop(ec->wl_display);
+	trace->dump_source = wl_event_loop_add_signal(loop, TRACE_DUMP_SIGNAL,
+						      trace_dump_signal,
+						      trace);
+
+	weston_compositor_add_debug_binding(ec, KEY_D,
+					    trace_dump_binding, trace);
+
+	trace->destroy_listener.notify = trace_destroy;
+	wl_signal_add(&ec->destroy_signal, &trace->destroy_listener);
+
+	weston_trace_enabled = 1;
+
+	weston_log("tracing enabled, send signal %d or press "
+		   "mod-shift-space d to write %s\n",
+		   TRACE_DUMP_SIGNAL, trace->filename);
+}
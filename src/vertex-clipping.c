@@ -23,9 +23,15 @@
 #include <float.h>
 #include <math.h>
 
+#ifdef IN_WESTON
+#include <wayland-server.h>
+#else
+#define WL_EXPORT
+#endif
+
 #include "vertex-clipping.h"
 
-float
+WL_EXPORT float
 float_difference(float a, float b)
 {
 	/* http://www.altdevblogaday.com/2012/02/22/comparing-floating-point-numbers-2012-edition/ */
@@ -267,7 +273,7 @@ clip_polygon_bottom(struct clip_context *ctx, const struct polygon8 *src,
 #define min(a, b) (((a) > (b)) ? (b) : (a))
 #define clip(x, a, b)  min(max(x, a), b)
 
-int
+WL_EXPORT int
 clip_simple(struct clip_context *ctx,
 	    struct polygon8 *surf,
 	    float *ex,
@@ -281,7 +287,7 @@ clip_simple(struct clip_context *ctx,
 	return surf->n;
 }
 
-int
+WL_EXPORT int
 clip_transformed(struct clip_context *ctx,
 		 struct polygon8 *surf,
 		 float *ex,
@@ -0,0 +1,196 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+/*
+ * Converts a trace written by weston --trace into the JSON trace event
+ * format understood by chrome://tracing and compatible timeline viewers.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "weston-trace.h"
+
+static const char * const event_names[] = {
+	[WESTON_TRACE_SURFACE_COMMIT] = "surface_commit",
+	[WESTON_TRACE_SCHEDULE_REPAINT] = "schedule_repaint",
+	[WESTON_TRACE_REPAINT_BEGIN] = "repaint",
+	[WESTON_TRACE_REPAINT_END] = "repaint",
+	[WESTON_TRACE_FINISH_FRAME] = "finish_frame",
+	[WESTON_TRACE_NOTIFY_MOTION] = "notify_motion",
+	[WESTON_TRACE_NOTIFY_KEY] = "notify_key",
+	[WESTON_TRACE_BUFFER_REFERENCE] = "buffer_reference",
+};
+
+static void
+print_args(FILE *out, const struct weston_trace_record *r)
+{
+	switch (r->event) {
+	case WESTON_TRACE_SURFACE_COMMIT:
+		fprintf(out, "{\"id\":%" PRIu32 ",\"surface\":\"0x%" PRIx64
+			"\",\"buffer\":\"0x%" PRIx64 "\"}",
+			r->arg0, r->arg1, r->arg2);
+		break;
+	case WESTON_TRACE_SCHEDULE_REPAINT:
+		fprintf(out, "{\"output\":%" PRIu32 "}", r->arg0);
+		break;
+	case WESTON_TRACE_REPAINT_BEGIN:
+	case WESTON_TRACE_FINISH_FRAME:
+		fprintf(out, "{\"output\":%" PRIu32 ",\"msecs\":%" PRIu64 "}",
+			r->arg0, r->arg1);
+		break;
+	case WESTON_TRACE_REPAINT_END:
+		fprintf(out, "{\"output\":%" PRIu32 ",\"result\":%d}",
+			r->arg0, (int32_t) r->arg1);
+		break;
+	case WESTON_TRACE_NOTIFY_MOTION:
+		fprintf(out, "{\"time\":%" PRIu32 ",\"dx\":%.2f,\"dy\":%.2f}",
+			r->arg0, (int32_t) r->arg1 / 256.0,
+			(int32_t) r->arg2 / 256.0);
+		break;
+	case WESTON_TRACE_NOTIFY_KEY:
+		fprintf(out, "{\"time\":%" PRIu32 ",\"key\":%" PRIu64
+			",\"state\":%" PRIu64 "}", r->arg0, r->arg1, r->arg2);
+		break;
+	case WESTON_TRACE_BUFFER_REFERENCE:
+		fprintf(out, "{\"old\":\"0x%" PRIx64 "\",\"new\":\"0x%" PRIx64
+			"\"}", r->arg1, r->arg2);
+		break;
+	default:
+		fprintf(out, "{}");
+		break;
+	}
+}
+
+static void
+print_record(FILE *out, const struct weston_trace_record *r,
+	     uint32_t tid, uint64_t base, int first)
+{
+	const char *phase;
+
+	switch (r->event) {
+	case WESTON_TRACE_REPAINT_BEGIN:
+		phase = "B";
+		break;
+	case WESTON_TRACE_REPAINT_END:
+		phase = "E";
+		break;
+	default:
+		phase = "i";
+		break;
+	}
+
+	fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"pid\":1,"
+		"\"tid\":%" PRIu32 ",\"ts\":%.3f,",
+		first ? "" : ",", event_names[r->event], phase, tid,
+		(r->timestamp - base) / 1000.0);
+	if (phase[0] == 'i')
+		fprintf(out, "\"s\":\"t\",");
+	fprintf(out, "\"args\":");
+	print_args(out, r);
+	fprintf(out, "}");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct weston_trace_file_header header;
+	struct weston_trace_thread_header thread;
+	struct weston_trace_record record;
+	FILE *in, *out = stdout;
+	uint64_t base = UINT64_MAX;
+	long data_start;
+	uint32_t i, j;
+	int first = 1;
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s TRACE [OUTPUT.json]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	in = fopen(argv[1], "r");
+	if (in == NULL) {
+		fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (fread(&header, sizeof header, 1, in) != 1 ||
+	    header.magic != WESTON_TRACE_MAGIC ||
+	    header.version != WESTON_TRACE_VERSION ||
+	    header.record_size != sizeof record) {
+		fprintf(stderr, "%s: not a weston trace\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	/* First pass finds the earliest timestamp so that the timeline
+	 * starts at zero. */
+	data_start = ftell(in);
+	for (i = 0; i < header.thread_count; i++) {
+		if (fread(&thread, sizeof thread, 1, in) != 1)
+			goto truncated;
+		for (j = 0; j < thread.record_count; j++) {
+			if (fread(&record, sizeof record, 1, in) != 1)
+				goto truncated;
+			if (record.timestamp < base)
+				base = record.timestamp;
+		}
+	}
+
+	if (argc == 3) {
+		out = fopen(argv[2], "w");
+		if (out == NULL) {
+			fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	fseek(in, data_start, SEEK_SET);
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (i = 0; i < header.thread_count; i++) {
+		fread(&thread, sizeof thread, 1, in);
+		for (j = 0; j < thread.record_count; j++) {
+			fread(&record, sizeof record, 1, in);
+			if (record.event == 0 ||
+			    record.event >= WESTON_TRACE_EVENT_COUNT)
+				continue;
+			print_record(out, &record, thread.thread_id,
+				     base, first);
+			first = 0;
+		}
+	}
+	fprintf(out, "\n]}\n");
+
+	fclose(in);
+	if (out != stdout)
+		fclose(out);
+
+	return EXIT_SUCCESS;
+
+truncated:
+	fprintf(stderr, "%s: truncated trace\n", argv[1]);
+	return EXIT_FAILURE;
+}
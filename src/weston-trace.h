@@ -0,0 +1,93 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef _WESTON_TRACE_H_
+#define _WESTON_TRACE_H_
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Binary event tracing.  Every thread records into its own ring of
+ * fixed-size records; the rings are written out by weston_trace_dump()
+ * and turned into a timeline by weston-trace-convert.
+ */
+
+enum weston_trace_event {
+	WESTON_TRACE_SURFACE_COMMIT = 1,  /* 0: surface id, 1: surface, 2: buffer */
+	WESTON_TRACE_SCHEDULE_REPAINT,    /* 0: output id */
+	WESTON_TRACE_REPAINT_BEGIN,       /* 0: output id, 1: frame time */
+	WESTON_TRACE_REPAINT_END,         /* 0: output id, 1: result */
+	WESTON_TRACE_FINISH_FRAME,        /* 0: output id, 1: frame time */
+	WESTON_TRACE_NOTIFY_MOTION,       /* 0: time, 1: dx, 2: dy (fixed) */
+	WESTON_TRACE_NOTIFY_KEY,          /* 0: time, 1: key, 2: state */
+	WESTON_TRACE_BUFFER_REFERENCE,    /* 1: old buffer, 2: new buffer */
+	WESTON_TRACE_EVENT_COUNT
+};
+
+struct weston_trace_record {
+	uint64_t timestamp;		/* CLOCK_MONOTONIC, ns */
+	uint32_t event;
+	uint32_t arg0;
+	uint64_t arg1;
+	uint64_t arg2;
+};
+
+/* Dump file layout: a file header, then for each thread a thread header
+ * followed by its records, oldest first.  Native byte order. */
+#define WESTON_TRACE_MAGIC	0x43525457	/* "WTRC" */
+#define WESTON_TRACE_VERSION	1
+
+struct weston_trace_file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t thread_count;
+};
+
+struct weston_trace_thread_header {
+	uint32_t thread_id;
+	uint32_t record_count;
+};
+
+extern int weston_trace_enabled;
+
+void
+weston_trace_add(uint32_t event, uint32_t arg0, uint64_t arg1, uint64_t arg2);
+
+int
+weston_trace_dump(const char *filename);
+
+static inline void
+weston_trace(uint32_t event, uint32_t arg0, uint64_t arg1, uint64_t arg2)
+{
+	if (weston_trace_enabled)
+		weston_trace_add(event, arg0, arg1, arg2);
+}
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "../src/band-pool.h"
+
+struct rows_case {
+	int y1, y2;
+	int bands;
+};
+
+static const struct rows_case rows_cases[] = {
+	{ 0, 2160, 1 },
+	{ 0, 2160, 16 },
+	{ 0, 1080, 7 },
+	{ 13, 14, 1 },
+	{ 0, 5, 5 },
+	{ -600, 480, 6 },
+	{ -1079, -3, 9 },
+	{ 100, 20000, 64 },
+};
+
+/* The bands must tile [y1, y2) exactly, in order, with heights that
+ * differ by at most one row. */
+TEST_P(bands_partition_rows, rows_cases)
+{
+	const struct rows_case *c = data;
+	int band, y1, y2, prev = c->y1;
+	int min_h = c->y2 - c->y1, max_h = 0;
+
+	for (band = 0; band < c->bands; band++) {
+		band_get_rows(c->y1, c->y2, c->bands, band, &y1, &y2);
+
+		assert(y1 == prev);
+		assert(y2 > y1);
+		if (y2 - y1 < min_h)
+			min_h = y2 - y1;
+		if (y2 - y1 > max_h)
+			max_h = y2 - y1;
+		prev = y2;
+	}
+
+	assert(prev == c->y2);
+	assert(max_h - min_h <= 1);
+}
+
+struct run_job {
+	int *count;
+	int bands;
+};
+
+static void
+count_band(int band, void *data)
+{
+	struct run_job *job = data;
+
+	assert(band >= 0 && band < job->bands);
+	job->count[band]++;
+}
+
+static const int thread_counts[] = { 0, 1, 2, 4, 9 };
+
+/* Every band runs exactly once per band_pool_run(), also when there are
+ * fewer bands than threads and when the pool is reused. */
+TEST_P(pool_runs_every_band_once, thread_counts)
+{
+	static const int band_counts[] = { 1, 2, 3, 8, 31, 200 };
+	const int *threads = data;
+	struct band_pool *pool;
+	struct run_job job;
+	unsigned int i;
+	int band, round;
+
+	pool = band_pool_create(*threads);
+	assert(pool);
+	assert(band_pool_get_threads(pool) >= 1);
+	assert(band_pool_get_threads(pool) <= (*threads > 1 ? *threads : 1));
+
+	for (round = 0; round < 50; round++) {
+		for (i = 0; i < sizeof band_counts / sizeof band_counts[0];
+		     i++) {
+			job.bands = band_counts[i];
+			job.count = calloc(job.bands, sizeof *job.count);
+			assert(job.count);
+
+			band_pool_run(pool, job.bands, count_band, &job);
+
+			for (band = 0; band < job.bands; band++)
+				assert(job.count[band] == 1);
+			free(job.count);
+		}
+	}
+
+	band_pool_destroy(pool);
+}
+
+TEST(no_pool_runs_inline)
+{
+	int count[4];
+	struct run_job job = { count, 4 };
+	int band;
+
+	memset(count, 0, sizeof count);
+	assert(band_pool_get_threads(NULL) == 1);
+
+	band_pool_run(NULL, 4, count_band, &job);
+	for (band = 0; band < 4; band++)
+		assert(count[band] == 1);
+}
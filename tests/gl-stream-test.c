@@ -0,0 +1,424 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+
+#include "../src/gl-stream.h"
+
+/*
+ * Draws a frame of many small damage rectangles the ways the GL
+ * renderer has done it: "fans" is the old path, with one
+ * glDrawArrays(GL_TRIANGLE_FAN) per rectangle from client memory, and
+ * "stream" the current one, drawing them through
+ * stream_draw_triangle_fans() as the renderer does: the vertices and the
+ * indices of a triangle list go into ring buffer objects and are drawn
+ * in one call.
+ * Checks that both paint the same pixels and reports the frame rate of
+ * each for a few rectangle counts.
+ *
+ * Meant for software GL, for instance Mesa llvmpipe without a display:
+ *	EGL_PLATFORM=surfaceless LIBGL_ALWAYS_SOFTWARE=1 ./gl-stream-test
+ */
+
+#define WIDTH		1920
+#define HEIGHT		1080
+#define TEX_SIZE	256
+#define RECT_SIZE	8
+
+static const char vertex_shader[] =
+	"uniform mat4 proj;\n"
+	"attribute vec2 position;\n"
+	"attribute vec2 texcoord;\n"
+	"varying vec2 v_texcoord;\n"
+	"void main()\n"
+	"{\n"
+	"   gl_Position = proj * vec4(position, 0.0, 1.0);\n"
+	"   v_texcoord = texcoord;\n"
+	"}\n";
+
+static const char fragment_shader[] =
+	"precision mediump float;\n"
+	"varying vec2 v_texcoord;\n"
+	"uniform sampler2D tex;\n"
+	"uniform float alpha;\n"
+	"void main()\n"
+	"{\n"
+	"   gl_FragColor = alpha * texture2D(tex, v_texcoord);\n"
+	"}\n";
+
+static struct gl_stream_buffer vertex_stream;
+static struct gl_stream_buffer index_stream;
+
+static GLfloat *vertices;
+static GLushort *indices;
+static unsigned int *vtxcnt;
+static int n_rects;
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+static volatile int running;
+static void
+stopme(int n)
+{
+	running = 0;
+}
+
+/* Spread 'n' small rectangles over the output in a grid, as fans of
+ * four vertices: position and texcoord.  They are small enough that
+ * filling them costs less than issuing the draws, like the damage of
+ * blinking cursors or of a spinner. */
+static void
+build_rects(int n)
+{
+	int cols, rows, w, h, i, x, y;
+	GLfloat *v;
+
+	for (cols = 1; cols * cols * HEIGHT < n * WIDTH; cols++)
+		;
+	rows = (n + cols - 1) / cols;
+	w = WIDTH / cols;
+	h = HEIGHT / rows;
+	if (w > RECT_SIZE)
+		w = RECT_SIZE;
+	if (h > RECT_SIZE)
+		h = RECT_SIZE;
+
+	free(vertices);
+	free(vtxcnt);
+	vertices = malloc(n * 4 * 4 * sizeof *vertices);
+	vtxcnt = malloc(n * sizeof *vtxcnt);
+	if (!vertices || !vtxcnt)
+		abort();
+
+	v = vertices;
+	for (i = 0; i < n; i++) {
+		x = (i % cols) * (WIDTH / cols);
+		y = (i / cols) * (HEIGHT / rows);
+
+		*v++ = x;		*v++ = y;
+		*v++ = x / (GLfloat) WIDTH;
+		*v++ = y / (GLfloat) HEIGHT;
+		*v++ = x + w - 1;	*v++ = y;
+		*v++ = (x + w - 1) / (GLfloat) WIDTH;
+		*v++ = y / (GLfloat) HEIGHT;
+		*v++ = x + w - 1;	*v++ = y + h - 1;
+		*v++ = (x + w - 1) / (GLfloat) WIDTH;
+		*v++ = (y + h - 1) / (GLfloat) HEIGHT;
+		*v++ = x;		*v++ = y + h - 1;
+		*v++ = x / (GLfloat) WIDTH;
+		*v++ = (y + h - 1) / (GLfloat) HEIGHT;
+
+		vtxcnt[i] = 4;
+	}
+
+	n_rects = n;
+}
+
+static void
+draw_fans(void)
+{
+	int i;
+
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *vertices,
+			      &vertices[0]);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *vertices,
+			      &vertices[2]);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+
+	for (i = 0; i < n_rects; i++)
+		glDrawArrays(GL_TRIANGLE_FAN, i * 4, 4);
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+}
+
+/* Up to 16384 rectangles, as the vertices of a draw must fit 16 bits */
+static void
+draw_stream(void)
+{
+	stream_draw_triangle_fans(&vertex_stream, &index_stream, indices,
+				  vertices, vtxcnt, n_rects, n_rects * 4);
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+struct path {
+	const char *name;
+	void (*draw)(void);
+};
+
+static const struct path paths[] = {
+	{ "fans", draw_fans },
+	{ "stream", draw_stream },
+};
+
+#define N_PATHS (sizeof paths / sizeof paths[0])
+
+static const int rect_counts[] = { 64, 1024, 4096, 16384 };
+
+#define N_RECT_COUNTS (sizeof rect_counts / sizeof rect_counts[0])
+
+static void
+draw_frame(const struct path *path)
+{
+	path->draw();
+}
+
+static double
+test_loop_speed(const struct path *path)
+{
+	unsigned long n = 0;
+	double t;
+
+	running = 1;
+	alarm(3);
+	reset_timer();
+	while (running) {
+		draw_frame(path);
+		glFinish();
+		n++;
+	}
+	t = read_timer();
+
+	return n / t;
+}
+
+static GLuint
+compile_shader(GLenum type, const char *source)
+{
+	GLuint s;
+	GLint status;
+
+	s = glCreateShader(type);
+	glShaderSource(s, 1, &source, NULL);
+	glCompileShader(s);
+	glGetShaderiv(s, GL_COMPILE_STATUS, &status);
+	if (!status) {
+		fprintf(stderr, "shader compile failed\n");
+		exit(1);
+	}
+
+	return s;
+}
+
+static void
+setup_gl(void)
+{
+	static const GLfloat proj[16] = {
+		2.0 / WIDTH, 0, 0, 0,
+		0, -2.0 / HEIGHT, 0, 0,
+		0, 0, 1, 0,
+		-1, 1, 0, 1
+	};
+	GLuint program, tex;
+	uint32_t *pixels;
+	int i;
+
+	program = glCreateProgram();
+	glAttachShader(program,
+		       compile_shader(GL_VERTEX_SHADER, vertex_shader));
+	glAttachShader(program,
+		       compile_shader(GL_FRAGMENT_SHADER, fragment_shader));
+	glBindAttribLocation(program, 0, "position");
+	glBindAttribLocation(program, 1, "texcoord");
+	glLinkProgram(program);
+	glUseProgram(program);
+
+	glUniformMatrix4fv(glGetUniformLocation(program, "proj"),
+			   1, GL_FALSE, proj);
+	glUniform1i(glGetUniformLocation(program, "tex"), 0);
+	glUniform1f(glGetUniformLocation(program, "alpha"), 0.75);
+
+	pixels = malloc(TEX_SIZE * TEX_SIZE * 4);
+	if (!pixels)
+		abort();
+	for (i = 0; i < TEX_SIZE * TEX_SIZE; i++)
+		pixels[i] = 0xff000000 | (i * 2654435761u >> 8);
+
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TEX_SIZE, TEX_SIZE, 0,
+		     GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	free(pixels);
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glClearColor(0.25, 0.5, 0.75, 1.0);
+	glViewport(0, 0, WIDTH, HEIGHT);
+}
+
+static int
+setup_egl(void)
+{
+	static const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_NONE
+	};
+	static const EGLint context_attribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+	static const EGLint surface_attribs[] = {
+		EGL_WIDTH, WIDTH,
+		EGL_HEIGHT, HEIGHT,
+		EGL_NONE
+	};
+	EGLDisplay dpy;
+	EGLConfig config;
+	EGLContext ctx;
+	EGLSurface surface;
+	EGLint n;
+
+	dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, NULL, NULL))
+		return -1;
+
+	if (!eglBindAPI(EGL_OPENGL_ES_API) ||
+	    !eglChooseConfig(dpy, config_attribs, &config, 1, &n) || n < 1)
+		return -1;
+
+	ctx = eglCreateContext(dpy, config, EGL_NO_CONTEXT, context_attribs);
+	surface = eglCreatePbufferSurface(dpy, config, surface_attribs);
+	if (ctx == EGL_NO_CONTEXT || surface == EGL_NO_SURFACE)
+		return -1;
+
+	if (!eglMakeCurrent(dpy, surface, surface, ctx))
+		return -1;
+
+	printf("GL renderer: %s\n", (const char *) glGetString(GL_RENDERER));
+
+	return 0;
+}
+
+/* Both paths must paint the same pixels */
+static int
+check_output(void)
+{
+	uint32_t *expected, *pixels;
+	int failed = 0;
+
+	expected = malloc(WIDTH * HEIGHT * 4);
+	pixels = malloc(WIDTH * HEIGHT * 4);
+	if (!expected || !pixels)
+		abort();
+
+	glClear(GL_COLOR_BUFFER_BIT);
+	draw_frame(&paths[0]);
+	glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE,
+		     expected);
+	glClear(GL_COLOR_BUFFER_BIT);
+	draw_frame(&paths[1]);
+	glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+	if (memcmp(expected, pixels, WIDTH * HEIGHT * 4) != 0) {
+		printf("%d rects: stream differs from fans\n", n_rects);
+		failed = 1;
+	}
+
+	free(pixels);
+	free(expected);
+
+	return failed;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sigaction ding;
+	unsigned int i, j;
+	double fps;
+	int failed = 0;
+
+	ding.sa_handler = stopme;
+	sigemptyset(&ding.sa_mask);
+	ding.sa_flags = 0;
+	sigaction(SIGALRM, &ding, NULL);
+
+	if (setup_egl() < 0) {
+		fprintf(stderr, "failed to set up an EGL pbuffer context\n");
+		return 1;
+	}
+	setup_gl();
+
+	stream_buffer_init(&vertex_stream, GL_ARRAY_BUFFER,
+			   VERTEX_STREAM_SIZE);
+	stream_buffer_init(&index_stream, GL_ELEMENT_ARRAY_BUFFER,
+			   INDEX_STREAM_SIZE);
+
+	indices = malloc(rect_counts[N_RECT_COUNTS - 1] * 6 * sizeof *indices);
+	if (!indices)
+		return 1;
+
+	printf("%dx%d\n", WIDTH, HEIGHT);
+	for (i = 0; i < N_RECT_COUNTS; i++) {
+		build_rects(rect_counts[i]);
+		failed += check_output();
+
+		for (j = 0; j < N_PATHS; j++) {
+			fps = test_loop_speed(&paths[j]);
+			printf("%d rects, %s: %.1f frames/s, %.2f ms/frame\n",
+			       n_rects, paths[j].name, fps, 1e3 / fps);
+		}
+	}
+
+	stream_buffer_release(&index_stream);
+	stream_buffer_release(&vertex_stream);
+	free(indices);
+	free(vtxcnt);
+	free(vertices);
+
+	return failed ? 1 : 0;
+}
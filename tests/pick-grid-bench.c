@@ -0,0 +1,282 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include "../src/pick-grid.h"
+
+/*
+ * Compares picking through the pick grid with the linear walk over the
+ * view list that weston_compositor_pick_view() used to do.  A view is
+ * modelled by its bounding box and an input rectangle inside it, like a
+ * window with a drop shadow.
+ */
+
+#define WIDTH		1920
+#define HEIGHT		1080
+
+struct view {
+	struct pick_grid_box box;
+	struct pick_grid_box input;
+};
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+static volatile int running;
+static void
+stopme(int n)
+{
+	running = 0;
+}
+
+static int
+view_contains_point(const struct view *view, int32_t x, int32_t y)
+{
+	return x >= view->input.x1 && x < view->input.x2 &&
+	       y >= view->input.y1 && y < view->input.y2;
+}
+
+static int
+pick_linear(const struct view *views, int count, int32_t x, int32_t y)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (view_contains_point(&views[i], x, y))
+			return i;
+
+	return -1;
+}
+
+static int
+pick_grid(const struct pick_grid *grid, const struct view *views,
+	  int32_t x, int32_t y)
+{
+	struct pick_grid_iter iter;
+	uint32_t i;
+
+	pick_grid_query(grid, x, y, &iter);
+	while (pick_grid_iter_next(&iter, &i))
+		if (view_contains_point(&views[i], x, y))
+			return i;
+
+	return -1;
+}
+
+static void
+random_views(struct view *views, struct pick_grid_box *boxes, int count)
+{
+	int i, w, h, shadow;
+
+	for (i = 0; i < count; i++) {
+		/* A background, a panel and otherwise windows. */
+		if (i == count - 1) {
+			w = WIDTH;
+			h = HEIGHT;
+		} else if (i == 0) {
+			w = WIDTH;
+			h = 32;
+		} else {
+			w = 50 + random() % (WIDTH / 2);
+			h = 50 + random() % (HEIGHT / 2);
+		}
+
+		shadow = (i == 0 || i == count - 1) ? 0 : 16;
+
+		views[i].box.x1 = random() % (WIDTH - w + 1) - shadow;
+		views[i].box.y1 = random() % (HEIGHT - h + 1) - shadow;
+		views[i].box.x2 = views[i].box.x1 + w + 2 * shadow;
+		views[i].box.y2 = views[i].box.y1 + h + 2 * shadow;
+
+		views[i].input.x1 = views[i].box.x1 + shadow;
+		views[i].input.y1 = views[i].box.y1 + shadow;
+		views[i].input.x2 = views[i].box.x2 - shadow;
+		views[i].input.y2 = views[i].box.y2 - shadow;
+
+		boxes[i] = views[i].box;
+	}
+}
+
+static int
+test_correctness(const struct pick_grid *grid,
+		 const struct view *views, int count)
+{
+	int i, failed = 0;
+	int32_t x, y;
+
+	for (i = 0; i < 1000000; i++) {
+		/* Include points off the edges of the screen. */
+		x = random() % (WIDTH + 200) - 100;
+		y = random() % (HEIGHT + 200) - 100;
+
+		if (pick_linear(views, count, x, y) !=
+		    pick_grid(grid, views, x, y)) {
+			printf("mismatch at %d,%d: linear %d, grid %d\n",
+			       x, y, pick_linear(views, count, x, y),
+			       pick_grid(grid, views, x, y));
+			failed++;
+		}
+	}
+
+	return failed;
+}
+
+static void __attribute__((noinline))
+test_loop_speed_linear(const struct view *views, int count)
+{
+	unsigned long n = 0;
+	int32_t x, y;
+	int hits = 0;
+	double t;
+
+	printf("Running 3 s test on the linear walk...\n");
+
+	running = 1;
+	alarm(3);
+	reset_timer();
+	while (running) {
+		x = (n * 7919) % WIDTH;
+		y = (n * 104729) % HEIGHT;
+		hits += pick_linear(views, count, x, y) >= 0;
+		n++;
+	}
+	t = read_timer();
+
+	printf("%lu picks in %f seconds, avg. %.1f ns/pick (%d hits).\n",
+	       n, t, 1e9 * t / n, hits);
+}
+
+static void __attribute__((noinline))
+test_loop_speed_grid(const struct pick_grid *grid,
+		     const struct view *views)
+{
+	unsigned long n = 0;
+	int32_t x, y;
+	int hits = 0;
+	double t;
+
+	printf("Running 3 s test on the pick grid...\n");
+
+	running = 1;
+	alarm(3);
+	reset_timer();
+	while (running) {
+		x = (n * 7919) % WIDTH;
+		y = (n * 104729) % HEIGHT;
+		hits += pick_grid(grid, views, x, y) >= 0;
+		n++;
+	}
+	t = read_timer();
+
+	printf("%lu picks in %f seconds, avg. %.1f ns/pick (%d hits).\n",
+	       n, t, 1e9 * t / n, hits);
+}
+
+static void __attribute__((noinline))
+test_loop_speed_build(struct pick_grid *grid,
+		      const struct pick_grid_box *boxes, int count)
+{
+	unsigned long n = 0;
+	double t;
+
+	printf("Running 3 s test on pick_grid_build()...\n");
+
+	running = 1;
+	alarm(3);
+	reset_timer();
+	while (running) {
+		pick_grid_build(grid, boxes, count);
+		n++;
+	}
+	t = read_timer();
+
+	printf("%lu builds in %f seconds, avg. %.1f us/build.\n",
+	       n, t, 1e6 * t / n);
+}
+
+int main(int argc, char *argv[])
+{
+	static const int counts[] = { 10, 100, 500, 2000 };
+	struct sigaction ding;
+	struct pick_grid grid;
+	struct pick_grid_box *boxes;
+	struct view *views;
+	unsigned int i;
+	int count, failed = 0;
+
+	ding.sa_handler = stopme;
+	sigemptyset(&ding.sa_mask);
+	ding.sa_flags = 0;
+	sigaction(SIGALRM, &ding, NULL);
+
+	srandom(13);
+	pick_grid_init(&grid);
+
+	for (i = 0; i < sizeof counts / sizeof counts[0]; i++) {
+		count = counts[i];
+		views = malloc(count * sizeof *views);
+		boxes = malloc(count * sizeof *boxes);
+		if (!views || !boxes)
+			return 1;
+
+		printf("\n%d views:\n", count);
+		random_views(views, boxes, count);
+		if (pick_grid_build(&grid, boxes, count) < 0)
+			return 1;
+
+		failed += test_correctness(&grid, views, count);
+
+		test_loop_speed_linear(views, count);
+		test_loop_speed_grid(&grid, views);
+		test_loop_speed_build(&grid, boxes, count);
+
+		free(views);
+		free(boxes);
+	}
+
+	pick_grid_release(&grid);
+
+	printf("\n%d mismatches\n", failed);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "weston-test-runner.h"
+
+#include "../src/pick-grid.h"
+
+/*
+ * Picking through the pick grid must find the same view as the linear
+ * walk over the view list that weston_compositor_pick_view() used to do.
+ * A view is modelled by its bounding box and an input rectangle inside
+ * it, like a window with a drop shadow.
+ */
+
+#define WIDTH		1920
+#define HEIGHT		1080
+
+struct view {
+	struct pick_grid_box box;
+	struct pick_grid_box input;
+};
+
+static int
+view_contains_point(const struct view *view, int32_t x, int32_t y)
+{
+	return x >= view->input.x1 && x < view->input.x2 &&
+	       y >= view->input.y1 && y < view->input.y2;
+}
+
+static int
+pick_linear(const struct view *views, int count, int32_t x, int32_t y)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (view_contains_point(&views[i], x, y))
+			return i;
+
+	return -1;
+}
+
+static int
+pick_grid(const struct pick_grid *grid, const struct view *views,
+	  int32_t x, int32_t y)
+{
+	struct pick_grid_iter iter;
+	uint32_t i;
+
+	pick_grid_query(grid, x, y, &iter);
+	while (pick_grid_iter_next(&iter, &i))
+		if (view_contains_point(&views[i], x, y))
+			return i;
+
+	return -1;
+}
+
+static void
+random_views(struct view *views, struct pick_grid_box *boxes, int count)
+{
+	int i, w, h, shadow;
+
+	for (i = 0; i < count; i++) {
+		/* A background, a panel and otherwise windows. */
+		if (i == count - 1) {
+			w = WIDTH;
+			h = HEIGHT;
+		} else if (i == 0) {
+			w = WIDTH;
+			h = 32;
+		} else {
+			w = 50 + random() % (WIDTH / 2);
+			h = 50 + random() % (HEIGHT / 2);
+		}
+
+		shadow = (i == 0 || i == count - 1) ? 0 : 16;
+
+		views[i].box.x1 = random() % (WIDTH - w + 1) - shadow;
+		views[i].box.y1 = random() % (HEIGHT - h + 1) - shadow;
+		views[i].box.x2 = views[i].box.x1 + w + 2 * shadow;
+		views[i].box.y2 = views[i].box.y1 + h + 2 * shadow;
+
+		views[i].input.x1 = views[i].box.x1 + shadow;
+		views[i].input.y1 = views[i].box.y1 + shadow;
+		views[i].input.x2 = views[i].box.x2 - shadow;
+		views[i].input.y2 = views[i].box.y2 - shadow;
+
+		boxes[i] = views[i].box;
+	}
+}
+
+static const int view_counts[] = { 1, 10, 100, 500, 2000 };
+
+TEST_P(grid_matches_linear_walk, view_counts)
+{
+	const int *count = data;
+	struct pick_grid grid;
+	struct pick_grid_box *boxes;
+	struct view *views;
+	int32_t x, y;
+	int i;
+
+	srandom(13 + *count);
+	views = malloc(*count * sizeof *views);
+	boxes = malloc(*count * sizeof *boxes);
+	assert(views && boxes);
+
+	random_views(views, boxes, *count);
+	pick_grid_init(&grid);
+	assert(pick_grid_build(&grid, boxes, *count) == 0);
+
+	for (i = 0; i < 100000; i++) {
+		/* Include points off the edges of the screen. */
+		x = random() % (WIDTH + 200) - 100;
+		y = random() % (HEIGHT + 200) - 100;
+
+		assert(pick_linear(views, *count, x, y) ==
+		       pick_grid(&grid, views, x, y));
+	}
+
+	pick_grid_release(&grid);
+	free(views);
+	free(boxes);
+}
+
+TEST(candidates_come_in_stacking_order)
+{
+	struct pick_grid_box boxes[64];
+	struct view views[64];
+	struct pick_grid grid;
+	struct pick_grid_iter iter;
+	uint32_t i, prev;
+	int32_t x, y;
+	int first;
+
+	srandom(7);
+	random_views(views, boxes, 64);
+	pick_grid_init(&grid);
+	assert(pick_grid_build(&grid, boxes, 64) == 0);
+
+	for (y = -50; y < HEIGHT + 50; y += 37) {
+		for (x = -50; x < WIDTH + 50; x += 41) {
+			first = 1;
+			prev = 0;
+			pick_grid_query(&grid, x, y, &iter);
+			while (pick_grid_iter_next(&iter, &i)) {
+				assert(i < 64);
+				assert(first || i > prev);
+				first = 0;
+				prev = i;
+			}
+		}
+	}
+
+	pick_grid_release(&grid);
+}
+
+TEST(always_box_is_returned_everywhere)
+{
+	struct pick_grid_box boxes[] = {
+		{ 0, 0, 100, 100 },
+		PICK_GRID_BOX_ALWAYS,
+	};
+	static const int32_t points[][2] = {
+		{ 50, 50 }, { -100000, 3 }, { 3, 1000000 },
+		{ INT32_MIN, INT32_MIN }, { INT32_MAX - 1, INT32_MAX - 1 },
+	};
+	struct pick_grid grid;
+	struct pick_grid_iter iter;
+	uint32_t i;
+	unsigned int p;
+	int found;
+
+	pick_grid_init(&grid);
+	assert(pick_grid_build(&grid, boxes, 2) == 0);
+
+	for (p = 0; p < sizeof points / sizeof points[0]; p++) {
+		found = 0;
+		pick_grid_query(&grid, points[p][0], points[p][1], &iter);
+		while (pick_grid_iter_next(&iter, &i))
+			if (i == 1)
+				found = 1;
+		assert(found);
+	}
+
+	pick_grid_release(&grid);
+}
+
+TEST(empty_grid_returns_nothing)
+{
+	struct pick_grid grid;
+	struct pick_grid_iter iter;
+	uint32_t i;
+
+	pick_grid_init(&grid);
+	assert(pick_grid_build(&grid, NULL, 0) == 0);
+
+	pick_grid_query(&grid, 10, 10, &iter);
+	assert(!pick_grid_iter_next(&iter, &i));
+
+	pick_grid_release(&grid);
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+
+#include "pixman-test-helper.h"
+
+/*
+ * How full repaints of the pixman renderer scale with the number of
+ * band threads, from one up to the number of CPUs.  Not run by make
+ * check; load it into the headless backend at the size to measure:
+ *
+ *   weston --backend=headless-backend.so --width=1920 --height=1080 \
+ *          --modules=$PWD/tests/.libs/pixman-bands-bench.so
+ */
+
+#define WARMUP_FRAMES 5
+#define FRAMES 100
+
+static double
+time_repaints(struct pixman_test *t)
+{
+	struct timespec begin, end;
+	int i;
+
+	for (i = 0; i < WARMUP_FRAMES; i++)
+		pixman_test_repaint(t);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < FRAMES; i++)
+		pixman_test_repaint(t);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return ((end.tv_sec - begin.tv_sec) * 1000.0 +
+		(end.tv_nsec - begin.tv_nsec) / 1000000.0) / FRAMES;
+}
+
+static void
+run_bench(struct pixman_test *t)
+{
+	struct weston_compositor *compositor = t->compositor;
+	char config[64];
+	double ms, single = 0.0;
+	long threads, max_threads;
+
+	max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (max_threads < 1)
+		max_threads = 1;
+
+	printf("%dx%d, %d frames\n", t->width, t->height, FRAMES);
+	for (threads = 1; threads <= max_threads; threads++) {
+		snprintf(config, sizeof config, "pixman-threads=%ld", threads);
+		assert(pixman_test_set_renderer(t, config) == 0);
+
+		ms = time_repaints(t);
+		if (threads == 1)
+			single = ms;
+		printf("%3ld threads: %8.3f ms per frame, %5.2fx\n",
+		       threads, ms, single / ms);
+	}
+
+	pixman_test_finish(t);
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct pixman_test *t;
+	struct pixman_test_view *v;
+	int i;
+
+	t = pixman_test_create(compositor, run_bench);
+	assert(t);
+
+	/* A desktop: a wallpaper, a panel, some windows with shadows, one
+	 * of them fading and one rotated. */
+	assert(pixman_test_add_buffer(t, 0, 0, t->width, t->height, 0));
+	assert(pixman_test_add_solid(t, 0, 0, t->width, 32,
+				     0.1, 0.1, 0.1, 0.8));
+
+	for (i = 0; i < 4; i++)
+		assert(pixman_test_add_buffer(t, 60 + i * t->width / 6,
+					      80 + i * t->height / 8,
+					      t->width / 2, t->height / 2,
+					      24));
+
+	v = pixman_test_add_buffer(t, t->width / 3, t->height / 3,
+				   t->width / 3, t->height / 3, 24);
+	assert(v);
+	pixman_test_view_set_alpha(v, 0.6);
+
+	v = pixman_test_add_buffer(t, t->width / 10, t->height / 2,
+				   t->width / 4, t->height / 4, 16);
+	assert(v);
+	pixman_test_view_transform(v, 10.0, 1.0);
+
+	return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "pixman-test-helper.h"
+
+/*
+ * Painting in bands on several threads must give the very same pixels
+ * as painting on one, with rotated views painted through coverage masks,
+ * scaled views, the shadow buffer and the layer cache.
+ */
+
+/* Enough for the stable views to be taken from the layer cache */
+#define FRAMES 6
+
+static const char *configs[] = {
+	"pixman-threads=4",
+	"pixman-threads=3",
+	"pixman-threads=4\npixman-shadow=true",
+	"pixman-threads=4\npixman-layer-cache=true",
+};
+
+static struct pixman_test_view *busy;
+
+static void
+bands_match_single_thread(struct pixman_test *t)
+{
+	struct weston_compositor *compositor = t->compositor;
+	uint32_t *reference;
+	unsigned int i;
+	int frame;
+
+	assert(pixman_test_set_renderer(t, "pixman-threads=1") == 0);
+	pixman_test_repaint(t);
+	reference = pixman_test_snapshot(t);
+	assert(reference);
+
+	for (i = 0; i < ARRAY_LENGTH(configs); i++) {
+		fprintf(stderr, "checking %s\n", configs[i]);
+		assert(pixman_test_set_renderer(t, configs[i]) == 0);
+
+		for (frame = 0; frame < FRAMES; frame++) {
+			pixman_test_view_touch(busy);
+			pixman_test_repaint(t);
+			assert(pixman_test_compare(t, reference, 0) == 0);
+		}
+	}
+
+	free(reference);
+	pixman_test_finish(t);
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct pixman_test *t;
+	struct pixman_test_view *v;
+
+	t = pixman_test_create(compositor, bands_match_single_thread);
+	assert(t);
+
+	assert(pixman_test_add_buffer(t, 0, 0, t->width, t->height, 0));
+
+	v = pixman_test_add_buffer(t, 100, 100, 300, 200, 12);
+	assert(v);
+	pixman_test_view_transform(v, 30.0, 1.0);
+
+	v = pixman_test_add_buffer(t, 500, 150, 200, 150, 0);
+	assert(v);
+	pixman_test_view_transform(v, 0.0, 1.5);
+
+	v = pixman_test_add_solid(t, 300, 380, 200, 120, 0.1, 0.3, 0.2, 1.0);
+	assert(v);
+	pixman_test_view_set_alpha(v, 0.8);
+	pixman_test_view_transform(v, -45.0, 1.0);
+
+	busy = pixman_test_add_solid(t, t->width - 80, t->height - 80,
+				     48, 48, 0.7, 0.7, 0.0, 1.0);
+	assert(busy);
+
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <assert.h>
+
+#include "pixman-test-helper.h"
+
+/*
+ * Solid color and buffer views faded to a view alpha of 1.0, 0.5 and 0,
+ * as the shell does when fading windows in and out, painted by the
+ * renderer and composited by hand with pixman for reference.
+ */
+
+#define FRAMES 50
+
+static const float alphas[] = { 1.0, 0.5, 0.0 };
+
+/* Bottom to top */
+static struct pixman_test_view *views[1 + 3 * ARRAY_LENGTH(alphas)];
+static int n_views;
+
+/* The color premultiplied by the view alpha, as fill_solid_view() does */
+static void
+fill_reference(pixman_image_t *image, struct pixman_test_view *v)
+{
+	float alpha = v->view->alpha;
+	pixman_color_t color;
+	pixman_box32_t box;
+	pixman_op_t op = PIXMAN_OP_OVER;
+
+	color.red = (uint16_t) (v->color[0] * 0xffff) * alpha;
+	color.green = (uint16_t) (v->color[1] * 0xffff) * alpha;
+	color.blue = (uint16_t) (v->color[2] * 0xffff) * alpha;
+	color.alpha = (uint16_t) (v->color[3] * 0xffff) * alpha;
+	if (color.alpha == 0xffff)
+		op = PIXMAN_OP_SRC;
+	else if (color.alpha == 0)
+		return;
+
+	box.x1 = v->view->geometry.x;
+	box.y1 = v->view->geometry.y;
+	box.x2 = box.x1 + v->surface->width;
+	box.y2 = box.y1 + v->surface->height;
+	pixman_image_fill_boxes(op, image, &color, 1, &box);
+}
+
+/* The buffer through a solid mask of the view alpha */
+static void
+composite_reference(pixman_image_t *image, struct pixman_test_view *v)
+{
+	pixman_color_t alpha_color = { 0, 0, 0, 0 };
+	pixman_image_t *src, *mask = NULL;
+
+	src = pixman_test_view_get_image(v);
+	assert(src);
+
+	if (v->view->alpha < 1.0) {
+		alpha_color.alpha = v->view->alpha * 0xffff;
+		mask = pixman_image_create_solid_fill(&alpha_color);
+		assert(mask);
+	}
+
+	pixman_image_composite32(PIXMAN_OP_OVER, src, mask, image,
+				 0, 0, 0, 0,
+				 v->view->geometry.x, v->view->geometry.y,
+				 v->surface->width, v->surface->height);
+
+	if (mask)
+		pixman_image_unref(mask);
+	pixman_image_unref(src);
+}
+
+static void
+fade_matches_reference(struct pixman_test *t)
+{
+	struct weston_compositor *compositor = t->compositor;
+	struct timespec begin, end;
+	pixman_image_t *image;
+	uint32_t *reference;
+	double ms;
+	int i;
+
+	reference = calloc(t->width * t->height, sizeof *reference);
+	assert(reference);
+	image = pixman_image_create_bits(PIXMAN_x8r8g8b8, t->width, t->height,
+					 reference, t->width * 4);
+	assert(image);
+
+	for (i = 0; i < n_views; i++) {
+		if (views[i]->buffer)
+			composite_reference(image, views[i]);
+		else
+			fill_reference(image, views[i]);
+	}
+	pixman_image_unref(image);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < FRAMES; i++)
+		pixman_test_repaint(t);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ms = (end.tv_sec - begin.tv_sec) * 1000.0 +
+		(end.tv_nsec - begin.tv_nsec) / 1000000.0;
+	fprintf(stderr, "%d frames of %dx%d: %.3f ms per frame\n",
+		FRAMES, t->width, t->height, ms / FRAMES);
+
+	assert(pixman_test_compare(t, reference, 1) == 0);
+
+	free(reference);
+	pixman_test_finish(t);
+	wl_display_terminate(compositor->wl_display);
+}
+
+static void
+add(struct pixman_test_view *v, float alpha)
+{
+	assert(v);
+	pixman_test_view_set_alpha(v, alpha);
+	views[n_views++] = v;
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct pixman_test *t;
+	unsigned int i;
+	int x;
+
+	t = pixman_test_create(compositor, fade_matches_reference);
+	assert(t);
+
+	add(pixman_test_add_solid(t, 0, 0, t->width, t->height,
+				  0.2, 0.3, 0.4, 1.0), 1.0);
+
+	/* One column per alpha: an opaque and a translucent solid color,
+	 * and a buffer with a shadow over both. */
+	for (i = 0; i < ARRAY_LENGTH(alphas); i++) {
+		x = 20 + i * 330;
+		add(pixman_test_add_solid(t, x, 20, 300, 160,
+					  0.9, 0.5, 0.1, 1.0), alphas[i]);
+		add(pixman_test_add_solid(t, x + 40, 120, 220, 160,
+					  0.25, 0.1, 0.4, 0.5), alphas[i]);
+		add(pixman_test_add_buffer(t, x + 20, 220, 260, 220, 16),
+		    alphas[i]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "pixman-test-helper.h"
+
+/* Enough for the stable views to be taken from the layer cache */
+#define FRAMES 8
+
+static struct pixman_test_view *busy;
+
+/* Once the views below 'busy' come from the layer cache, every frame
+ * must look like the first one, which repaint_surfaces() painted
+ * without the cache. */
+static void
+layer_cache_matches_repaint(struct pixman_test *t)
+{
+	struct weston_compositor *compositor = t->compositor;
+	uint32_t *reference;
+	int frame;
+
+	assert(pixman_test_set_renderer(t, "pixman-layer-cache=true") == 0);
+
+	pixman_test_repaint(t);
+	reference = pixman_test_snapshot(t);
+	assert(reference);
+
+	for (frame = 0; frame < FRAMES; frame++) {
+		pixman_test_view_touch(busy);
+		pixman_test_repaint(t);
+		assert(pixman_test_compare(t, reference, 0) == 0);
+	}
+
+	free(reference);
+	pixman_test_finish(t);
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct pixman_test *t;
+	struct pixman_test_view *v;
+
+	t = pixman_test_create(compositor, layer_cache_matches_repaint);
+	assert(t);
+
+	/* Bottom to top: an opaque background and window, a translucent
+	 * panel across the window, and a window with a shadow over both. */
+	assert(pixman_test_add_buffer(t, 0, 0, t->width, t->height, 0));
+	assert(pixman_test_add_solid(t, 100, 80, 300, 200,
+				     0.8, 0.1, 0.1, 1.0));
+	assert(pixman_test_add_solid(t, 0, 150, t->width, 40,
+				     0.1, 0.2, 0.3, 0.5));
+	v = pixman_test_add_buffer(t, 250, 120, 320, 240, 16);
+	assert(v);
+	pixman_test_view_set_alpha(v, 0.75);
+	assert(pixman_test_add_buffer(t, 300, 220, 200, 160, 8));
+
+	/* Changes every frame, so it stays out of the cache */
+	busy = pixman_test_add_solid(t, 120, 100, 64, 64,
+				     0.0, 0.5, 0.0, 1.0);
+	assert(busy);
+
+	return 0;
+}
@@ -0,0 +1,462 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/socket.h>
+
+#include "pixman-test-helper.h"
+#include "../src/pixman-renderer.h"
+#include "../shared/config-parser.h"
+
+static void
+view_attach(struct pixman_test_view *v)
+{
+	struct weston_renderer *renderer = v->test->compositor->renderer;
+
+	if (v->buffer) {
+		renderer->attach(v->surface, v->buffer);
+		renderer->flush_damage(v->surface);
+	} else {
+		weston_surface_set_color(v->surface, v->color[0], v->color[1],
+					 v->color[2], v->color[3]);
+	}
+}
+
+static void
+run_idle(void *data)
+{
+	struct pixman_test *t = data;
+
+	t->run(t);
+}
+
+static void
+frame_notify(struct wl_listener *listener, void *data)
+{
+	struct pixman_test *t =
+		container_of(listener, struct pixman_test, frame_listener);
+	struct wl_event_loop *loop;
+
+	/* Not from within the repaint, as the test replaces the renderer */
+	wl_list_remove(&t->frame_listener.link);
+	loop = wl_display_get_event_loop(t->compositor->wl_display);
+	wl_event_loop_add_idle(loop, run_idle, t);
+}
+
+/* Replace the renderer with the pixman renderer painting into our own
+ * image, and call 'run' once it has painted the first frame, so that
+ * the compositor has worked out the view list and the clip of every
+ * view.  The views are added before going back to the main loop. */
+struct pixman_test *
+pixman_test_create(struct weston_compositor *compositor,
+		   pixman_test_func_t run)
+{
+	struct pixman_test *t;
+	int sv[2];
+
+	t = zalloc(sizeof *t);
+	if (t == NULL)
+		return NULL;
+
+	t->compositor = compositor;
+	t->output = container_of(compositor->output_list.next,
+				 struct weston_output, link);
+	t->width = t->output->current_mode->width;
+	t->height = t->output->current_mode->height;
+	t->run = run;
+	t->next_id = 2;
+	wl_list_init(&t->view_list);
+
+	t->image = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+					    t->width, t->height, NULL, 0);
+	if (t->image == NULL)
+		goto err_free;
+
+	/* The buffers need a client to belong to, which never talks. */
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+		goto err_image;
+	t->client = wl_client_create(compositor->wl_display, sv[0]);
+	if (t->client == NULL) {
+		close(sv[0]);
+		close(sv[1]);
+		goto err_image;
+	}
+	t->client_fd = sv[1];
+
+	if (pixman_test_set_renderer(t, "") < 0)
+		goto err_client;
+
+	weston_layer_init(&t->layer, &compositor->layer_list);
+
+	t->frame_listener.notify = frame_notify;
+	wl_signal_add(&t->output->frame_signal, &t->frame_listener);
+	weston_output_damage(t->output);
+
+	return t;
+
+err_client:
+	wl_client_destroy(t->client);
+	close(t->client_fd);
+err_image:
+	pixman_image_unref(t->image);
+err_free:
+	free(t);
+	return NULL;
+}
+
+/* Put the noop renderer of the headless backend back */
+void
+pixman_test_finish(struct pixman_test *t)
+{
+	struct weston_compositor *ec = t->compositor;
+	struct pixman_test_view *v, *next;
+
+	wl_list_for_each_safe(v, next, &t->view_list, link) {
+		weston_surface_destroy(v->surface);
+		free(v);
+	}
+	wl_list_remove(&t->layer.link);
+
+	wl_client_destroy(t->client);
+	close(t->client_fd);
+
+	pixman_renderer_output_destroy(t->output);
+	t->output->renderer_state = NULL;
+	ec->renderer->destroy(ec);
+	noop_renderer_init(ec);
+
+	pixman_image_unref(t->image);
+	free(t);
+}
+
+/* Start over with a new pixman renderer, configured from the lines of
+ * 'core_config' as if they were in the [core] section of weston.ini.
+ * The views keep their contents, the renderer state does not. */
+int
+pixman_test_set_renderer(struct pixman_test *t, const char *core_config)
+{
+	struct weston_compositor *ec = t->compositor;
+	struct weston_config *config, *saved;
+	struct pixman_test_view *v;
+	char file[] = "/tmp/weston-pixman-test-XXXXXX";
+	char text[512];
+	int fd, len, ret;
+
+	len = snprintf(text, sizeof text, "[core]\n%s\n", core_config);
+	if (len < 0 || len >= (int) sizeof text)
+		return -1;
+
+	fd = mkstemp(file);
+	if (fd < 0)
+		return -1;
+	config = NULL;
+	if (write(fd, text, len) == len)
+		config = weston_config_parse(file);
+	close(fd);
+	unlink(file);
+	if (config == NULL)
+		return -1;
+
+	if (t->output->renderer_state) {
+		pixman_renderer_output_destroy(t->output);
+		t->output->renderer_state = NULL;
+	}
+	ec->renderer->destroy(ec);
+
+	saved = ec->config;
+	ec->config = config;
+	ret = pixman_renderer_init(ec);
+	ec->config = saved;
+	weston_config_destroy(config);
+
+	if (ret < 0) {
+		noop_renderer_init(ec);
+		return -1;
+	}
+
+	if (pixman_renderer_output_create(t->output) < 0)
+		return -1;
+	pixman_renderer_output_set_buffer(t->output, t->image);
+
+	wl_list_for_each(v, &t->view_list, link)
+		view_attach(v);
+
+	return 0;
+}
+
+static struct pixman_test_view *
+add_view(struct pixman_test *t, int x, int y, int width, int height)
+{
+	struct pixman_test_view *v;
+
+	v = zalloc(sizeof *v);
+	if (v == NULL)
+		return NULL;
+
+	v->test = t;
+	v->surface = weston_surface_create(t->compositor);
+	if (v->surface == NULL) {
+		free(v);
+		return NULL;
+	}
+
+	v->view = weston_view_create(v->surface);
+	if (v->view == NULL) {
+		weston_surface_destroy(v->surface);
+		free(v);
+		return NULL;
+	}
+
+	weston_surface_set_size(v->surface, width, height);
+	weston_view_set_position(v->view, x, y);
+	wl_list_init(&v->transform.link);
+
+	/* Each view goes on top of the ones added before */
+	wl_list_insert(&t->layer.view_list, &v->view->layer_link);
+	wl_list_insert(t->view_list.prev, &v->link);
+
+	return v;
+}
+
+struct pixman_test_view *
+pixman_test_add_solid(struct pixman_test *t, int x, int y,
+		      int width, int height,
+		      float red, float green, float blue, float alpha)
+{
+	struct pixman_test_view *v;
+
+	v = add_view(t, x, y, width, height);
+	if (v == NULL)
+		return NULL;
+
+	v->color[0] = red;
+	v->color[1] = green;
+	v->color[2] = blue;
+	v->color[3] = alpha;
+	if (alpha == 1.0) {
+		pixman_region32_fini(&v->surface->opaque);
+		pixman_region32_init_rect(&v->surface->opaque,
+					  0, 0, width, height);
+	}
+
+	view_attach(v);
+
+	return v;
+}
+
+/* Premultiplied gradient, with the alpha ramping up over the 'border'
+ * outermost pixels like a drop shadow, and opaque inside. */
+static void
+fill_pattern(uint32_t *data, int width, int height, int border)
+{
+	uint32_t a, r, g, b;
+	int x, y, d;
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			d = x;
+			if (y < d)
+				d = y;
+			if (width - 1 - x < d)
+				d = width - 1 - x;
+			if (height - 1 - y < d)
+				d = height - 1 - y;
+
+			a = d >= border ? 255 : (d + 1) * 255 / (border + 1);
+			r = (x * 255 / width) * a / 255;
+			g = (y * 255 / height) * a / 255;
+			b = 0x80 * a / 255;
+			data[y * width + x] = a << 24 | r << 16 | g << 8 | b;
+		}
+	}
+}
+
+struct pixman_test_view *
+pixman_test_add_buffer(struct pixman_test *t, int x, int y,
+		       int width, int height, int border)
+{
+	struct pixman_test_view *v;
+	struct wl_shm_buffer *shm_buffer;
+	struct wl_resource *resource;
+	uint32_t id = t->next_id++;
+
+	v = add_view(t, x, y, width, height);
+	if (v == NULL)
+		return NULL;
+
+	shm_buffer = wl_shm_buffer_create(t->client, id, width, height,
+					  width * 4, WL_SHM_FORMAT_ARGB8888);
+	if (shm_buffer == NULL) {
+		weston_log("pixman test: failed to create a shm buffer\n");
+		return NULL;
+	}
+
+	resource = wl_client_get_object(t->client, id);
+	v->buffer = weston_buffer_from_resource(resource);
+	if (v->buffer == NULL)
+		return NULL;
+	weston_buffer_reference(&v->surface->buffer_ref, v->buffer);
+
+	fill_pattern(wl_shm_buffer_get_data(shm_buffer), width, height,
+		     border);
+	if (border * 2 < width && border * 2 < height) {
+		pixman_region32_fini(&v->surface->opaque);
+		pixman_region32_init_rect(&v->surface->opaque, border, border,
+					  width - border * 2,
+					  height - border * 2);
+	}
+
+	view_attach(v);
+
+	return v;
+}
+
+/* Changes to the geometry and the alpha only reach view->clip and the
+ * opaque regions in a real frame, so make them before the first one. */
+void
+pixman_test_view_set_alpha(struct pixman_test_view *v, float alpha)
+{
+	v->view->alpha = alpha;
+	weston_view_geometry_dirty(v->view);
+}
+
+/* Rotate by 'degrees' and scale by 'scale' around the middle */
+void
+pixman_test_view_transform(struct pixman_test_view *v,
+			   float degrees, float scale)
+{
+	struct weston_matrix *matrix = &v->transform.matrix;
+	float cx = v->surface->width * 0.5f;
+	float cy = v->surface->height * 0.5f;
+	float rad = degrees * M_PI / 180.0f;
+
+	weston_matrix_init(matrix);
+	weston_matrix_translate(matrix, -cx, -cy, 0.0f);
+	weston_matrix_scale(matrix, scale, scale, 1.0f);
+	weston_matrix_rotate_xy(matrix, cosf(rad), sinf(rad));
+	weston_matrix_translate(matrix, cx, cy, 0.0f);
+
+	wl_list_remove(&v->transform.link);
+	wl_list_insert(&v->view->geometry.transformation_list,
+		       &v->transform.link);
+	weston_view_geometry_dirty(v->view);
+}
+
+/* Tell the renderer the contents changed, without changing them */
+void
+pixman_test_view_touch(struct pixman_test_view *v)
+{
+	view_attach(v);
+}
+
+/* The pixels of a buffer view, for painting references with */
+pixman_image_t *
+pixman_test_view_get_image(struct pixman_test_view *v)
+{
+	struct wl_shm_buffer *shm_buffer;
+
+	shm_buffer = wl_shm_buffer_get(v->buffer->resource);
+
+	return pixman_image_create_bits(PIXMAN_a8r8g8b8,
+					wl_shm_buffer_get_width(shm_buffer),
+					wl_shm_buffer_get_height(shm_buffer),
+					wl_shm_buffer_get_data(shm_buffer),
+					wl_shm_buffer_get_stride(shm_buffer));
+}
+
+/* Paint the whole output, with the view list of the last real frame */
+void
+pixman_test_repaint(struct pixman_test *t)
+{
+	pixman_region32_t damage;
+
+	pixman_region32_init(&damage);
+	pixman_region32_copy(&damage, &t->output->region);
+	t->compositor->renderer->repaint_output(t->output, &damage);
+	pixman_region32_fini(&damage);
+}
+
+/* A copy of the output image, packed one row after the other */
+uint32_t *
+pixman_test_snapshot(struct pixman_test *t)
+{
+	uint8_t *src = (uint8_t *) pixman_image_get_data(t->image);
+	int stride = pixman_image_get_stride(t->image);
+	uint32_t *pixels;
+	int y;
+
+	pixels = malloc(t->width * t->height * 4);
+	if (pixels == NULL)
+		return NULL;
+
+	for (y = 0; y < t->height; y++)
+		memcpy(pixels + y * t->width, src + y * stride, t->width * 4);
+
+	return pixels;
+}
+
+/* Count the pixels of the output image that are off from 'reference'
+ * by more than 'tolerance' in any channel, logging the first one.  The
+ * x8 byte of the output format is left out. */
+int
+pixman_test_compare(struct pixman_test *t, const uint32_t *reference,
+		    int tolerance)
+{
+	uint32_t *pixels, a, b;
+	int x, y, shift, bad = 0;
+
+	pixels = pixman_test_snapshot(t);
+	if (pixels == NULL)
+		return -1;
+
+	for (y = 0; y < t->height; y++) {
+		for (x = 0; x < t->width; x++) {
+			a = pixels[y * t->width + x];
+			b = reference[y * t->width + x];
+
+			for (shift = 0; shift < 24; shift += 8)
+				if (abs((int) ((a >> shift) & 0xff) -
+					(int) ((b >> shift) & 0xff)) >
+				    tolerance)
+					break;
+			if (shift == 24)
+				continue;
+
+			if (bad++ == 0)
+				fprintf(stderr, "pixel %d,%d is %06x, "
+					"expected %06x\n", x, y,
+					a & 0xffffff, b & 0xffffff);
+		}
+	}
+
+	if (bad)
+		fprintf(stderr, "%d pixels differ\n", bad);
+	free(pixels);
+
+	return bad;
+}
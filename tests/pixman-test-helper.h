@@ -0,0 +1,109 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WESTON_PIXMAN_TEST_HELPER_H_
+#define _WESTON_PIXMAN_TEST_HELPER_H_
+
+#include <stdint.h>
+#include <pixman.h>
+
+#include "../src/compositor.h"
+
+/*
+ * Scaffolding for compositor modules that run the pixman renderer on
+ * the first output of the headless backend.  The renderer paints into
+ * an image of our own, above everything else the compositor shows.
+ */
+
+struct pixman_test;
+
+typedef void (*pixman_test_func_t)(struct pixman_test *t);
+
+struct pixman_test {
+	struct weston_compositor *compositor;
+	struct weston_output *output;
+	pixman_image_t *image;
+	int width, height;
+
+	struct weston_layer layer;
+	struct wl_client *client;
+	int client_fd;
+	uint32_t next_id;
+	struct wl_list view_list;
+
+	struct wl_listener frame_listener;
+	pixman_test_func_t run;
+};
+
+struct pixman_test_view {
+	struct pixman_test *test;
+	struct weston_surface *surface;
+	struct weston_view *view;
+	struct weston_buffer *buffer;	/* NULL for a solid color */
+	float color[4];
+	struct weston_transform transform;
+	struct wl_list link;
+};
+
+struct pixman_test *
+pixman_test_create(struct weston_compositor *compositor,
+		   pixman_test_func_t run);
+
+void
+pixman_test_finish(struct pixman_test *t);
+
+int
+pixman_test_set_renderer(struct pixman_test *t, const char *core_config);
+
+struct pixman_test_view *
+pixman_test_add_solid(struct pixman_test *t, int x, int y,
+		      int width, int height,
+		      float red, float green, float blue, float alpha);
+
+struct pixman_test_view *
+pixman_test_add_buffer(struct pixman_test *t, int x, int y,
+		       int width, int height, int border);
+
+void
+pixman_test_view_set_alpha(struct pixman_test_view *v, float alpha);
+
+void
+pixman_test_view_transform(struct pixman_test_view *v,
+			   float degrees, float scale);
+
+void
+pixman_test_view_touch(struct pixman_test_view *v);
+
+pixman_image_t *
+pixman_test_view_get_image(struct pixman_test_view *v);
+
+void
+pixman_test_repaint(struct pixman_test *t);
+
+uint32_t *
+pixman_test_snapshot(struct pixman_test *t);
+
+int
+pixman_test_compare(struct pixman_test *t, const uint32_t *reference,
+		    int tolerance);
+
+#endif
@@ -0,0 +1,222 @@
+/*
+ * Copyright © 2013 Sam Spilsbury <smspillaz@gmail.com>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-server.h>
+
+#include "weston-test-runner.h"
+
+#include "../src/shm-convert.h"
+
+#define WIDTH 67
+#define HEIGHT 9
+#define MAX_SPAN 40
+
+/* BT.601 limited range, in floating point, with the pixel at (x, y)
+ * taking its chroma from the sample covering it. */
+static uint32_t
+reference_yuv(int y, int u, int v)
+{
+	double yf = 1.164383 * (y - 16);
+	double r = yf + 1.596027 * (v - 128);
+	double g = yf - 0.391762 * (u - 128) - 0.812968 * (v - 128);
+	double b = yf + 2.017232 * (u - 128);
+	double c[3] = { r, g, b };
+	uint32_t p = 0xff;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		if (c[i] < 0.0)
+			c[i] = 0.0;
+		if (c[i] > 255.0)
+			c[i] = 255.0;
+		p = p << 8 | (uint32_t) (c[i] + 0.5);
+	}
+
+	return p;
+}
+
+static uint32_t
+reference_2101010(uint32_t p, int alpha)
+{
+	uint32_t a = alpha ? (p >> 30) * 255 / 3 : 0xff;
+
+	return a << 24 |
+	       ((p >> 20) & 0x3ff) * 255 / 1023 << 16 |
+	       ((p >> 10) & 0x3ff) * 255 / 1023 << 8 |
+	       (p & 0x3ff) * 255 / 1023;
+}
+
+/* The fixed point kernels may be off by one from the real numbers, and
+ * the 10-bit ones truncate. */
+static void
+assert_close(uint32_t a, uint32_t b)
+{
+	int shift, d;
+
+	for (shift = 0; shift < 32; shift += 8) {
+		d = (int) ((a >> shift) & 0xff) - (int) ((b >> shift) & 0xff);
+		assert(d >= -1 && d <= 1);
+	}
+}
+
+static void
+fill_random(void *data, size_t size, unsigned int seed)
+{
+	uint8_t *p = data;
+	size_t i;
+
+	srand(seed);
+	for (i = 0; i < size; i++)
+		p[i] = rand();
+}
+
+TEST(yuv_black_and_white)
+{
+	uint8_t y[2] = { 16, 235 }, uv[2] = { 128, 128 };
+	uint32_t dst[2];
+
+	shm_convert_nv12_row_scalar(dst, y, uv, 0, 2);
+	assert(dst[0] == 0xff000000);
+	assert(dst[1] == 0xffffffff);
+
+	shm_convert_nv12_row(dst, y, uv, 0, 2);
+	assert(dst[0] == 0xff000000);
+	assert(dst[1] == 0xffffffff);
+}
+
+TEST(nv12_matches_reference)
+{
+	uint8_t *src = malloc(WIDTH * HEIGHT * 3 / 2 + WIDTH);
+	uint8_t *luma, *chroma;
+	uint32_t simd[WIDTH], scalar[WIDTH];
+	int x, y, width;
+
+	fill_random(src, WIDTH * HEIGHT * 3 / 2 + WIDTH, 1);
+
+	for (y = 0; y < HEIGHT; y++) {
+		luma = src + y * WIDTH;
+		chroma = src + WIDTH * HEIGHT + y / 2 * WIDTH;
+
+		for (x = 0; x < 4; x++)
+			for (width = 0; width <= MAX_SPAN; width++) {
+				memset(simd, 0, sizeof simd);
+				memset(scalar, 0, sizeof scalar);
+				shm_convert_nv12_row(simd, luma, chroma,
+						     x, width);
+				shm_convert_nv12_row_scalar(scalar, luma,
+							    chroma, x, width);
+				assert(memcmp(simd, scalar, sizeof simd) == 0);
+			}
+
+		shm_convert_nv12_row(simd, luma, chroma, 0, WIDTH);
+		for (x = 0; x < WIDTH; x++)
+			assert_close(simd[x],
+				     reference_yuv(luma[x],
+						   chroma[x / 2 * 2],
+						   chroma[x / 2 * 2 + 1]));
+	}
+
+	free(src);
+}
+
+TEST(yuyv_matches_reference)
+{
+	uint8_t *src = malloc(WIDTH * 2 + 2);
+	uint32_t simd[WIDTH], scalar[WIDTH];
+	int x, width, m;
+
+	fill_random(src, WIDTH * 2 + 2, 2);
+
+	for (x = 0; x < 4; x++)
+		for (width = 0; width <= MAX_SPAN; width++) {
+			memset(simd, 0, sizeof simd);
+			memset(scalar, 0, sizeof scalar);
+			shm_convert_yuyv_row(simd, src, x, width);
+			shm_convert_yuyv_row_scalar(scalar, src, x, width);
+			assert(memcmp(simd, scalar, sizeof simd) == 0);
+		}
+
+	shm_convert_yuyv_row(simd, src, 0, WIDTH);
+	for (x = 0; x < WIDTH; x++) {
+		m = x / 2 * 4;
+		assert_close(simd[x], reference_yuv(src[x * 2],
+						    src[m + 1], src[m + 3]));
+	}
+
+	free(src);
+}
+
+TEST(rgb2101010_matches_reference)
+{
+	uint32_t src[WIDTH], simd[WIDTH], scalar[WIDTH];
+	int x, width, alpha;
+
+	fill_random(src, sizeof src, 3);
+
+	for (alpha = 0; alpha < 2; alpha++) {
+		for (x = 0; x < 4; x++)
+			for (width = 0; width <= MAX_SPAN; width++) {
+				memset(simd, 0, sizeof simd);
+				memset(scalar, 0, sizeof scalar);
+				shm_convert_2101010_row(simd, src, x, width,
+							alpha);
+				shm_convert_2101010_row_scalar(scalar, src, x,
+							       width, alpha);
+				assert(memcmp(simd, scalar,
+					      sizeof simd) == 0);
+			}
+
+		shm_convert_2101010_row(simd, src, 0, WIDTH, alpha);
+		for (x = 0; x < WIDTH; x++)
+			assert_close(simd[x],
+				     reference_2101010(src[x], alpha));
+	}
+}
+
+TEST(box_converts_only_the_box)
+{
+	uint8_t src[16 * 4 * 3 / 2];
+	uint32_t dst[16 * 4];
+	pixman_box32_t box = { 3, 1, 11, 3 };
+	int x, y;
+
+	fill_random(src, sizeof src, 4);
+	memset(dst, 0, sizeof dst);
+
+	shm_convert_box(WL_SHM_FORMAT_NV12, src, 16, 4, dst, 16 * 4, &box);
+
+	for (y = 0; y < 4; y++)
+		for (x = 0; x < 16; x++) {
+			if (x < box.x1 || x >= box.x2 ||
+			    y < box.y1 || y >= box.y2) {
+				assert(dst[y * 16 + x] == 0);
+				continue;
+			}
+			assert_close(dst[y * 16 + x],
+				     reference_yuv(src[y * 16 + x],
+						   src[64 + y / 2 * 16 + x / 2 * 2],
+						   src[64 + y / 2 * 16 + x / 2 * 2 + 1]));
+		}
+}
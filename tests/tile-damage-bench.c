@@ -0,0 +1,301 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pixman.h>
+
+#include "../src/tile-damage.h"
+
+/*
+ * Compares the damage path with and without tile coarsening.  A frame
+ * unions the damage rectangles of one commit the way surface_damage()
+ * does, then clips the result against a few views the way the renderers
+ * do.  With tiles, the damage is coarsened whenever it grows past the
+ * threshold, like weston_compositor_simplify_damage().
+ */
+
+#define WIDTH		1920
+#define HEIGHT		1080
+#define THRESHOLD	64
+
+struct pattern {
+	const char *name;
+	pixman_box32_t *rects;
+	int count;
+};
+
+static const pixman_box32_t views[] = {
+	{ 0, 0, WIDTH, HEIGHT },
+	{ 100, 80, 1100, 780 },
+	{ 700, 300, 1800, 1000 },
+	{ 0, 0, WIDTH, 32 },
+};
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+static volatile int running;
+static void
+stopme(int n)
+{
+	running = 0;
+}
+
+static void
+add_rect(struct pattern *p, int32_t x, int32_t y, int32_t w, int32_t h)
+{
+	pixman_box32_t *box = &p->rects[p->count++];
+
+	box->x1 = x;
+	box->y1 = y;
+	box->x2 = x + w;
+	box->y2 = y + h;
+}
+
+/* A few widgets changing: a cursor, a clock, a progress bar. */
+static void
+pattern_typical(struct pattern *p)
+{
+	add_rect(p, 412, 300, 2, 18);
+	add_rect(p, 1800, 4, 100, 24);
+	add_rect(p, 600, 700, 320, 12);
+	add_rect(p, 120, 96, 500, 18);
+	add_rect(p, 120, 114, 500, 18);
+	add_rect(p, 1300, 500, 48, 48);
+}
+
+/* A terminal updating scattered glyph cells on most of its lines. */
+static void
+pattern_terminal(struct pattern *p)
+{
+	int row, i;
+
+	for (row = 0; row < 40; row++)
+		for (i = 0; i < 12; i++)
+			add_rect(p, 100 + (random() % 110) * 9,
+				 80 + row * 18, 9, 18);
+}
+
+/* A spreadsheet recalculating every other cell. */
+static void
+pattern_spreadsheet(struct pattern *p)
+{
+	int row, col;
+
+	for (row = 0; row < 40; row++)
+		for (col = (row & 1); col < 16; col += 2)
+			add_rect(p, 100 + col * 80, 100 + row * 20, 79, 19);
+}
+
+/* Tiny rectangles all over the screen. */
+static void
+pattern_pathological(struct pattern *p)
+{
+	int i;
+
+	for (i = 0; i < 2000; i++)
+		add_rect(p, random() % (WIDTH - 4), random() % (HEIGHT - 4),
+			 1 + random() % 4, 1 + random() % 4);
+}
+
+static uint64_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *rects;
+	uint64_t area = 0;
+	int i, n;
+
+	rects = pixman_region32_rectangles(region, &n);
+	for (i = 0; i < n; i++)
+		area += (uint64_t) (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	return area;
+}
+
+static void
+accumulate(const struct pattern *p, struct tile_damage *td,
+	   pixman_region32_t *damage)
+{
+	pixman_box32_t *r;
+	int i;
+
+	for (i = 0; i < p->count; i++) {
+		r = &p->rects[i];
+		pixman_region32_union_rect(damage, damage, r->x1, r->y1,
+					   r->x2 - r->x1, r->y2 - r->y1);
+		if (td && pixman_region32_n_rects(damage) > THRESHOLD)
+			tile_damage_simplify(td, damage, THRESHOLD / 2);
+	}
+}
+
+static int
+frame(const struct pattern *p, struct tile_damage *td)
+{
+	pixman_region32_t damage, repaint;
+	unsigned int i;
+	int rects = 0;
+
+	pixman_region32_init(&damage);
+	accumulate(p, td, &damage);
+
+	for (i = 0; i < sizeof views / sizeof views[0]; i++) {
+		pixman_region32_init_rect(&repaint, views[i].x1, views[i].y1,
+					  views[i].x2 - views[i].x1,
+					  views[i].y2 - views[i].y1);
+		pixman_region32_intersect(&repaint, &repaint, &damage);
+		rects += pixman_region32_n_rects(&repaint);
+		pixman_region32_fini(&repaint);
+	}
+
+	pixman_region32_fini(&damage);
+
+	return rects;
+}
+
+static int
+test_coverage(const struct pattern *p, struct tile_damage *td)
+{
+	pixman_region32_t exact, tiled;
+	int i, failed = 0;
+
+	pixman_region32_init(&exact);
+	pixman_region32_init(&tiled);
+	accumulate(p, NULL, &exact);
+	accumulate(p, td, &tiled);
+
+	for (i = 0; i < p->count; i++)
+		if (pixman_region32_contains_rectangle(&tiled, &p->rects[i]) !=
+		    PIXMAN_REGION_IN) {
+			printf("rectangle %d,%d %dx%d not covered\n",
+			       p->rects[i].x1, p->rects[i].y1,
+			       p->rects[i].x2 - p->rects[i].x1,
+			       p->rects[i].y2 - p->rects[i].y1);
+			failed++;
+		}
+
+	printf("exact: %d rects, %llu pixels; tiled: %d rects, "
+	       "%llu pixels\n",
+	       pixman_region32_n_rects(&exact),
+	       (unsigned long long) region_area(&exact),
+	       pixman_region32_n_rects(&tiled),
+	       (unsigned long long) region_area(&tiled));
+
+	pixman_region32_fini(&exact);
+	pixman_region32_fini(&tiled);
+
+	return failed;
+}
+
+static void __attribute__((noinline))
+test_loop_speed(const struct pattern *p, struct tile_damage *td)
+{
+	unsigned long n = 0;
+	int rects = 0;
+	double t;
+
+	printf("Running 3 s test on the %s path...\n",
+	       td ? "tile" : "region");
+
+	running = 1;
+	alarm(3);
+	reset_timer();
+	while (running) {
+		rects += frame(p, td);
+		n++;
+	}
+	t = read_timer();
+
+	printf("%lu frames in %f seconds, avg. %.1f us/frame "
+	       "(%d rects to paint).\n",
+	       n, t, 1e6 * t / n, rects / (int) n);
+}
+
+int main(int argc, char *argv[])
+{
+	static void (* const generators[])(struct pattern *) = {
+		pattern_typical,
+		pattern_terminal,
+		pattern_spreadsheet,
+		pattern_pathological,
+	};
+	static const char * const names[] = {
+		"typical", "terminal", "spreadsheet", "pathological"
+	};
+	struct sigaction ding;
+	struct tile_damage td;
+	struct pattern p;
+	unsigned int i;
+	int failed = 0;
+
+	ding.sa_handler = stopme;
+	sigemptyset(&ding.sa_mask);
+	ding.sa_flags = 0;
+	sigaction(SIGALRM, &ding, NULL);
+
+	srandom(13);
+	tile_damage_init(&td);
+
+	p.rects = malloc(4096 * sizeof *p.rects);
+	if (!p.rects)
+		return 1;
+
+	for (i = 0; i < sizeof generators / sizeof generators[0]; i++) {
+		p.name = names[i];
+		p.count = 0;
+		generators[i](&p);
+
+		printf("\n%s damage, %d rectangles:\n", p.name, p.count);
+		failed += test_coverage(&p, &td);
+
+		test_loop_speed(&p, NULL);
+		test_loop_speed(&p, &td);
+	}
+
+	free(p.rects);
+	tile_damage_release(&td);
+
+	printf("\n%d uncovered rectangles\n", failed);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,311 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pixman.h>
+
+#include "weston-test-runner.h"
+
+#include "../src/tile-damage.h"
+
+/*
+ * Whatever tile_damage_to_region() and tile_damage_simplify() give up in
+ * detail, the result must still cover all of the damage that went in,
+ * stay inside the bounds and use no more than max_rects rectangles.
+ */
+
+struct damage_case {
+	pixman_box32_t bounds;
+	int count;
+	int max_rects;
+};
+
+static const struct damage_case damage_cases[] = {
+	/* Typical output, a few rectangles. */
+	{ { 0, 0, 1920, 1080 }, 6, 64 },
+	/* Many rectangles, forces merging runs into rows. */
+	{ { 0, 0, 1920, 1080 }, 2000, 64 },
+	/* Size not a multiple of the tile size, so edge tiles stick out. */
+	{ { 0, 0, 1000, 700 }, 300, 32 },
+	/* Negative and unaligned origin, like an output left of another. */
+	{ { -1917, -37, 3, 1043 }, 500, 16 },
+	{ { -100, -100, -10, -20 }, 50, 4 },
+	/* Bounds too big for 64x64 tiles. */
+	{ { -4000, 0, 12000, 9000 }, 1000, 64 },
+	/* Coarse fallback down to a single rectangle. */
+	{ { 0, 0, 1920, 1080 }, 2000, 1 },
+	{ { 17, 3, 1300, 1299 }, 2000, 3 },
+};
+
+static void
+random_boxes(const pixman_box32_t *bounds, pixman_box32_t *boxes, int count)
+{
+	int32_t width = bounds->x2 - bounds->x1;
+	int32_t height = bounds->y2 - bounds->y1;
+	int i;
+
+	/* Let some boxes hang over the bounds. */
+	for (i = 0; i < count; i++) {
+		boxes[i].x1 = bounds->x1 - 20 + random() % (width + 20);
+		boxes[i].y1 = bounds->y1 - 20 + random() % (height + 20);
+		boxes[i].x2 = boxes[i].x1 + 1 + random() % 90;
+		boxes[i].y2 = boxes[i].y1 + 1 + random() % 40;
+	}
+}
+
+static void
+clip_box(pixman_box32_t *box, const pixman_box32_t *bounds)
+{
+	if (box->x1 < bounds->x1)
+		box->x1 = bounds->x1;
+	if (box->y1 < bounds->y1)
+		box->y1 = bounds->y1;
+	if (box->x2 > bounds->x2)
+		box->x2 = bounds->x2;
+	if (box->y2 > bounds->y2)
+		box->y2 = bounds->y2;
+}
+
+static void
+assert_covers(pixman_region32_t *region, const pixman_box32_t *boxes,
+	      int count, const pixman_box32_t *bounds)
+{
+	pixman_box32_t box;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		box = boxes[i];
+		clip_box(&box, bounds);
+		if (box.x1 >= box.x2 || box.y1 >= box.y2)
+			continue;
+
+		assert(pixman_region32_contains_rectangle(region, &box) ==
+		       PIXMAN_REGION_IN);
+	}
+}
+
+static void
+assert_inside(pixman_region32_t *region, const pixman_box32_t *bounds)
+{
+	pixman_box32_t *extents;
+
+	if (!pixman_region32_not_empty(region))
+		return;
+
+	extents = pixman_region32_extents(region);
+	assert(extents->x1 >= bounds->x1);
+	assert(extents->y1 >= bounds->y1);
+	assert(extents->x2 <= bounds->x2);
+	assert(extents->y2 <= bounds->y2);
+}
+
+TEST_P(to_region_covers_damage, damage_cases)
+{
+	const struct damage_case *c = data;
+	struct tile_damage td;
+	pixman_region32_t region;
+	pixman_box32_t *boxes;
+	int i, n;
+
+	srandom(c->count * 31 + c->max_rects);
+	boxes = malloc(c->count * sizeof *boxes);
+	assert(boxes);
+	random_boxes(&c->bounds, boxes, c->count);
+
+	tile_damage_init(&td);
+	assert(tile_damage_reset(&td, &c->bounds) == 0);
+	for (i = 0; i < c->count; i++)
+		tile_damage_add_box(&td, &boxes[i]);
+
+	pixman_region32_init(&region);
+	n = tile_damage_to_region(&td, &region, c->max_rects);
+	assert(n >= 0 && n <= c->max_rects);
+	assert(pixman_region32_n_rects(&region) <= c->max_rects);
+
+	assert_covers(&region, boxes, c->count, &c->bounds);
+	assert_inside(&region, &c->bounds);
+
+	pixman_region32_fini(&region);
+	tile_damage_release(&td);
+	free(boxes);
+}
+
+TEST(edge_tiles_are_clipped_to_bounds)
+{
+	static const pixman_box32_t bounds = { -70, -5, 130, 100 };
+	static const pixman_box32_t boxes[] = {
+		{ -70, -5, -69, -4 },
+		{ 129, 99, 130, 100 },
+		{ 100, -50, 200, 0 },
+	};
+	struct tile_damage td;
+	pixman_region32_t region;
+	pixman_box32_t *extents;
+	unsigned int i;
+
+	tile_damage_init(&td);
+	assert(tile_damage_reset(&td, &bounds) == 0);
+	for (i = 0; i < sizeof boxes / sizeof boxes[0]; i++)
+		tile_damage_add_box(&td, &boxes[i]);
+
+	pixman_region32_init(&region);
+	assert(tile_damage_to_region(&td, &region, 16) >= 0);
+	assert_covers(&region, boxes, 3, &bounds);
+
+	/* The corner tiles reach past the bounds on every side. */
+	extents = pixman_region32_extents(&region);
+	assert(extents->x1 == bounds.x1 && extents->y1 == bounds.y1);
+	assert(extents->x2 == bounds.x2 && extents->y2 == bounds.y2);
+
+	pixman_region32_fini(&region);
+	tile_damage_release(&td);
+}
+
+TEST(damage_outside_bounds_is_dropped)
+{
+	static const pixman_box32_t bounds = { 0, 0, 640, 480 };
+	static const pixman_box32_t empty = { 10, 10, 10, 20 };
+	static const pixman_box32_t outside[] = {
+		{ -100, 0, 0, 480 },
+		{ 640, 0, 700, 480 },
+		{ 0, 480, 640, 500 },
+	};
+	struct tile_damage td;
+	pixman_region32_t region;
+	unsigned int i;
+
+	tile_damage_init(&td);
+	assert(tile_damage_reset(&td, &bounds) == 0);
+	for (i = 0; i < sizeof outside / sizeof outside[0]; i++)
+		tile_damage_add_box(&td, &outside[i]);
+
+	pixman_region32_init_rect(&region, 0, 0, 1, 1);
+	assert(tile_damage_to_region(&td, &region, 8) == 0);
+	assert(!pixman_region32_not_empty(&region));
+
+	/* Empty bounds take no damage at all. */
+	assert(tile_damage_reset(&td, &empty) == 0);
+	tile_damage_add_box(&td, &bounds);
+	assert(tile_damage_to_region(&td, &region, 8) == 0);
+	assert(!pixman_region32_not_empty(&region));
+
+	pixman_region32_fini(&region);
+	tile_damage_release(&td);
+}
+
+TEST(checkerboard_falls_back_to_bands)
+{
+	static const pixman_box32_t bounds = { 0, 0, 2048, 2048 };
+	struct tile_damage td;
+	pixman_region32_t region;
+	pixman_box32_t box;
+	int32_t r, c;
+	int max_rects;
+
+	/* Every other tile, so no two tiles ever merge. */
+	tile_damage_init(&td);
+	for (max_rects = 1; max_rects <= 64; max_rects *= 2) {
+		assert(tile_damage_reset(&td, &bounds) == 0);
+		for (r = 0; r < 32; r++) {
+			for (c = r & 1; c < 32; c += 2) {
+				box.x1 = c * 64 + 10;
+				box.y1 = r * 64 + 10;
+				box.x2 = box.x1 + 1;
+				box.y2 = box.y1 + 1;
+				tile_damage_add_box(&td, &box);
+			}
+		}
+
+		pixman_region32_init(&region);
+		assert(tile_damage_to_region(&td, &region, max_rects) > 0);
+		assert(pixman_region32_n_rects(&region) <= max_rects);
+
+		for (r = 0; r < 32; r++) {
+			for (c = r & 1; c < 32; c += 2)
+				assert(pixman_region32_contains_point(&region,
+						c * 64 + 10, r * 64 + 10,
+						NULL));
+		}
+
+		pixman_region32_fini(&region);
+	}
+	tile_damage_release(&td);
+}
+
+TEST(simplify_keeps_small_regions)
+{
+	static const pixman_box32_t boxes[] = {
+		{ 0, 0, 3, 3 },
+		{ 100, 0, 103, 3 },
+		{ 50, 50, 51, 51 },
+	};
+	struct tile_damage td;
+	pixman_region32_t region;
+	pixman_box32_t *rects;
+	int n;
+
+	tile_damage_init(&td);
+	pixman_region32_init_rects(&region, boxes, 3);
+
+	assert(tile_damage_simplify(&td, &region, 3) == 0);
+	rects = pixman_region32_rectangles(&region, &n);
+	assert(n == 3);
+	assert(rects[0].x2 - rects[0].x1 == 3);
+
+	pixman_region32_fini(&region);
+	tile_damage_release(&td);
+}
+
+static const int simplify_limits[] = { 1, 2, 7, 64 };
+
+TEST_P(simplify_covers_region, simplify_limits)
+{
+	const int *max_rects = data;
+	struct tile_damage td;
+	pixman_region32_t region;
+	pixman_box32_t boxes[400];
+	pixman_box32_t extents;
+	int i;
+
+	/* Disjoint cells at a negative offset. */
+	for (i = 0; i < 400; i++) {
+		boxes[i].x1 = -1000 + (i % 20) * 50 + (i / 20) % 7;
+		boxes[i].y1 = -700 + (i / 20) * 40;
+		boxes[i].x2 = boxes[i].x1 + 1 + i % 11;
+		boxes[i].y2 = boxes[i].y1 + 1 + i % 13;
+	}
+
+	tile_damage_init(&td);
+	pixman_region32_init_rects(&region, boxes, 400);
+	assert(pixman_region32_n_rects(&region) > *max_rects);
+	extents = *pixman_region32_extents(&region);
+
+	assert(tile_damage_simplify(&td, &region, *max_rects) == 0);
+	assert(pixman_region32_n_rects(&region) <= *max_rects);
+	assert_covers(&region, boxes, 400, &extents);
+	assert_inside(&region, &extents);
+
+	pixman_region32_fini(&region);
+	tile_damage_release(&td);
+}